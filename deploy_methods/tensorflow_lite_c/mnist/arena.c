@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_POOL_MAX 64 // chunk standard tenuti in riserva
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size; // byte totali del chunk, header compreso
+} __attribute__((aligned(ARENA_ALIGN)));
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct arena_chunk *pool;
+static int pool_count;
+
+void mem_budget_init(struct mem_budget *budget, size_t limit) {
+    memset(budget, 0, sizeof(*budget));
+    pthread_mutex_init(&budget->lock, NULL);
+    budget->limit = limit;
+}
+
+int mem_budget_charge(struct mem_budget *budget, size_t size) {
+    if (budget == NULL)
+        return 0;
+    int ret = 0;
+    pthread_mutex_lock(&budget->lock);
+    if (budget->limit > 0 && budget->used + size > budget->limit) {
+        budget->rejected++;
+        ret = -1;
+    } else {
+        budget->used += size;
+        if (budget->used > budget->high_water)
+            budget->high_water = budget->used;
+    }
+    pthread_mutex_unlock(&budget->lock);
+    return ret;
+}
+
+void mem_budget_uncharge(struct mem_budget *budget, size_t size) {
+    if (budget == NULL)
+        return;
+    pthread_mutex_lock(&budget->lock);
+    budget->used -= size;
+    pthread_mutex_unlock(&budget->lock);
+}
+
+static struct arena_chunk *chunk_get(size_t size) {
+    struct arena_chunk *chunk = NULL;
+    if (size == ARENA_CHUNK_SIZE) {
+        pthread_mutex_lock(&pool_lock);
+        if ((chunk = pool) != NULL) {
+            pool = chunk->next;
+            pool_count--;
+        }
+        pthread_mutex_unlock(&pool_lock);
+    }
+    if (chunk == NULL && (chunk = malloc(size)) != NULL)
+        chunk->size = size;
+    return chunk;
+}
+
+static void chunk_put(struct arena_chunk *chunk) {
+    if (chunk->size == ARENA_CHUNK_SIZE) {
+        pthread_mutex_lock(&pool_lock);
+        if (pool_count < ARENA_POOL_MAX) {
+            chunk->next = pool;
+            pool = chunk;
+            pool_count++;
+            chunk = NULL;
+        }
+        pthread_mutex_unlock(&pool_lock);
+    }
+    free(chunk);
+}
+
+void arena_init(struct arena *arena, struct mem_budget *budget, size_t limit) {
+    memset(arena, 0, sizeof(*arena));
+    arena->budget = budget;
+    arena->limit = limit;
+}
+
+void *arena_alloc(struct arena *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size <= arena->left) {
+        void *p = arena->cur;
+        arena->cur += size;
+        arena->left -= size;
+        return p;
+    }
+
+    // Le allocazioni grandi hanno un chunk dedicato e non consumano quello corrente
+    size_t chunk_size = sizeof(struct arena_chunk) + size;
+    int dedicated = chunk_size > ARENA_CHUNK_SIZE / 4;
+    if (!dedicated)
+        chunk_size = ARENA_CHUNK_SIZE;
+    if (arena->limit > 0 && arena->used + chunk_size > arena->limit)
+        return NULL;
+    if (mem_budget_charge(arena->budget, chunk_size) < 0)
+        return NULL;
+    struct arena_chunk *chunk = chunk_get(chunk_size);
+    if (chunk == NULL) {
+        mem_budget_uncharge(arena->budget, chunk_size);
+        return NULL;
+    }
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->used += chunk_size;
+    if (arena->used > arena->high_water)
+        arena->high_water = arena->used;
+
+    char *p = (char *)(chunk + 1);
+    if (!dedicated) {
+        arena->cur = p + size;
+        arena->left = ARENA_CHUNK_SIZE - sizeof(*chunk) - size;
+    }
+    return p;
+}
+
+void arena_release(struct arena *arena) {
+    struct arena_chunk *chunk = arena->chunks;
+    while (chunk != NULL) {
+        struct arena_chunk *next = chunk->next;
+        chunk_put(chunk);
+        chunk = next;
+    }
+    mem_budget_uncharge(arena->budget, arena->used);
+    arena->chunks = NULL;
+    arena->cur = NULL;
+    arena->left = 0;
+    arena->used = 0;
+}
+
+int mem_rss_kb(long *rss_kb, long *hwm_kb) {
+    FILE *status = fopen("/proc/self/status", "r");
+    char line[128];
+    if (status == NULL)
+        return -1;
+    *rss_kb = *hwm_kb = 0;
+    while (fgets(line, sizeof(line), status) != NULL) {
+        if (strncmp(line, "VmRSS:", 6) == 0)
+            *rss_kb = atol(line + 6);
+        else if (strncmp(line, "VmHWM:", 6) == 0)
+            *hwm_kb = atol(line + 6);
+    }
+    fclose(status);
+    return 0;
+}
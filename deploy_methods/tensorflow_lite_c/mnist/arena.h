@@ -0,0 +1,55 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/*
+ * Allocazione a regioni per richiesta con budget di memoria.
+ *
+ * Ogni richiesta alloca tutto da una propria arena (allocazioni a
+ * incremento dentro chunk da ARENA_CHUNK_SIZE, o chunk dedicati per i blocchi
+ * grandi) e la rilascia in un colpo solo alla fine. L'arena rifiuta
+ * un'allocazione che farebbe superare il budget della richiesta o quello
+ * globale condiviso da tutte le richieste: il chiamante decide se riusare
+ * memoria gia' posseduta o rifiutare la richiesta. I chunk standard liberati
+ * restano in una piccola riserva comune, cosi' la memoria del processo non
+ * cresce con il numero di thread che hanno servito richieste.
+ */
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+struct mem_budget {
+    pthread_mutex_t lock;
+    size_t limit; // 0 = illimitato
+    size_t used;
+    size_t high_water;
+    unsigned long rejected;
+};
+
+struct arena_chunk;
+
+struct arena {
+    struct mem_budget *budget;
+    size_t limit; // budget della singola richiesta, 0 = illimitato
+    size_t used;  // byte dei chunk posseduti
+    size_t high_water;
+    struct arena_chunk *chunks;
+    char *cur;
+    size_t left;
+};
+
+void mem_budget_init(struct mem_budget *budget, size_t limit);
+// Memoria fuori dalle arene ma dentro il budget globale; -1 se lo supererebbe
+int mem_budget_charge(struct mem_budget *budget, size_t size);
+void mem_budget_uncharge(struct mem_budget *budget, size_t size);
+
+void arena_init(struct arena *arena, struct mem_budget *budget, size_t limit);
+// Memoria allineata a 16 byte, NULL se supererebbe uno dei due budget
+void *arena_alloc(struct arena *arena, size_t size);
+void arena_release(struct arena *arena);
+
+// RSS attuale e massimo del processo da /proc/self/status
+int mem_rss_kb(long *rss_kb, long *hwm_kb);
+
+#endif
@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tensorflow/lite/c/c_api.h"
+#include <tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h>
+
+#include "autotune.h"
+#include "log.h"
+
+#define AUTOTUNE_RUN_NS (200 * 1000000LL) // durata della misura di ogni candidato
+#define AUTOTUNE_WARMUP 3
+#define AUTOTUNE_MAX_SAMPLES 65536        // latenze registrate per interprete
+#define AUTOTUNE_LINE 1024
+
+static const char *objective_names[] = {"throughput", "p99"};
+
+struct bench_engine {
+    TfLiteInterpreterOptions *options;
+    TfLiteDelegate *delegate;
+    TfLiteInterpreter *interpreter;
+};
+
+struct bench_thread {
+    pthread_t thread;
+    struct bench_engine eng;
+    long long deadline;
+    int invokes_per_sample; // invoke che servono per le righe di una richiesta
+    long long *samples;
+    int n_samples;
+    long long invokes;
+    int failed;
+};
+
+struct bench_result {
+    double rows_per_sec;
+    double p99_us;
+};
+
+static long long tune_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int autotune_parse_objective(const char *name) {
+    for (int i = 0; i < (int)(sizeof(objective_names) / sizeof(objective_names[0])); i++)
+        if (strcasecmp(name, objective_names[i]) == 0)
+            return i;
+    return -1;
+}
+
+const char *autotune_objective_name(int objective) {
+    return objective == AUTOTUNE_P99 ? objective_names[AUTOTUNE_P99] : objective_names[AUTOTUNE_THROUGHPUT];
+}
+
+static void bench_engine_destroy(struct bench_engine *eng) {
+    if (eng->interpreter != NULL)
+        TfLiteInterpreterDelete(eng->interpreter);
+    if (eng->options != NULL)
+        TfLiteInterpreterOptionsDelete(eng->options);
+    if (eng->delegate != NULL)
+        TfLiteXNNPackDelegateDelete(eng->delegate);
+    memset(eng, 0, sizeof(*eng));
+}
+
+static int bench_engine_create(struct bench_engine *eng, TfLiteModel *model, const struct tune_config *cfg,
+                               int input_size) {
+    memset(eng, 0, sizeof(*eng));
+    eng->options = TfLiteInterpreterOptionsCreate();
+    TfLiteInterpreterOptionsSetNumThreads(eng->options, cfg->threads);
+    if (cfg->xnnpack) {
+        TfLiteXNNPackDelegateOptions xnnpack_options = TfLiteXNNPackDelegateOptionsDefault();
+        xnnpack_options.num_threads = cfg->threads;
+        if ((eng->delegate = TfLiteXNNPackDelegateCreate(&xnnpack_options)) == NULL)
+            goto fail;
+        TfLiteInterpreterOptionsAddDelegate(eng->options, eng->delegate);
+    }
+    if ((eng->interpreter = TfLiteInterpreterCreate(model, eng->options)) == NULL)
+        goto fail;
+
+    // Il batch e' la prima dimensione dell'input: il modello deve accettarne il ridimensionamento
+    TfLiteTensor *input = TfLiteInterpreterGetInputTensor(eng->interpreter, 0);
+    if (input == NULL)
+        goto fail;
+    if (cfg->batch > 1) {
+        int dims[8];
+        int n = TfLiteTensorNumDims(input);
+        if (n < 1 || n > 8)
+            goto fail;
+        for (int i = 0; i < n; i++)
+            dims[i] = TfLiteTensorDim(input, i);
+        dims[0] = cfg->batch;
+        if (TfLiteInterpreterResizeInputTensor(eng->interpreter, 0, dims, n) != kTfLiteOk)
+            goto fail;
+    }
+    if (TfLiteInterpreterAllocateTensors(eng->interpreter) != kTfLiteOk)
+        goto fail;
+    input = TfLiteInterpreterGetInputTensor(eng->interpreter, 0);
+    if (TfLiteTensorByteSize(input) != (size_t)cfg->batch * input_size * sizeof(float))
+        goto fail;
+
+    // Input sintetico deterministico nell'intervallo dei pixel normalizzati
+    float *data = TfLiteTensorData(input);
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < (size_t)cfg->batch * input_size; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        data[i] = (seed >> 8) / 16777216.0f;
+    }
+    for (int i = 0; i < AUTOTUNE_WARMUP; i++)
+        if (TfLiteInterpreterInvoke(eng->interpreter) != kTfLiteOk)
+            goto fail;
+    return 0;
+
+fail:
+    bench_engine_destroy(eng);
+    return -1;
+}
+
+static void *bench_main(void *arg) {
+    struct bench_thread *bt = arg;
+    long long now = tune_now_ns();
+    while (now < bt->deadline && !bt->failed) {
+        for (int i = 0; i < bt->invokes_per_sample; i++) {
+            if (TfLiteInterpreterInvoke(bt->eng.interpreter) != kTfLiteOk) {
+                bt->failed = 1;
+                break;
+            }
+            bt->invokes++;
+        }
+        long long end = tune_now_ns();
+        if (!bt->failed && bt->n_samples < AUTOTUNE_MAX_SAMPLES)
+            bt->samples[bt->n_samples++] = end - now;
+        now = end;
+    }
+    return NULL;
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Righe di una richiesta: la latenza si misura su queste, non sulla singola
+// invoke, altrimenti con -A p99 vincerebbe sempre il batch piu' piccolo
+static int request_rows(const struct autotune_options *opts) {
+    int rows = opts->request_rows;
+    for (int b = 0; rows < 1 && b < opts->n_batches; b++)
+        if (opts->batches[b] > rows)
+            rows = opts->batches[b];
+    return rows > 0 ? rows : 1;
+}
+
+// Misura un candidato con opts->workers interpreti che lavorano in parallelo
+static int bench_candidate(const struct autotune_options *opts, TfLiteModel *model, const struct tune_config *cfg,
+                           struct bench_result *res) {
+    int workers = opts->workers > 0 ? opts->workers : 1;
+    struct bench_thread *bt = calloc(workers, sizeof(*bt));
+    long long *samples = malloc((size_t)workers * AUTOTUNE_MAX_SAMPLES * sizeof(long long));
+    int created = 0, ret = -1;
+
+    if (bt == NULL || samples == NULL)
+        goto out;
+    for (; created < workers; created++) {
+        if (bench_engine_create(&bt[created].eng, model, cfg, opts->input_size) < 0)
+            goto out;
+        bt[created].samples = samples + (size_t)created * AUTOTUNE_MAX_SAMPLES;
+        bt[created].invokes_per_sample = (request_rows(opts) + cfg->batch - 1) / cfg->batch;
+    }
+
+    long long start = tune_now_ns();
+    for (int i = 0; i < workers; i++) {
+        bt[i].deadline = start + AUTOTUNE_RUN_NS;
+        pthread_create(&bt[i].thread, NULL, bench_main, &bt[i]);
+    }
+    long long invokes = 0;
+    int n = 0, failed = 0;
+    for (int i = 0; i < workers; i++) {
+        pthread_join(bt[i].thread, NULL);
+        invokes += bt[i].invokes;
+        failed |= bt[i].failed;
+        // Le latenze vengono compattate in testa per calcolare il percentile
+        memmove(samples + n, bt[i].samples, bt[i].n_samples * sizeof(long long));
+        n += bt[i].n_samples;
+    }
+    long long elapsed = tune_now_ns() - start;
+    if (failed || n == 0)
+        goto out;
+
+    qsort(samples, n, sizeof(long long), cmp_ll);
+    int idx = (int)(0.99 * n + 0.999999) - 1;
+    res->p99_us = samples[idx < 0 ? 0 : idx] / 1e3;
+    res->rows_per_sec = (double)invokes * cfg->batch / (elapsed / 1e9);
+    ret = 0;
+
+out:
+    for (int i = 0; i < created; i++)
+        bench_engine_destroy(&bt[i].eng);
+    free(bt);
+    free(samples);
+    return ret;
+}
+
+static int better(int objective, const struct bench_result *a, const struct bench_result *b) {
+    if (objective == AUTOTUNE_P99)
+        return a->p99_us < b->p99_us;
+    return a->rows_per_sec > b->rows_per_sec;
+}
+
+// I valori finiscono in un file key=value: niente spazi o '='
+static void sanitize(char *s) {
+    for (; *s != '\0'; s++)
+        if (*s == ' ' || *s == '\t' || *s == '=' || *s == '\n')
+            *s = '_';
+}
+
+// Identita' di modello, nodo e misura: i risultati non valgono per un modello
+// modificato, per un nodo con CPU diversa ne' per altri candidati o richieste
+static void build_key(const struct autotune_options *opts, char *key, size_t size) {
+    char node[128] = "unknown", cpu[128] = "unknown", line[256], batches[AUTOTUNE_MAX_BATCHES * 12] = "";
+    const char *base = strrchr(opts->model_path, '/');
+    base = base != NULL ? base + 1 : opts->model_path;
+
+    uint32_t hash = 2166136261u;
+    long model_size = 0;
+    FILE *f = fopen(opts->model_path, "rb");
+    if (f != NULL) {
+        int c;
+        while ((c = fgetc(f)) != EOF) {
+            hash = (hash ^ (uint32_t)c) * 16777619u;
+            model_size++;
+        }
+        fclose(f);
+    }
+
+    // Nel pod il nome host cambia a ogni riavvio: si preferisce il nodo passato dal deployment
+    const char *node_env = getenv("NODE_NAME");
+    if (node_env != NULL)
+        snprintf(node, sizeof(node), "%s", node_env);
+    else
+        gethostname(node, sizeof(node) - 1);
+    FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+    if (cpuinfo != NULL) {
+        while (fgets(line, sizeof(line), cpuinfo) != NULL) {
+            char *colon = strchr(line, ':');
+            if (strncmp(line, "model name", 10) == 0 && colon != NULL) {
+                snprintf(cpu, sizeof(cpu), "%s", colon + 2);
+                cpu[strcspn(cpu, "\n")] = '\0';
+                break;
+            }
+        }
+        fclose(cpuinfo);
+    }
+    sanitize(node);
+    sanitize(cpu);
+
+    char model[128];
+    snprintf(model, sizeof(model), "%s", base);
+    sanitize(model);
+    for (int b = 0, len = 0; b < opts->n_batches; b++)
+        len += snprintf(batches + len, sizeof(batches) - len, "%s%d", b > 0 ? "," : "", opts->batches[b]);
+    snprintf(key, size,
+             "model=%s size=%ld hash=%08x node=%s cpu=%s ncpu=%ld workers=%d objective=%s batches=%s rows=%d", model,
+             model_size, hash, node, cpu, sysconf(_SC_NPROCESSORS_ONLN), opts->workers,
+             autotune_objective_name(opts->objective), batches, request_rows(opts));
+}
+
+// Una riga vale solo se il batch salvato e' tra i candidati di questo avvio
+// (file scritto a mano o da una versione che non li metteva nella chiave)
+static int load_result(const struct autotune_options *opts, const char *path, const char *key,
+                       struct tune_config *out) {
+    char line[AUTOTUNE_LINE], backend[16];
+    size_t key_len = strlen(key);
+    int found = 0;
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    while (!found && fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, key, key_len) != 0 || line[key_len] != ' ')
+            continue;
+        struct tune_config cfg;
+        if (sscanf(line + key_len, " threads=%d batch=%d backend=%15s", &cfg.threads, &cfg.batch, backend) != 3 ||
+            cfg.threads < 1)
+            continue;
+        cfg.xnnpack = strcmp(backend, "xnnpack") == 0;
+        for (int b = 0; b < opts->n_batches; b++)
+            found |= opts->batches[b] == cfg.batch;
+        if (found)
+            *out = cfg;
+        else
+            LOG_WARN("event=autotune_scartato path=%s batch=%d", path, cfg.batch);
+    }
+    fclose(f);
+    return found ? 0 : -1;
+}
+
+// Riscrive il file sostituendo la riga con la stessa chiave; il rename rende
+// l'aggiornamento atomico per gli altri pod che leggono lo stesso volume
+static int save_result(const char *path, const char *key, const struct tune_config *cfg,
+                       const struct bench_result *res) {
+    char tmp_path[512], line[AUTOTUNE_LINE];
+    size_t key_len = strlen(key);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+
+    FILE *out = fopen(tmp_path, "w");
+    if (out == NULL)
+        return -1;
+    FILE *in = fopen(path, "r");
+    if (in != NULL) {
+        while (fgets(line, sizeof(line), in) != NULL)
+            if (strncmp(line, key, key_len) != 0 || line[key_len] != ' ')
+                fputs(line, out);
+        fclose(in);
+    }
+    fprintf(out, "%s threads=%d batch=%d backend=%s rows_per_sec=%.1f p99_us=%.1f\n", key, cfg->threads, cfg->batch,
+            cfg->xnnpack ? "xnnpack" : "builtin", res->rows_per_sec, res->p99_us);
+    if (fclose(out) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+int autotune(const struct autotune_options *opts, TfLiteModel *model, struct tune_config *out) {
+    const char *path = opts->path != NULL ? opts->path : AUTOTUNE_DEFAULT_PATH;
+    char key[AUTOTUNE_LINE / 2];
+    build_key(opts, key, sizeof(key));
+
+    if (!opts->force && load_result(opts, path, key, out) == 0) {
+        LOG_INFO("event=autotune_riusato path=%s threads=%d batch=%d backend=%s", path, out->threads, out->batch,
+                 out->xnnpack ? "xnnpack" : "builtin");
+        return 0;
+    }
+
+    int max_threads = opts->max_threads > 0 ? opts->max_threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    struct tune_config best_cfg = {0};
+    struct bench_result best = {0};
+    int found = 0;
+    long long start = tune_now_ns();
+    LOG_INFO("event=autotune_inizio objective=%s workers=%d", autotune_objective_name(opts->objective),
+             opts->workers);
+
+    for (int xnnpack = 1; xnnpack >= 0; xnnpack--) {
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            for (int b = 0; b < opts->n_batches; b++) {
+                struct tune_config cand = {.threads = threads, .batch = opts->batches[b], .xnnpack = xnnpack};
+                struct bench_result res;
+                if (bench_candidate(opts, model, &cand, &res) < 0) {
+                    LOG_WARN("event=autotune_candidato_fallito threads=%d batch=%d backend=%s", cand.threads,
+                             cand.batch, xnnpack ? "xnnpack" : "builtin");
+                    continue;
+                }
+                LOG_INFO("event=autotune_candidato threads=%d batch=%d backend=%s rows_per_sec=%.1f p99_us=%.1f",
+                         cand.threads, cand.batch, xnnpack ? "xnnpack" : "builtin", res.rows_per_sec, res.p99_us);
+                if (!found || better(opts->objective, &res, &best)) {
+                    best = res;
+                    best_cfg = cand;
+                    found = 1;
+                }
+            }
+        }
+    }
+    if (!found) {
+        LOG_ERROR("event=autotune_fallito");
+        return -1;
+    }
+
+    *out = best_cfg;
+    LOG_INFO("event=autotune_scelto threads=%d batch=%d backend=%s rows_per_sec=%.1f p99_us=%.1f ms=%.1f",
+             best_cfg.threads, best_cfg.batch, best_cfg.xnnpack ? "xnnpack" : "builtin", best.rows_per_sec,
+             best.p99_us, (tune_now_ns() - start) / 1e6);
+    // Un volume in sola lettura non impedisce l'avvio: si rifaranno le misure
+    if (save_result(path, key, &best_cfg, &best) < 0)
+        LOG_WARN("event=autotune_salvataggio_fallito path=%s error=\"%s\"", path, strerror(errno));
+    return 0;
+}
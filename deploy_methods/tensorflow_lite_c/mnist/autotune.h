@@ -0,0 +1,52 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "tensorflow/lite/c/c_api.h"
+
+/*
+ * Scelta automatica della configurazione di inferenza per modello e nodo.
+ *
+ * Ogni candidato (thread per interprete, righe per invoke, backend XNNPACK o
+ * kernel builtin) viene misurato sull'host reale con tanti interpreti
+ * concorrenti quanti sono i worker, su input sintetici, e valutato secondo
+ * l'obiettivo: righe al secondo oppure latenza p99 di una richiesta di
+ * request_rows righe (le invoke necessarie una dopo l'altra). Il vincitore
+ * viene salvato in un file di testo key=value sul volume, una riga per
+ * modello, nodo, numero di worker, obiettivo, candidati e righe per
+ * richiesta, e riusato agli avvii successivi senza rifare le misure.
+ */
+
+#define AUTOTUNE_DEFAULT_PATH "/var/data/ml_model_prova/autotune.conf"
+#define AUTOTUNE_MAX_BATCHES 8
+
+enum autotune_objective {
+    AUTOTUNE_THROUGHPUT = 0,
+    AUTOTUNE_P99
+};
+
+struct tune_config {
+    int threads;
+    int batch;   // righe per invoke (dimensione 0 del tensore di input)
+    int xnnpack; // 0 = kernel builtin di TFLite
+};
+
+struct autotune_options {
+    const char *path;       // file dei risultati (NULL = AUTOTUNE_DEFAULT_PATH)
+    const char *model_path;
+    int objective;
+    int input_size;
+    int workers;            // interpreti eseguiti in parallelo durante le misure
+    int max_threads;        // 0 = CPU online
+    int batches[AUTOTUNE_MAX_BATCHES];
+    int n_batches;
+    int request_rows;       // righe di una richiesta per la p99 (0 = batch candidato piu' grande)
+    int force;              // rifa le misure anche se c'e' un risultato salvato
+};
+
+int autotune_parse_objective(const char *name);
+const char *autotune_objective_name(int objective);
+
+// Restituisce la configurazione salvata o, in mancanza, la misura e la salva
+int autotune(const struct autotune_options *opts, TfLiteModel *model, struct tune_config *out);
+
+#endif
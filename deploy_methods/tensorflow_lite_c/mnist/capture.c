@@ -0,0 +1,390 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "log.h"
+
+struct capture_entry {
+    uint64_t hash; // 0 = voce libera
+    uint64_t len;
+    uint64_t id;
+    int64_t offset; // del corpo nel file, per confrontarlo byte per byte
+};
+
+static long long capture_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t fnv1a(const char *data, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+// Una richiesta completata in attesa del thread di scrittura
+struct capture_pending {
+    struct capture_pending *next;
+    struct capture_request req;
+    char *data;
+    size_t len, cap;
+    uint64_t hash;
+    int overflow;
+};
+
+static void *capture_writer(void *arg);
+
+int capture_open(struct capture *cap, const char *path, size_t max_payload, struct mem_budget *budget) {
+    memset(cap, 0, sizeof(*cap));
+    pthread_mutex_init(&cap->lock, NULL);
+    pthread_cond_init(&cap->ready, NULL);
+    cap->budget = budget;
+    cap->max_payload = max_payload;
+    cap->next_payload = cap->next_request = 1;
+    // Anche in lettura: i corpi gia' scritti si rileggono per confrontarli
+    if ((cap->file = fopen(path, "w+b")) == NULL) {
+        LOG_ERROR("event=capture_apertura_fallita path=%s error=\"%s\"", path, strerror(errno));
+        return -1;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct capture_header header = {.magic = CAPTURE_MAGIC, .version = CAPTURE_VERSION,
+                                    .start_unix_ns = now.tv_sec * 1000000000LL + now.tv_nsec};
+    cap->start_ns = capture_now_ns();
+    if (fwrite(&header, sizeof(header), 1, cap->file) != 1 || fflush(cap->file) != 0) {
+        LOG_ERROR("event=capture_scrittura_fallita path=%s error=\"%s\"", path, strerror(errno));
+        fclose(cap->file);
+        cap->file = NULL;
+        return -1;
+    }
+    cap->flushed = sizeof(header);
+    if (pthread_create(&cap->writer, NULL, capture_writer, cap) != 0) {
+        LOG_ERROR("event=capture_thread_fallito path=%s", path);
+        fclose(cap->file);
+        cap->file = NULL;
+        return -1;
+    }
+    LOG_INFO("event=capture_avviata path=%s max_payload_mb=%zu", path, max_payload >> 20);
+    return 0;
+}
+
+// Le richieste ancora in coda vengono scritte prima di chiudere il file
+void capture_close(struct capture *cap) {
+    if (cap->file != NULL) {
+        pthread_mutex_lock(&cap->lock);
+        cap->closing = 1;
+        pthread_cond_signal(&cap->ready);
+        pthread_mutex_unlock(&cap->lock);
+        pthread_join(cap->writer, NULL);
+        fclose(cap->file);
+    }
+    free(cap->entries);
+    pthread_cond_destroy(&cap->ready);
+    pthread_mutex_destroy(&cap->lock);
+    memset(cap, 0, sizeof(*cap));
+}
+
+void capture_report(struct capture *cap) {
+    pthread_mutex_lock(&cap->lock);
+    LOG_INFO("event=capture richieste=%lu payload=%lu duplicati=%lu non_salvati=%lu errori=%lu bytes=%llu",
+             cap->requests, cap->payloads, cap->duplicates, cap->overflows, cap->errors, cap->bytes);
+    pthread_mutex_unlock(&cap->lock);
+}
+
+void capture_begin(struct capture *cap, struct capture_buf *buf) {
+    memset(buf, 0, sizeof(*buf));
+    buf->arrival_ns = capture_now_ns() - cap->start_ns;
+}
+
+void capture_discard(struct capture *cap, struct capture_buf *buf) {
+    free(buf->data);
+    mem_budget_uncharge(cap->budget, buf->cap);
+    buf->data = NULL;
+    buf->len = buf->cap = 0;
+}
+
+void capture_append(struct capture *cap, struct capture_buf *buf, const void *data, size_t len) {
+    if (buf->overflow)
+        return;
+    if (buf->len + len > cap->max_payload) {
+        // Corpo troppo grande: resta solo il riferimento con il numero di righe
+        buf->overflow = 1;
+        capture_discard(cap, buf);
+        return;
+    }
+    if (buf->len + len > buf->cap) {
+        size_t size = buf->cap ? buf->cap : 64 * 1024;
+        while (size < buf->len + len)
+            size *= 2;
+        // Con il budget globale esaurito si rinuncia al corpo, non alla richiesta
+        if (mem_budget_charge(cap->budget, size - buf->cap) < 0) {
+            buf->overflow = 1;
+            capture_discard(cap, buf);
+            return;
+        }
+        char *data_new = realloc(buf->data, size);
+        if (data_new == NULL) {
+            mem_budget_uncharge(cap->budget, size - buf->cap);
+            buf->overflow = 1;
+            capture_discard(cap, buf);
+            return;
+        }
+        buf->data = data_new;
+        buf->cap = size;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+// Confronta un corpo con quello gia' scritto a offset: l'hash da solo non
+// esclude una collisione, che farebbe riprodurre un corpo diverso. Il buffer
+// di stdio si svuota solo se contiene ancora parte del corpo
+static int same_body(struct capture *cap, const struct capture_entry *e, const char *data) {
+    char chunk[64 * 1024];
+    if (e->offset + (int64_t)e->len > cap->flushed) {
+        if (fflush(cap->file) != 0)
+            return 0;
+        cap->flushed = ftello(cap->file);
+    }
+    for (uint64_t done = 0; done < e->len;) {
+        size_t n = e->len - done < sizeof(chunk) ? e->len - done : sizeof(chunk);
+        if (pread(fileno(cap->file), chunk, n, e->offset + done) != (ssize_t)n || memcmp(chunk, data + done, n) != 0)
+            return 0;
+        done += n;
+    }
+    return 1;
+}
+
+// Id di un corpo gia' scritto, 0 se nuovo; con id != 0 lo registra
+static uint64_t entries_lookup(struct capture *cap, uint64_t hash, const char *data, uint64_t len, uint64_t id,
+                               int64_t offset) {
+    if (cap->n_entries * 2 >= cap->cap_entries) {
+        size_t size = cap->cap_entries ? cap->cap_entries * 2 : 256;
+        struct capture_entry *entries = calloc(size, sizeof(*entries));
+        if (entries == NULL)
+            return 0;
+        for (size_t i = 0; i < cap->cap_entries; i++) {
+            struct capture_entry *e = &cap->entries[i];
+            if (e->hash == 0)
+                continue;
+            size_t j = e->hash & (size - 1);
+            while (entries[j].hash != 0)
+                j = (j + 1) & (size - 1);
+            entries[j] = *e;
+        }
+        free(cap->entries);
+        cap->entries = entries;
+        cap->cap_entries = size;
+    }
+    size_t j = hash & (cap->cap_entries - 1);
+    for (; cap->entries[j].hash != 0; j = (j + 1) & (cap->cap_entries - 1))
+        if (id == 0 && cap->entries[j].hash == hash && cap->entries[j].len == len &&
+            same_body(cap, &cap->entries[j], data))
+            return cap->entries[j].id;
+    if (id != 0) {
+        cap->entries[j] = (struct capture_entry){.hash = hash, .len = len, .id = id, .offset = offset};
+        cap->n_entries++;
+    }
+    return 0;
+}
+
+// L'hash si calcola sul thread della connessione, fuori da ogni lock
+void capture_end(struct capture *cap, struct capture_buf *buf, struct capture_request *req) {
+    struct capture_pending *p = malloc(sizeof(*p));
+    if (p == NULL) {
+        capture_discard(cap, buf);
+        pthread_mutex_lock(&cap->lock);
+        if (cap->errors++ == 0)
+            LOG_ERROR("event=capture_memoria_esaurita");
+        pthread_mutex_unlock(&cap->lock);
+        return;
+    }
+    req->arrival_ns = buf->arrival_ns;
+    req->payload_id = 0;
+    *p = (struct capture_pending){.req = *req, .data = buf->data, .len = buf->len, .cap = buf->cap,
+                                  .hash = buf->overflow ? 0 : fnv1a(buf->data, buf->len),
+                                  .overflow = buf->overflow};
+    buf->data = NULL;
+    buf->len = buf->cap = 0;
+
+    pthread_mutex_lock(&cap->lock);
+    if (cap->queue_tail != NULL)
+        cap->queue_tail->next = p;
+    else
+        cap->queue = p;
+    cap->queue_tail = p;
+    pthread_cond_signal(&cap->ready);
+    pthread_mutex_unlock(&cap->lock);
+}
+
+// Scrive una richiesta accodata; solo dal thread di scrittura, che possiede
+// il file e l'indice dei corpi
+static void capture_write(struct capture *cap, struct capture_pending *p) {
+    int ok = 1, overflow = 0, duplicate = 0, written = 0;
+    unsigned long long bytes = 0;
+    if (p->overflow) {
+        overflow = 1;
+    } else if ((p->req.payload_id = entries_lookup(cap, p->hash, p->data, p->len, 0, 0)) != 0) {
+        duplicate = 1;
+    } else {
+        struct capture_record rec = {.type = CAPTURE_PAYLOAD, .length = p->len, .id = cap->next_payload};
+        ok = fwrite(&rec, sizeof(rec), 1, cap->file) == 1;
+        int64_t offset = ftello(cap->file);
+        ok = ok && offset >= 0 && (p->len == 0 || fwrite(p->data, p->len, 1, cap->file) == 1);
+        if (ok) {
+            p->req.payload_id = cap->next_payload++;
+            entries_lookup(cap, p->hash, p->data, p->len, p->req.payload_id, offset);
+            written = 1;
+            bytes += sizeof(rec) + p->len;
+        }
+    }
+    if (ok) {
+        struct capture_record rec = {.type = CAPTURE_REQUEST, .length = sizeof(p->req), .id = cap->next_request++};
+        ok = fwrite(&rec, sizeof(rec), 1, cap->file) == 1 && fwrite(&p->req, sizeof(p->req), 1, cap->file) == 1;
+        bytes += sizeof(rec) + sizeof(p->req);
+    }
+
+    pthread_mutex_lock(&cap->lock);
+    cap->overflows += overflow;
+    cap->duplicates += duplicate;
+    cap->payloads += written;
+    cap->bytes += bytes;
+    if (ok) {
+        cap->requests++;
+    } else if (cap->errors++ == 0) {
+        LOG_ERROR("event=capture_scrittura_fallita error=\"%s\"", strerror(errno));
+    }
+    pthread_mutex_unlock(&cap->lock);
+}
+
+// Prende la coda intera a ogni giro; il file si svuota quando non resta altro
+static void *capture_writer(void *arg) {
+    struct capture *cap = arg;
+    pthread_setname_np(pthread_self(), "capture");
+
+    pthread_mutex_lock(&cap->lock);
+    for (;;) {
+        while (cap->queue == NULL && !cap->closing)
+            pthread_cond_wait(&cap->ready, &cap->lock);
+        struct capture_pending *p = cap->queue;
+        if (p == NULL)
+            break;
+        cap->queue = cap->queue_tail = NULL;
+        pthread_mutex_unlock(&cap->lock);
+
+        while (p != NULL) {
+            struct capture_pending *next = p->next;
+            capture_write(cap, p);
+            free(p->data);
+            mem_budget_uncharge(cap->budget, p->cap);
+            free(p);
+            p = next;
+        }
+        int flushed = fflush(cap->file) == 0;
+        if (flushed)
+            cap->flushed = ftello(cap->file);
+
+        pthread_mutex_lock(&cap->lock);
+        if (!flushed && cap->errors++ == 0)
+            LOG_ERROR("event=capture_scrittura_fallita error=\"%s\"", strerror(errno));
+    }
+    pthread_mutex_unlock(&cap->lock);
+    return NULL;
+}
+
+static int cmp_arrival(const void *a, const void *b) {
+    const struct capture_request *x = a, *y = b;
+    return (x->arrival_ns > y->arrival_ns) - (x->arrival_ns < y->arrival_ns);
+}
+
+int capture_load(const char *path, struct capture_trace *trace) {
+    memset(trace, 0, sizeof(*trace));
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        LOG_ERROR("event=capture_apertura_fallita path=%s error=\"%s\"", path, strerror(errno));
+        return -1;
+    }
+    if (fread(&trace->header, sizeof(trace->header), 1, file) != 1 || trace->header.magic != CAPTURE_MAGIC ||
+        trace->header.version != CAPTURE_VERSION) {
+        LOG_ERROR("event=capture_non_valida path=%s", path);
+        fclose(file);
+        return -1;
+    }
+
+    size_t cap_requests = 0;
+    struct capture_record rec;
+    int ret = 0;
+    // Un record troncato in coda (server terminato durante la scrittura) chiude la lettura
+    while (ret == 0 && fread(&rec, sizeof(rec), 1, file) == 1) {
+        if (rec.type == CAPTURE_REQUEST && rec.length == sizeof(struct capture_request)) {
+            if (trace->n_requests == cap_requests) {
+                cap_requests = cap_requests ? cap_requests * 2 : 1024;
+                struct capture_request *r = realloc(trace->requests, cap_requests * sizeof(*r));
+                if (r == NULL) {
+                    ret = -1;
+                    break;
+                }
+                trace->requests = r;
+            }
+            if (fread(&trace->requests[trace->n_requests], sizeof(struct capture_request), 1, file) != 1)
+                break;
+            trace->n_requests++;
+        } else if (rec.type == CAPTURE_PAYLOAD && rec.id > 0 && rec.id < (1u << 30)) {
+            if (rec.id >= trace->n_payloads) {
+                size_t n = rec.id + 1 > trace->n_payloads * 2 ? rec.id + 1 : trace->n_payloads * 2;
+                char **payloads = realloc(trace->payloads, n * sizeof(*payloads));
+                uint32_t *lens = payloads != NULL ? realloc(trace->payload_len, n * sizeof(*lens)) : NULL;
+                if (payloads != NULL)
+                    trace->payloads = payloads;
+                if (lens == NULL) {
+                    ret = -1;
+                    break;
+                }
+                trace->payload_len = lens;
+                memset(trace->payloads + trace->n_payloads, 0, (n - trace->n_payloads) * sizeof(*payloads));
+                memset(trace->payload_len + trace->n_payloads, 0, (n - trace->n_payloads) * sizeof(*lens));
+                trace->n_payloads = n;
+            }
+            char *data = malloc(rec.length ? rec.length : 1);
+            if (data == NULL) {
+                ret = -1;
+                break;
+            }
+            if (rec.length > 0 && fread(data, rec.length, 1, file) != 1) {
+                free(data);
+                break;
+            }
+            free(trace->payloads[rec.id]);
+            trace->payloads[rec.id] = data;
+            trace->payload_len[rec.id] = rec.length;
+        } else if (fseek(file, rec.length, SEEK_CUR) != 0) {
+            break; // record sconosciuto di una versione futura: si salta
+        }
+    }
+    fclose(file);
+    if (ret < 0) {
+        LOG_ERROR("event=capture_memoria_insufficiente path=%s", path);
+        capture_trace_free(trace);
+        return -1;
+    }
+    // Le richieste vengono scritte al completamento: si riordinano per arrivo
+    qsort(trace->requests, trace->n_requests, sizeof(struct capture_request), cmp_arrival);
+    return 0;
+}
+
+void capture_trace_free(struct capture_trace *trace) {
+    for (size_t i = 0; i < trace->n_payloads; i++)
+        free(trace->payloads[i]);
+    free(trace->payloads);
+    free(trace->payload_len);
+    free(trace->requests);
+    memset(trace, 0, sizeof(*trace));
+}
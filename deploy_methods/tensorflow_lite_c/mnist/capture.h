@@ -0,0 +1,133 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arena.h"
+#include "payload.h"
+
+/*
+ * Registrazione del traffico del server per riprodurlo in locale (replay.c).
+ *
+ * Il file inizia con una capture_header ed e' una sequenza di record, ognuno
+ * preceduto da una capture_record:
+ *   CAPTURE_PAYLOAD  corpo di una richiesta cosi' come e' arrivato sul filo
+ *                    (dopo l'eventuale payload_hello), identificato da id
+ *   CAPTURE_REQUEST  una capture_request: istante di arrivo, payload a cui fa
+ *                    riferimento, codifica e dimensioni
+ * Corpi identici (stesso hash e stessa lunghezza, poi confrontati byte per
+ * byte con quello gia' scritto) vengono salvati una volta sola e referenziati
+ * da piu' richieste; un corpo oltre max_payload, o che non sta nel budget
+ * di memoria globale finche' e' in attesa di scrittura, non viene salvato
+ * (payload_id 0) e il replay lo sostituisce con righe nulle dello stesso
+ * numero. Le richieste cancellate dal server (client disconnesso o scadenza
+ * superata) hanno cancelled = 1: il loro corpo puo' essere troncato e il
+ * replay le salta. Le richieste sulla socket Unix vengono registrate come
+ * corpo RAW, cioe' le righe float32 degli slot, e riprodotte su TCP. Numeri
+ * nell'ordine dei byte nativo.
+ *
+ * Le connessioni calcolano l'hash del corpo e accodano il record; confronto
+ * con i corpi gia' scritti e scrittura del file li fa un thread dedicato,
+ * che svuota il buffer del file quando la coda resta vuota.
+ */
+
+#define CAPTURE_MAGIC 0x31434e4du // "MNC1"
+#define CAPTURE_VERSION 1
+#define CAPTURE_DEFAULT_MAX_PAYLOAD (64u << 20)
+
+enum capture_record_type {
+    CAPTURE_PAYLOAD = 1,
+    CAPTURE_REQUEST
+};
+
+enum capture_transport {
+    CAPTURE_TCP = 0,
+    CAPTURE_UNIX
+};
+
+struct capture_header {
+    uint32_t magic;
+    uint32_t version;
+    int64_t start_unix_ns; // ora di inizio della registrazione
+};
+
+struct capture_record {
+    uint32_t type;
+    uint32_t length; // byte che seguono
+    uint64_t id;     // payload_id per CAPTURE_PAYLOAD, progressivo per CAPTURE_REQUEST
+};
+
+struct capture_request {
+    uint64_t arrival_ns; // dall'inizio della registrazione
+    uint64_t payload_id; // 0 = corpo non salvato
+    uint64_t wire_bytes;
+    uint64_t service_ns; // tempo di servizio osservato dal server
+    uint32_t rows;
+    uint8_t transport;
+    uint8_t hello;       // la connessione iniziava con una payload_hello
+    uint8_t cancelled;   // cancellata dal server, corpo forse incompleto
+    uint8_t pad;
+    struct payload_hello mode;
+    char tenant[32];
+};
+
+// Corpo di una richiesta in corso, fuori dalle arene ma addebitato al budget
+// globale fino alla scrittura
+struct capture_buf {
+    long long arrival_ns;
+    char *data;
+    size_t len, cap;
+    int overflow;
+};
+
+struct capture_entry;
+struct capture_pending;
+
+struct capture {
+    pthread_mutex_t lock; // coda e statistiche
+    pthread_cond_t ready;
+    pthread_t writer;
+    int closing;
+    struct capture_pending *queue, *queue_tail;
+    struct mem_budget *budget;
+    long long start_ns;
+    size_t max_payload;
+    // Usati solo dal thread di scrittura
+    FILE *file;
+    int64_t flushed; // byte del file gia' fuori dal buffer di stdio
+    uint64_t next_payload, next_request;
+    struct capture_entry *entries; // hash dei corpi gia' scritti
+    size_t n_entries, cap_entries;
+    // statistiche
+    unsigned long requests, payloads, duplicates, overflows, errors;
+    unsigned long long bytes;
+};
+
+int capture_open(struct capture *cap, const char *path, size_t max_payload, struct mem_budget *budget);
+void capture_close(struct capture *cap);
+void capture_report(struct capture *cap);
+
+void capture_begin(struct capture *cap, struct capture_buf *buf);
+void capture_append(struct capture *cap, struct capture_buf *buf, const void *data, size_t len);
+// Accoda la richiesta (e il corpo se nuovo) per la scrittura; buf passa al writer
+void capture_end(struct capture *cap, struct capture_buf *buf, struct capture_request *req);
+// Abbandona il corpo senza registrare la richiesta
+void capture_discard(struct capture *cap, struct capture_buf *buf);
+
+// Lettura di una registrazione completa, per il replay
+struct capture_trace {
+    struct capture_header header;
+    struct capture_request *requests; // in ordine di arrivo
+    size_t n_requests;
+    char **payloads;                  // indicizzati per payload_id
+    uint32_t *payload_len;
+    size_t n_payloads;
+};
+
+int capture_load(const char *path, struct capture_trace *trace);
+void capture_trace_free(struct capture_trace *trace);
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <dirent.h>
 #include <errno.h>
@@ -15,9 +16,21 @@
 #include <sys/wait.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
 #include <json-c/json.h>
 
+#include "log.h"
+#include "payload.h"
+#include "shm_transport.h"
+
 #define PORT 30080 //porta del nodeport
+#define INPUT_SIZE 784 // pixel per immagine
+
+// Tempo massimo concesso al server per ogni richiesta TCP (0 = nessun limite)
+static uint32_t deadline_ms;
 
 int leggiLinea(int fd, char *linea) {
     char c;
@@ -27,27 +40,150 @@ int leggiLinea(int fd, char *linea) {
         linea[i] = c;
         i++;
     }
-    printf("%s\n", linea);
+    LOG_DEBUG("event=linea len=%d", i);
     linea[i]='\0';
     return letti;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <csv_file_path>\n", argv[0]);
-        return 1;
+// Riceve esattamente len byte, gestendo le recv parziali
+int ricevi_tutto(int sock, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = recv(sock, p, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Invia tutto il buffer; MSG_NOSIGNAL evita SIGPIPE se il server chiude
+int invia_tutto(int sock, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Risposta del server: dimensione del JSON seguita dal JSON terminato da '\0'
+char *ricevi_json(int sock) {
+    size_t json_size = 0;
+    if (ricevi_tutto(sock, &json_size, sizeof(json_size)) < 0) {
+        LOG_ERROR("event=recv_fallita what=size error=\"%s\"", strerror(errno));
+        return NULL;
+    }
+    if (json_size > (1u << 30)) {
+        LOG_ERROR("event=risposta_non_valida size=%zu", json_size);
+        return NULL;
+    }
+    char *buff = malloc(json_size + 1);
+    if (buff == NULL || ricevi_tutto(sock, buff, json_size + 1) < 0) {
+        LOG_ERROR("event=recv_fallita what=labels error=\"%s\"", strerror(errno));
+        free(buff);
+        return NULL;
+    }
+    buff[json_size] = '\0';
+    return buff;
+}
+
+// Legge fino a max_rows righe del CSV convertendole in float nel buffer di destinazione
+// Righe vuote o che iniziano con '\r' (l'a capo in piu' a fine file, i CSV
+// DOS): il server le salta come decode_csv_line, quindi non sono righe di dati
+static int riga_vuota(const char *p, const char *end) {
+    return p == end || *p == '\n' || *p == '\r';
+}
+
+int leggi_righe(FILE *fp, float *dest, int max_rows) {
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    int rows = 0;
+
+    while (rows < max_rows && (len = getline(&line, &cap, fp)) > 0) {
+        char *p = line;
+        if (riga_vuota(line, line + len))
+            continue;
+        float *row = dest + (size_t)rows * INPUT_SIZE;
+        for (int i = 0; i < INPUT_SIZE; i++) {
+            row[i] = strtof(p, &p);
+            if (*p == ',')
+                p++;
+        }
+        rows++;
+    }
+    free(line);
+    return rows;
+}
+
+// Invia il CSV nella codifica negoziata con il server; mode viene aggiornato
+// con la combinazione accettata
+int invia_payload(int sock, struct payload_hello *mode, FILE *fp) {
+    struct payload_hello requested = *mode;
+    struct payload_encoder enc;
+    int ret = 0;
+
+    if (payload_negotiate(sock, mode) < 0) {
+        LOG_ERROR("event=negoziazione_fallita encoding=%s", payload_encoding_name(requested.encoding));
+        return -1;
+    }
+    if (mode->compression != requested.compression)
+        LOG_WARN("event=compressione_rifiutata richiesta=%s usata=%s", payload_compression_name(requested.compression),
+                 payload_compression_name(mode->compression));
+    if (payload_encoder_init(&enc, mode, INPUT_SIZE, sock) < 0) {
+        payload_encoder_free(&enc);
+        return -1;
     }
 
-    const char *file_path = argv[1];
-    int sock, length, b;
+    if (mode->encoding == PAYLOAD_CSV) {
+        char sendbuffer[8192];
+        size_t b;
+        while (ret == 0 && (b = fread(sendbuffer, 1, sizeof(sendbuffer), fp)) > 0)
+            ret = payload_encode_text(&enc, sendbuffer, b);
+    } else {
+        float *rows = malloc(100 * INPUT_SIZE * sizeof(float));
+        int n = 0;
+        while (ret == 0 && rows != NULL && (n = leggi_righe(fp, rows, 100)) > 0)
+            for (int r = 0; ret == 0 && r < n; r++)
+                ret = payload_encode_row(&enc, rows + (size_t)r * INPUT_SIZE);
+        if (rows == NULL)
+            ret = -1;
+        free(rows);
+    }
+    if (ret == 0)
+        ret = payload_encoder_finish(&enc);
+
+    const struct payload_counters *c = &enc.counters;
+    LOG_INFO("event=payload_inviato encoding=%s compression=%s rows=%llu wire_bytes=%llu dense_bytes=%llu "
+             "ratio=%.3f encode_ms=%.3f encode_mb_s=%.1f",
+             payload_encoding_name(mode->encoding), payload_compression_name(mode->compression),
+             (unsigned long long)c->rows, (unsigned long long)c->wire_bytes, (unsigned long long)c->dense_bytes,
+             c->dense_bytes > 0 ? (double)c->wire_bytes / c->dense_bytes : 0.0, c->codec_ns / 1e6,
+             c->codec_ns > 0 ? c->dense_bytes / (c->codec_ns / 1e3) : 0.0);
+    payload_encoder_free(&enc);
+    return ret;
+}
+
+// Invio del CSV al server remoto su TCP e stampa del JSON ricevuto; con mode
+// diverso da NULL il corpo viaggia nella codifica negoziata
+int invia_tcp(const char *file_path, struct payload_hello *mode) {
+    int sock, b;
     char sendbuffer[8192];
-    char linea[19600];
     struct sockaddr_in server_addr;
 
     // Creazione del socket
     sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) {
-        perror("Failed to create socket");
+        LOG_ERROR("event=socket_fallita error=\"%s\"", strerror(errno));
         return 1;
     }
 
@@ -55,12 +191,12 @@ int main(int argc, char *argv[]) {
     socklen_t optlen = sizeof(int);
     getsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen);
     getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen);
-    printf("Buffer invio: %d, Buffer ricezione: %d\n", sndbuf, rcvbuf);
+    LOG_INFO("event=socket_buffer sndbuf=%d rcvbuf=%d", sndbuf, rcvbuf);
 
     // Risoluzione del nome del servizio in indirizzo IP
     struct hostent *server = gethostbyname("deployment-mnist-service.crossplane-system.svc.cluster.local");
     if (server == NULL) {
-        fprintf(stderr, "ERROR: No such host\n");
+        LOG_ERROR("event=host_sconosciuto");
         return 1;
     }
 
@@ -71,46 +207,581 @@ int main(int argc, char *argv[]) {
     // Connessione al server
     b = connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr));
     if (b < 0) {
-        perror("Failed to connect to server");
+        LOG_ERROR("event=connect_fallita error=\"%s\"", strerror(errno));
         close(sock);
         return 1;
     }
 
-    printf("Connesso a server\n");
-    printf("Apro file\n");
+    LOG_INFO("event=connesso transport=tcp port=%d", PORT);
+    if (deadline_ms > 0 && payload_send_deadline(sock, deadline_ms) < 0) {
+        LOG_ERROR("event=send_fallita error=\"%s\"", strerror(errno));
+        close(sock);
+        return 1;
+    }
     // Apertura del file CSV
     // lettura da file e invio delle linee
     FILE *fp = fopen(file_path, "rb");
     if (fp == NULL) {
-        perror("Failed to open file");
+        LOG_ERROR("event=apertura_file_fallita path=%s error=\"%s\"", file_path, strerror(errno));
         close(sock);
         return 1;
     }
 
-    printf("Inizio lettura\n");
+    LOG_DEBUG("event=invio_inizio path=%s", file_path);
 
-    while( (b = fread(sendbuffer, 1, sizeof(sendbuffer), fp))>0 ){
-        send(sock, sendbuffer, b, 0);
+    if (mode != NULL) {
+        if (invia_payload(sock, mode, fp) < 0) {
+            fclose(fp);
+            close(sock);
+            return 1;
+        }
+    } else {
+        while( (b = fread(sendbuffer, 1, sizeof(sendbuffer), fp))>0 ){
+            if (invia_tutto(sock, sendbuffer, b) < 0) {
+                LOG_ERROR("event=send_fallita error=\"%s\"", strerror(errno));
+                break;
+            }
+        }
     }
     fclose(fp);
     shutdown(sock, SHUT_WR);
     
     // Ricezione delle etichette predette dal server
-    // Ricezione della dimensione del JSON
-    size_t json_size = 0;
-    if (recv(sock, &json_size, sizeof(json_size), 0) < 0) {
-        perror("Error receiving size");
-        return 1;
-    }
-    char buff[json_size];
-    if(recv(sock, buff, sizeof(buff), 0)<0){
-        perror("Error receiving labels");
+    char *buff = ricevi_json(sock);
+    if (buff == NULL) {
+        close(sock);
         return 1;
     }
 
     printf("%s", buff);
+    free(buff);
 
     // Chiusura della connessione
     close(sock);
     return 0;
 }
+
+/*
+ * Invio tramite socket Unix e memoria condivisa, per client sullo stesso nodo
+ * del server: le immagini vengono scritte una sola volta negli slot del memfd
+ * e il server le legge da li'. Con piu' slot la lettura del file procede
+ * mentre il server elabora gli slot gia' inviati.
+ */
+int invia_shm(const char *file_path, const char *socket_path, const char *tenant) {
+    struct sockaddr_un addr;
+    struct shm_region region;
+    struct shm_msg msg;
+    size_t slot_base[SHM_DEFAULT_SLOTS];
+    int *labels = NULL;
+    size_t total = 0;
+    uint32_t seq = 0, inflight = 0;
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        LOG_ERROR("event=socket_fallita transport=unix error=\"%s\"", strerror(errno));
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOG_ERROR("event=connect_fallita transport=unix path=%s error=\"%s\"", socket_path, strerror(errno));
+        close(sock);
+        return 1;
+    }
+    LOG_INFO("event=connesso transport=unix path=%s", socket_path);
+
+    if (shm_region_create(&region, SHM_DEFAULT_SLOTS, SHM_DEFAULT_SLOT_ROWS, INPUT_SIZE, tenant) < 0) {
+        close(sock);
+        return 1;
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.type = SHM_MSG_HELLO;
+    if (shm_send_msg(sock, &msg, region.fd) < 0) {
+        LOG_ERROR("event=invio_regione_fallito error=\"%s\"", strerror(errno));
+        shm_region_close(&region);
+        close(sock);
+        return 1;
+    }
+
+    FILE *fp = fopen(file_path, "r");
+    if (fp == NULL) {
+        LOG_ERROR("event=apertura_file_fallita path=%s error=\"%s\"", file_path, strerror(errno));
+        shm_region_close(&region);
+        close(sock);
+        return 1;
+    }
+
+    int eof = 0, err = 0;
+    while (!err && (!eof || inflight > 0)) {
+        // Ring pieno o file finito: si attende il completamento dello slot piu' vecchio
+        if (inflight == SHM_DEFAULT_SLOTS || (eof && inflight > 0)) {
+            if (shm_recv_msg(sock, &msg, NULL) < 0 || msg.type != SHM_MSG_DONE) {
+                LOG_ERROR("event=errore_server transport=unix");
+                err = 1;
+                break;
+            }
+            memcpy(labels + slot_base[msg.slot], shm_slot_labels(&region, msg.slot), msg.rows * sizeof(int));
+            inflight--;
+            continue;
+        }
+
+        uint32_t slot = seq % SHM_DEFAULT_SLOTS;
+        int rows = leggi_righe(fp, shm_slot_input(&region, slot), SHM_DEFAULT_SLOT_ROWS);
+        if (rows == 0) {
+            eof = 1;
+            continue;
+        }
+        int *labels_new = realloc(labels, (total + rows) * sizeof(int));
+        if (labels_new == NULL) {
+            LOG_ERROR("event=memoria_esaurita rows=%zu", total + rows);
+            err = 1;
+            break;
+        }
+        labels = labels_new;
+        slot_base[slot] = total;
+        total += rows;
+
+        msg.type = SHM_MSG_SUBMIT;
+        msg.slot = slot;
+        msg.rows = rows;
+        msg.seq = seq++;
+        if (shm_send_msg(sock, &msg, -1) < 0) {
+            LOG_ERROR("event=invio_slot_fallito error=\"%s\"", strerror(errno));
+            err = 1;
+            break;
+        }
+        inflight++;
+    }
+    fclose(fp);
+
+    msg.type = SHM_MSG_END;
+    shm_send_msg(sock, &msg, -1);
+    shm_region_close(&region);
+    close(sock);
+    if (err) {
+        free(labels);
+        return 1;
+    }
+
+    // Stesso formato della risposta TCP
+    struct json_object *json_obj = json_object_new_object();
+    struct json_object *json_predictions = json_object_new_array();
+    for (size_t i = 0; i < total; i++)
+        json_object_array_add(json_predictions, json_object_new_int(labels[i]));
+    json_object_object_add(json_obj, "Labels", json_predictions);
+    printf("%s", json_object_to_json_string(json_obj));
+    json_object_put(json_obj);
+    free(labels);
+    return 0;
+}
+
+/*
+ * Modalita' scatter-gather: il file viene diviso in intervalli di righe
+ * (shard) inviati in parallelo a tutte le repliche del server. Ogni endpoint
+ * ha un thread che preleva il prossimo shard libero, quindi le repliche piu'
+ * veloci ne elaborano di piu'. Uno shard fallito torna in coda per un altro
+ * endpoint; quando non restano shard liberi, un thread inattivo duplica lo
+ * shard in corso da piu' tempo rispetto alla media (hedging) e vince la
+ * prima risposta. Le etichette vengono ricomposte nell'ordine originale.
+ */
+
+#define SHARDS_PER_ENDPOINT 4
+#define MAX_SHARD_ATTEMPTS 3
+#define MAX_ENDPOINT_FAILURES 3
+#define HEDGE_FACTOR 2.0
+
+enum shard_state { SHARD_PENDING, SHARD_RUNNING, SHARD_DONE };
+
+struct shard {
+    const char *data; // righe del CSV nel file mappato
+    size_t len;
+    size_t first_row;
+    int rows;
+    int state;
+    int attempts;
+    int running;  // tentativi in corso (originale + eventuale copia hedge)
+    int hedged;
+    long long started_ns;
+    int fds[2];   // socket dei tentativi in corso, chiuse quando uno vince
+    struct endpoint *last_failed;
+};
+
+struct endpoint {
+    char host[NI_MAXHOST];
+    char port[NI_MAXSERV];
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    pthread_t thread;
+    int failures;
+    int shards_done;
+    long long busy_ns;
+};
+
+struct scatter {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct shard *shards;
+    int n_shards;
+    int remaining;
+    int failed;
+    int *labels;
+    struct endpoint *endpoints;
+    int n_endpoints;
+    struct payload_hello *mode; // codifica degli shard, NULL = CSV storico
+    int alive; // endpoint non ancora esclusi
+    long long done_ns_total;
+    int done_count;
+    int retries;
+    int hedges;
+};
+
+static long long client_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Aggiunge alla lista gli indirizzi IPv4 di host; con un servizio headless
+// il DNS restituisce un record A per ogni replica
+int risolvi_endpoint(const char *spec, struct endpoint **eps, int *n) {
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM}, *res;
+
+    const char *colon = strrchr(spec, ':');
+    if (colon != NULL) {
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - spec), spec);
+        snprintf(port, sizeof(port), "%s", colon + 1);
+    } else {
+        snprintf(host, sizeof(host), "%s", spec);
+        snprintf(port, sizeof(port), "%d", PORT);
+    }
+    int rc = getaddrinfo(host, port, &hints, &res);
+    if (rc != 0) {
+        LOG_ERROR("event=risoluzione_fallita host=%s error=\"%s\"", host, gai_strerror(rc));
+        return -1;
+    }
+    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+        *eps = realloc(*eps, (*n + 1) * sizeof(struct endpoint));
+        struct endpoint *ep = &(*eps)[*n];
+        memset(ep, 0, sizeof(*ep));
+        memcpy(&ep->addr, ai->ai_addr, ai->ai_addrlen);
+        ep->addr_len = ai->ai_addrlen;
+        getnameinfo(ai->ai_addr, ai->ai_addrlen, ep->host, sizeof(ep->host), ep->port, sizeof(ep->port),
+                    NI_NUMERICHOST | NI_NUMERICSERV);
+        (*n)++;
+    }
+    freeaddrinfo(res);
+    return 0;
+}
+
+// Registra o rimuove la socket di un tentativo; da chiamare con il lock
+static void shard_set_fd(struct shard *sh, int old_fd, int new_fd) {
+    for (int i = 0; i < 2; i++) {
+        if (sh->fds[i] == old_fd) {
+            sh->fds[i] = new_fd;
+            return;
+        }
+    }
+}
+
+// Esegue uno shard su un endpoint: invia le righe e legge le etichette
+static int esegui_shard(struct scatter *sc, struct endpoint *ep, struct shard *sh, int *labels) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+        return -1;
+    if (connect(sock, (struct sockaddr *)&ep->addr, ep->addr_len) < 0) {
+        LOG_WARN("event=connect_fallita endpoint=%s:%s error=\"%s\"", ep->host, ep->port, strerror(errno));
+        close(sock);
+        return -1;
+    }
+    pthread_mutex_lock(&sc->lock);
+    shard_set_fd(sh, -1, sock);
+    pthread_mutex_unlock(&sc->lock);
+
+    int ret = -1, sent = 0;
+    char *json = NULL;
+    if (deadline_ms > 0)
+        sent = payload_send_deadline(sock, deadline_ms);
+    if (sent == 0 && sc->mode != NULL) {
+        struct payload_hello mode = *sc->mode;
+        FILE *fp = fmemopen((void *)sh->data, sh->len, "r");
+        sent = fp != NULL ? invia_payload(sock, &mode, fp) : -1;
+        if (fp != NULL)
+            fclose(fp);
+    } else if (sent == 0) {
+        sent = invia_tutto(sock, sh->data, sh->len);
+    }
+    if (sent == 0 && shutdown(sock, SHUT_WR) == 0 &&
+        (json = ricevi_json(sock)) != NULL) {
+        struct json_object *obj = json_tokener_parse(json), *arr;
+        if (obj != NULL && json_object_object_get_ex(obj, "Labels", &arr) &&
+            (int)json_object_array_length(arr) == sh->rows) {
+            for (int i = 0; i < sh->rows; i++)
+                labels[i] = json_object_get_int(json_object_array_get_idx(arr, i));
+            ret = 0;
+        }
+        json_object_put(obj);
+    }
+    free(json);
+
+    pthread_mutex_lock(&sc->lock);
+    shard_set_fd(sh, sock, -1);
+    pthread_mutex_unlock(&sc->lock);
+    // Un tentativo fallito o superato da un hedge si chiude con un reset: il
+    // server lo vede subito e scarta il lavoro ancora in coda
+    if (ret < 0) {
+        struct linger reset = {.l_onoff = 1, .l_linger = 0};
+        setsockopt(sock, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    }
+    close(sock);
+    return ret;
+}
+
+// Sceglie il lavoro per un endpoint: prima gli shard liberi, poi un hedge.
+// Uno shard fallito non torna all'endpoint che l'ha appena fallito finche'
+// ce n'e' un altro attivo
+static struct shard *prossimo_shard(struct scatter *sc, struct endpoint *ep) {
+    struct shard *slowest = NULL;
+    long long now = client_now_ns();
+
+    for (int i = 0; i < sc->n_shards; i++) {
+        struct shard *sh = &sc->shards[i];
+        if (sh->state == SHARD_PENDING && (sh->last_failed != ep || sc->alive == 1)) {
+            sh->state = SHARD_RUNNING;
+            sh->attempts++;
+            sh->started_ns = now;
+            return sh;
+        }
+        if (sh->state == SHARD_RUNNING && sh->running == 1 && !sh->hedged &&
+            (slowest == NULL || sh->started_ns < slowest->started_ns))
+            slowest = sh;
+    }
+    if (slowest != NULL && sc->done_count > 0 &&
+        now - slowest->started_ns > HEDGE_FACTOR * sc->done_ns_total / sc->done_count) {
+        slowest->hedged = 1;
+        sc->hedges++;
+        return slowest;
+    }
+    return NULL;
+}
+
+static void *endpoint_main(void *arg) {
+    struct scatter *sc = ((void **)arg)[0];
+    struct endpoint *ep = ((void **)arg)[1];
+    free(arg);
+
+    pthread_mutex_lock(&sc->lock);
+    while (sc->remaining > 0 && !sc->failed && ep->failures < MAX_ENDPOINT_FAILURES) {
+        struct shard *sh = prossimo_shard(sc, ep);
+        if (sh == NULL) {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += 10000000L;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&sc->changed, &sc->lock, &until);
+            continue;
+        }
+        sh->running++;
+        pthread_mutex_unlock(&sc->lock);
+
+        long long start = client_now_ns();
+        int *labels = malloc(sh->rows * sizeof(int));
+        int rc = labels != NULL ? esegui_shard(sc, ep, sh, labels) : -1;
+        long long elapsed = client_now_ns() - start;
+
+        pthread_mutex_lock(&sc->lock);
+        sh->running--;
+        if (rc == 0 && sh->state != SHARD_DONE) {
+            memcpy(sc->labels + sh->first_row, labels, sh->rows * sizeof(int));
+            sh->state = SHARD_DONE;
+            sc->remaining--;
+            sc->done_ns_total += elapsed;
+            sc->done_count++;
+            ep->shards_done++;
+            ep->busy_ns += elapsed;
+            ep->failures = 0;
+            // Il tentativo perdente viene interrotto: il server vede la chiusura
+            for (int i = 0; i < 2; i++)
+                if (sh->fds[i] >= 0)
+                    shutdown(sh->fds[i], SHUT_RDWR);
+        } else if (rc < 0 && sh->state != SHARD_DONE) {
+            ep->failures++;
+            sh->last_failed = ep;
+            if (sh->running == 0) {
+                if (sh->attempts >= MAX_SHARD_ATTEMPTS) {
+                    LOG_ERROR("event=shard_fallito first_row=%zu rows=%d attempts=%d", sh->first_row, sh->rows,
+                              sh->attempts);
+                    sc->failed = 1;
+                } else {
+                    sc->retries++;
+                    sh->state = SHARD_PENDING;
+                    sh->hedged = 0;
+                }
+            }
+            LOG_WARN("event=shard_ritentato endpoint=%s:%s first_row=%zu attempts=%d", ep->host, ep->port,
+                     sh->first_row, sh->attempts);
+        }
+        free(labels);
+        pthread_cond_broadcast(&sc->changed);
+    }
+    sc->alive--;
+    if (ep->failures >= MAX_ENDPOINT_FAILURES)
+        LOG_WARN("event=endpoint_escluso endpoint=%s:%s", ep->host, ep->port);
+    pthread_cond_broadcast(&sc->changed);
+    pthread_mutex_unlock(&sc->lock);
+    return NULL;
+}
+
+int invia_scatter(const char *file_path, struct endpoint *eps, int n_eps, struct payload_hello *mode) {
+    struct scatter sc = {.endpoints = eps, .n_endpoints = n_eps, .mode = mode, .alive = n_eps};
+    struct stat st;
+
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        LOG_ERROR("event=apertura_file_fallita path=%s error=\"%s\"", file_path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+    const char *data = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (data == MAP_FAILED || data == NULL) {
+        LOG_ERROR("event=mmap_fallita path=%s", file_path);
+        return 1;
+    }
+
+    // Conta le righe di dati (l'ultima puo' non avere l'a capo finale)
+    size_t total_rows = 0;
+    for (const char *p = data, *end = data + st.st_size; p < end;) {
+        const char *nl = memchr(p, '\n', end - p);
+        total_rows += !riga_vuota(p, nl != NULL ? nl : end);
+        p = nl != NULL ? nl + 1 : end;
+    }
+
+    // Shard di righe consecutive, piu' shard che endpoint per bilanciare il carico
+    int n_shards = n_eps * SHARDS_PER_ENDPOINT;
+    if ((size_t)n_shards > total_rows)
+        n_shards = total_rows > 0 ? total_rows : 1;
+    size_t rows_per_shard = (total_rows + n_shards - 1) / n_shards;
+    sc.shards = calloc(n_shards, sizeof(struct shard));
+    sc.labels = calloc(total_rows > 0 ? total_rows : 1, sizeof(int));
+    const char *p = data, *end = data + st.st_size;
+    for (size_t row = 0; row < total_rows && sc.n_shards < n_shards; sc.n_shards++) {
+        struct shard *sh = &sc.shards[sc.n_shards];
+        sh->data = p;
+        sh->first_row = row;
+        sh->fds[0] = sh->fds[1] = -1;
+        // Le righe vuote restano nello shard ma non contano: il server le salta
+        while (sh->rows < (int)rows_per_shard && p < end) {
+            const char *nl = memchr(p, '\n', end - p);
+            sh->rows += !riga_vuota(p, nl != NULL ? nl : end);
+            p = nl != NULL ? nl + 1 : end;
+        }
+        sh->len = p - sh->data;
+        row += sh->rows;
+    }
+    sc.remaining = sc.n_shards;
+    pthread_mutex_init(&sc.lock, NULL);
+    pthread_cond_init(&sc.changed, NULL);
+    LOG_INFO("event=scatter_inizio endpoints=%d shards=%d rows=%zu", n_eps, sc.n_shards, total_rows);
+
+    long long start = client_now_ns();
+    for (int i = 0; i < n_eps; i++) {
+        void **arg = malloc(2 * sizeof(void *));
+        arg[0] = &sc;
+        arg[1] = &eps[i];
+        pthread_create(&eps[i].thread, NULL, endpoint_main, arg);
+    }
+    for (int i = 0; i < n_eps; i++)
+        pthread_join(eps[i].thread, NULL);
+    double secs = (client_now_ns() - start) / 1e9;
+
+    for (int i = 0; i < n_eps; i++)
+        LOG_INFO("event=endpoint_stats endpoint=%s:%s shards=%d busy_ms=%.3f", eps[i].host, eps[i].port,
+                 eps[i].shards_done, eps[i].busy_ns / 1e6);
+    LOG_INFO("event=scatter_fine rows=%zu secs=%.3f rows_per_sec=%.1f retries=%d hedges=%d", total_rows, secs,
+             secs > 0 ? total_rows / secs : 0.0, sc.retries, sc.hedges);
+
+    int ret = 0;
+    if (sc.remaining > 0) {
+        LOG_ERROR("event=scatter_incompleto shards_mancanti=%d", sc.remaining);
+        ret = 1;
+    } else {
+        // Stesso formato della risposta TCP
+        struct json_object *json_obj = json_object_new_object();
+        struct json_object *json_predictions = json_object_new_array();
+        for (size_t i = 0; i < total_rows; i++)
+            json_object_array_add(json_predictions, json_object_new_int(sc.labels[i]));
+        json_object_object_add(json_obj, "Labels", json_predictions);
+        printf("%s", json_object_to_json_string(json_obj));
+        json_object_put(json_obj);
+    }
+
+    pthread_mutex_destroy(&sc.lock);
+    pthread_cond_destroy(&sc.changed);
+    munmap((void *)data, st.st_size);
+    free(sc.shards);
+    free(sc.labels);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    const char *socket_path = NULL;
+    const char *tenant = NULL;
+    struct endpoint *endpoints = NULL;
+    int n_endpoints = 0;
+    struct payload_hello mode, *modep = NULL;
+    int opt;
+
+    // Con -u il client usa la socket Unix e la memoria condivisa, altrimenti TCP;
+    // -t sceglie il tenant con cui il server schedula la richiesta
+    while ((opt = getopt(argc, argv, "u:t:e:z:d:")) != -1) {
+        switch (opt) {
+        case 'u':
+            socket_path = optarg;
+            break;
+        case 't':
+            tenant = optarg;
+            break;
+        case 'e':
+            // Ripetibile: host[:porta], un nome con piu' record A vale per tutte le repliche
+            if (risolvi_endpoint(optarg, &endpoints, &n_endpoints) < 0)
+                return 1;
+            break;
+        case 'z':
+            // Codifica dell'upload TCP: csv, raw o sparse, con +lz4 o +zstd[:livello]
+            if (payload_parse_mode(optarg, &mode) < 0) {
+                fprintf(stderr, "Codifica non valida: %s\n", optarg);
+                return 1;
+            }
+            modep = &mode;
+            break;
+        case 'd':
+            // Oltre questo tempo il server abbandona la richiesta e risponde con un errore
+            deadline_ms = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-u unix_socket_path [-t tenant] | [-e host[:port]...] [-z encoding[+lz4|+zstd]] [-d deadline_ms]] <csv_file_path>\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-u unix_socket_path [-t tenant] | [-e host[:port]...] [-z encoding[+lz4|+zstd]] [-d deadline_ms]] <csv_file_path>\n", argv[0]);
+        return 1;
+    }
+
+    // I log vanno su stderr: stdout e' riservato al JSON delle etichette
+    log_init("client", STDERR_FILENO);
+    if (socket_path != NULL)
+        return invia_shm(argv[optind], socket_path, tenant);
+    if (n_endpoints > 0) {
+        int ret = invia_scatter(argv[optind], endpoints, n_endpoints, modep);
+        free(endpoints);
+        return ret;
+    }
+    return invia_tcp(argv[optind], modep);
+}
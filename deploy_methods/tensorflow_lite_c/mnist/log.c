@@ -0,0 +1,239 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define LOG_RING_SIZE 1024 // record per thread, potenza di 2
+#define LOG_MSG_SIZE 228
+#define LOG_IDLE_SLEEP_NS 1000000L
+
+struct log_record {
+    struct timespec ts;
+    int level;
+    pid_t tid;
+    char msg[LOG_MSG_SIZE];
+};
+
+// Ring di un singolo thread: il thread scrive in head, il writer legge da tail
+struct log_ring {
+    struct log_record records[LOG_RING_SIZE];
+    _Atomic unsigned long head;
+    _Atomic unsigned long tail;
+    _Atomic unsigned long dropped;
+    atomic_int in_use;
+    pid_t tid;
+    struct log_ring *next;
+};
+
+int log_runtime_level = LOG_LEVEL_INFO;
+
+static const char *level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+static const char *log_program = "";
+static int log_fd = 1;
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct log_ring *_Atomic rings;
+static __thread struct log_ring *thread_ring;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_t writer;
+static atomic_int writer_running;
+
+// Alla terminazione del thread il ring torna libero per il prossimo thread
+static void release_ring(void *arg) {
+    struct log_ring *ring = arg;
+    atomic_store(&ring->in_use, 0);
+}
+
+static void create_ring_key(void) {
+    pthread_key_create(&ring_key, release_ring);
+}
+
+static struct log_ring *ring_for_thread(void) {
+    if (thread_ring != NULL)
+        return thread_ring;
+
+    pthread_once(&ring_key_once, create_ring_key);
+
+    // Prima si prova a riusare il ring di un thread terminato (i thread di
+    // connessione vivono poco), altrimenti se ne alloca uno nuovo
+    struct log_ring *ring;
+    for (ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+        int free_ring = 0;
+        if (atomic_compare_exchange_strong(&ring->in_use, &free_ring, 1))
+            break;
+    }
+    if (ring == NULL) {
+        ring = calloc(1, sizeof(*ring));
+        if (ring == NULL)
+            return NULL;
+        atomic_store(&ring->in_use, 1);
+        // La lista dei ring cresce solo in testa: il writer la scorre senza lock
+        pthread_mutex_lock(&rings_lock);
+        ring->next = atomic_load(&rings);
+        atomic_store(&rings, ring);
+        pthread_mutex_unlock(&rings_lock);
+    }
+    ring->tid = syscall(SYS_gettid);
+    pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+void log_write(int level, const char *fmt, ...) {
+    struct log_ring *ring = ring_for_thread();
+    if (ring == NULL)
+        return;
+
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == LOG_RING_SIZE) {
+        // Ring pieno: il record si perde ma il thread non si blocca mai
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    struct log_record *rec = &ring->records[head & (LOG_RING_SIZE - 1)];
+    clock_gettime(CLOCK_REALTIME, &rec->ts);
+    rec->level = level;
+    rec->tid = ring->tid;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+    va_end(ap);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static size_t format_record(char *out, size_t size, const struct log_record *rec) {
+    struct tm tm;
+    gmtime_r(&rec->ts.tv_sec, &tm);
+    int n = snprintf(out, size, "ts=%04d-%02d-%02dT%02d:%02d:%02d.%06ldZ level=%s prog=%s pid=%d tid=%d %s\n",
+                     tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                     rec->ts.tv_nsec / 1000, level_names[rec->level], log_program, (int)getpid(), (int)rec->tid,
+                     rec->msg);
+    return n < 0 ? 0 : ((size_t)n < size ? (size_t)n : size - 1);
+}
+
+static void write_all(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(log_fd, buf, len);
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= n;
+    }
+}
+
+// Svuota tutti i ring; restituisce il numero di record scritti
+static int drain(void) {
+    char buf[16384];
+    size_t used = 0;
+    int written = 0;
+
+    for (struct log_ring *ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+        unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (; tail != head; tail++) {
+            if (sizeof(buf) - used < LOG_MSG_SIZE + 128) {
+                write_all(buf, used);
+                used = 0;
+            }
+            used += format_record(buf + used, sizeof(buf) - used, &ring->records[tail & (LOG_RING_SIZE - 1)]);
+            written++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        unsigned long dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+        if (dropped > 0) {
+            if (sizeof(buf) - used < LOG_MSG_SIZE + 128) {
+                write_all(buf, used);
+                used = 0;
+            }
+            struct log_record rec = {.level = LOG_LEVEL_WARN, .tid = ring->tid};
+            clock_gettime(CLOCK_REALTIME, &rec.ts);
+            snprintf(rec.msg, sizeof(rec.msg), "event=log_dropped count=%lu", dropped);
+            used += format_record(buf + used, sizeof(buf) - used, &rec);
+        }
+    }
+    write_all(buf, used);
+    return written;
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    struct timespec idle = {0, LOG_IDLE_SLEEP_NS};
+    while (atomic_load(&writer_running)) {
+        if (drain() == 0)
+            nanosleep(&idle, NULL);
+    }
+    drain();
+    return NULL;
+}
+
+static void start_writer(void) {
+    atomic_store(&writer_running, 1);
+    if (pthread_create(&writer, NULL, writer_main, NULL) != 0)
+        atomic_store(&writer_running, 0);
+}
+
+void log_flush(void) {
+    if (atomic_exchange(&writer_running, 0))
+        pthread_join(writer, NULL);
+    else
+        drain();
+}
+
+static void atfork_prepare(void) {
+    pthread_mutex_lock(&rings_lock);
+}
+
+static void atfork_parent(void) {
+    pthread_mutex_unlock(&rings_lock);
+}
+
+// Nel figlio il writer non esiste piu': i record ancora in coda sono copie di
+// quelli che scrivera' il padre, quindi vengono scartati prima di ripartire
+static void atfork_child(void) {
+    for (struct log_ring *ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+        atomic_store(&ring->tail, atomic_load(&ring->head));
+        atomic_store(&ring->dropped, 0);
+    }
+    if (thread_ring != NULL)
+        thread_ring->tid = syscall(SYS_gettid);
+    pthread_mutex_unlock(&rings_lock);
+    if (atomic_load(&writer_running))
+        start_writer();
+}
+
+static int parse_level(const char *name) {
+    if (name == NULL)
+        return LOG_LEVEL_INFO;
+    if (strcasecmp(name, "DEBUG") == 0)
+        return LOG_LEVEL_DEBUG;
+    if (strcasecmp(name, "WARN") == 0 || strcasecmp(name, "WARNING") == 0)
+        return LOG_LEVEL_WARN;
+    if (strcasecmp(name, "ERROR") == 0)
+        return LOG_LEVEL_ERROR;
+    if (strcasecmp(name, "OFF") == 0)
+        return LOG_LEVEL_OFF;
+    return LOG_LEVEL_INFO;
+}
+
+void log_init(const char *program, int fd) {
+    log_program = program;
+    log_fd = fd;
+    log_runtime_level = parse_level(getenv("LOGGING_LEVEL"));
+    pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
+    atexit(log_flush);
+    start_writer();
+}
@@ -0,0 +1,53 @@
+#ifndef LOG_H
+#define LOG_H
+
+/*
+ * Logging asincrono con filtro per livello.
+ *
+ * Ogni thread scrive i propri record in un ring buffer lock-free (un solo
+ * produttore, un solo consumatore); un thread di background li svuota e li
+ * scrive in formato key=value:
+ *
+ *   ts=2024-05-01T10:00:00.123456Z level=INFO prog=server pid=12 tid=12 event=listen port=30080
+ *
+ * Il messaggio e' una stringa printf che per convenzione inizia con event=.
+ * Il livello minimo si fissa a compilazione con -DLOG_COMPILE_LEVEL=... (le
+ * chiamate sotto soglia spariscono dal binario) e a runtime con la variabile
+ * d'ambiente LOGGING_LEVEL (DEBUG, INFO, WARN, ERROR, OFF). Un record scartato
+ * dal filtro non valuta nemmeno i propri argomenti.
+ */
+
+enum log_level {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF
+};
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+extern int log_runtime_level;
+
+#define LOG_AT(level, ...)                                                        \
+    do {                                                                          \
+        if ((level) >= LOG_COMPILE_LEVEL && (level) >= log_runtime_level)         \
+            log_write((level), __VA_ARGS__);                                      \
+    } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#define LOG_ENABLED(level) ((level) >= LOG_COMPILE_LEVEL && (level) >= log_runtime_level)
+
+// Avvia il thread di scrittura verso fd; il flush finale avviene in automatico
+// all'uscita del processo. Dopo una fork il figlio riavvia il proprio writer.
+void log_init(const char *program, int fd);
+void log_flush(void);
+void log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#endif
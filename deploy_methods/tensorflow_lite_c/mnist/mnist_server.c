@@ -1,9 +1,11 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <regex.h>
 #include <signal.h>
 #include <stdio.h>
@@ -12,64 +14,1272 @@
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/types.h>
-#include <sys/wait.h>
+#include <sys/un.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <stdint.h>
+#include <time.h>
 // include tensorflow lite
 #include "tensorflow/lite/c/c_api.h"
 #include <tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h>
-#include <json-c/json.h>
+
+#include "arena.h"
+#include "autotune.h"
+#include "capture.h"
+#include "log.h"
+#include "payload.h"
+#include "placement.h"
+#include "scheduler.h"
+#include "shm_transport.h"
+#include "telemetry.h"
 
 #define INPUT_SIZE 784 // Dimensioni delle funzionalità di input
 #define OUTPUT_SIZE 10 // Numero di classi (ad esempio, cifre 0-9)
 
-// Struttura per contenere metadati per le previsioni
-struct metadata {
-    float train_feature[INPUT_SIZE];
-    int label;
-    float prediction[OUTPUT_SIZE];
+#define NSEC_PER_SEC 1000000000LL
+#define CANCEL_POLL_MS 10 // controllo della connessione mentre i worker eseguono i batch
+
+long long gettimens() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+// Configurazione del server letta dalla riga di comando
+struct server_config {
+    const char *model_path;
+    const char *weight_cache_path; // cache XNNPACK dei pesi impacchettati (NULL = disabilitata)
+    const char *unix_path;         // socket Unix per i client locali (NULL = solo TCP)
+    int warmup_invokes;            // invoke a vuoto eseguite prima di accettare richieste
+    struct tune_config tune;       // thread, righe per invoke e backend di ogni interprete
+    int autotune_objective;        // -1 = configurazione fissa da riga di comando
+    int autotune_force;            // rifa le misure anche se c'e' un risultato salvato
+    const char *autotune_path;
+    int workers;                   // thread di inferenza, ognuno con il proprio interprete
+    int batch_rows;                // granularita' di scheduling in immagini
+    int stats_interval;            // secondi tra i report per tenant (0 = disabilitati)
+    size_t request_budget;         // memoria massima di una richiesta in byte
+    size_t memory_budget;          // memoria massima di tutte le richieste insieme
+    const char *capture_path;      // registrazione del traffico per replay (NULL = disabilitata)
+    size_t capture_max_payload;    // corpi piu' grandi registrati solo come riferimento
+    struct placement_config placement; // CPU di I/O e dei worker, NUMA e huge page
+    const char *telemetry_path;    // file ad anello dei campioni di risorse (NULL = disabilitato)
+    int telemetry_hz;
+    size_t telemetry_size;
 };
 
-int get_data(FILE *file, struct metadata *data) {
-    char line[INPUT_SIZE * 24 * 4];
-    char *check = fgets(line, INPUT_SIZE * 24 * 4, file);
-    if (check == NULL) {
-        printf("Fine file\n");
+// Tempi delle fasi di avvio in nanosecondi
+struct startup_times {
+    long long load;
+    long long delegate;
+    long long allocate;
+    long long warmup;
+};
+
+// Modello pronto per l'inferenza: delegate, interprete e tensori
+struct engine {
+    TfLiteInterpreterOptions *options;
+    TfLiteDelegate *xnnpack_delegate;
+    TfLiteInterpreter *interpreter;
+    TfLiteTensor *input_tensor;
+    const TfLiteTensor *output_tensor;
+    int batch; // righe elaborate da ogni invoke
+};
+
+void engine_destroy(struct engine *eng) {
+    if (eng->interpreter != NULL)
+        TfLiteInterpreterDelete(eng->interpreter);
+    if (eng->options != NULL)
+        TfLiteInterpreterOptionsDelete(eng->options);
+    if (eng->xnnpack_delegate != NULL)
+        TfLiteXNNPackDelegateDelete(eng->xnnpack_delegate);
+    memset(eng, 0, sizeof(*eng));
+}
+
+/*
+ * Crea delegate XNNPACK e interprete sul modello gia' caricato, misurando le
+ * singole fasi. Con weight_cache_path i pesi impacchettati da XNNPACK vengono
+ * salvati in un file (sul volume montato) che i processi successivi mappano
+ * con mmap invece di rifare il repacking: il primo avvio scrive la cache,
+ * tutti gli altri la riusano condividendo le stesse pagine. Thread, backend e
+ * righe per invoke arrivano da cfg->tune (riga di comando o autotune).
+ */
+int engine_create(struct engine *eng, TfLiteModel *model, const struct server_config *cfg,
+                  struct startup_times *times) {
+    long long start;
+
+    memset(eng, 0, sizeof(*eng));
+
+    start = gettimens();
+    eng->options = TfLiteInterpreterOptionsCreate();
+    TfLiteInterpreterOptionsSetNumThreads(eng->options, cfg->tune.threads); // Parametro thread utilizzati
+    if (cfg->tune.xnnpack) {
+        TfLiteXNNPackDelegateOptions xnnpack_options = TfLiteXNNPackDelegateOptionsDefault();
+        xnnpack_options.num_threads = cfg->tune.threads;
+        // Richiede TensorFlow Lite >= 2.17 (cache dei pesi su file)
+        xnnpack_options.weight_cache_file_path = cfg->weight_cache_path;
+        eng->xnnpack_delegate = TfLiteXNNPackDelegateCreate(&xnnpack_options);
+        if (eng->xnnpack_delegate == NULL && cfg->weight_cache_path != NULL) {
+            // Cache non utilizzabile (volume non montato, permessi...): si procede senza
+            LOG_WARN("event=weight_cache_non_utilizzabile path=%s", cfg->weight_cache_path);
+            xnnpack_options.weight_cache_file_path = NULL;
+            eng->xnnpack_delegate = TfLiteXNNPackDelegateCreate(&xnnpack_options);
+        }
+        if (eng->xnnpack_delegate == NULL) {
+            LOG_ERROR("event=delegate_fallito");
+            engine_destroy(eng);
+            return -1;
+        }
+
+        // Enable XNNPACK
+        TfLiteInterpreterOptionsAddDelegate(eng->options, eng->xnnpack_delegate);
+    }
+
+    // Crea l'interprete del modello (qui XNNPACK impacchetta o mappa i pesi)
+    eng->interpreter = TfLiteInterpreterCreate(model, eng->options);
+    if (eng->interpreter == NULL) {
+        LOG_ERROR("event=interpreter_fallito");
+        engine_destroy(eng);
+        return -1;
+    }
+    times->delegate = gettimens() - start;
+
+    // Con piu' righe per invoke si ridimensiona la prima dimensione dell'input
+    eng->batch = cfg->tune.batch;
+    if (eng->batch > 1) {
+        TfLiteTensor *input = TfLiteInterpreterGetInputTensor(eng->interpreter, 0);
+        int dims[8];
+        int n = input != NULL ? TfLiteTensorNumDims(input) : 0;
+        for (int i = 0; i < n && i < 8; i++)
+            dims[i] = TfLiteTensorDim(input, i);
+        dims[0] = eng->batch;
+        if (n < 1 || n > 8 || TfLiteInterpreterResizeInputTensor(eng->interpreter, 0, dims, n) != kTfLiteOk) {
+            LOG_ERROR("event=resize_fallito batch=%d", eng->batch);
+            engine_destroy(eng);
+            return -1;
+        }
+    }
+
+    // Alloca i tensori dell'interprete
+    start = gettimens();
+    if (TfLiteInterpreterAllocateTensors(eng->interpreter) != kTfLiteOk) {
+        LOG_ERROR("event=allocate_fallito");
+        engine_destroy(eng);
         return -1;
     }
+    times->allocate = gettimens() - start;
+
+    // Ottieni i tensori di input e output
+    eng->input_tensor = TfLiteInterpreterGetInputTensor(eng->interpreter, 0);
+    eng->output_tensor = TfLiteInterpreterGetOutputTensor(eng->interpreter, 0);
+    if (eng->input_tensor == NULL || eng->output_tensor == NULL ||
+        TfLiteTensorByteSize(eng->input_tensor) != (size_t)eng->batch * INPUT_SIZE * sizeof(float) ||
+        TfLiteTensorByteSize(eng->output_tensor) != (size_t)eng->batch * OUTPUT_SIZE * sizeof(float)) {
+        LOG_ERROR("event=input_tensor_fallito");
+        engine_destroy(eng);
+        return -1;
+    }
+    // Input e output stanno nell'arena delle attivazioni allocata qui sopra:
+    // l'avviso copre l'intervallo tra i due, o solo i due tensori se distanti
+    if (cfg->placement.hugepages != PLACEMENT_HUGE_NONE) {
+        const char *in = TfLiteTensorData(eng->input_tensor), *out = TfLiteTensorData(eng->output_tensor);
+        const char *in_end = in + TfLiteTensorByteSize(eng->input_tensor);
+        const char *out_end = out + TfLiteTensorByteSize(eng->output_tensor);
+        const char *lo = in < out ? in : out, *hi = in_end > out_end ? in_end : out_end;
+        if (hi - lo <= (64 << 20)) {
+            placement_advise_range(lo, hi);
+        } else {
+            placement_advise_range(in, in_end);
+            placement_advise_range(out, out_end);
+        }
+    }
+
+    // Warm-up: la prima invoke paga l'inizializzazione pigra dei kernel,
+    // la si esegue qui cosi' la prima richiesta reale non la vede
+    start = gettimens();
+    if (cfg->warmup_invokes > 0) {
+        memset(TfLiteTensorData(eng->input_tensor), 0, TfLiteTensorByteSize(eng->input_tensor));
+        for (int i = 0; i < cfg->warmup_invokes; i++) {
+            if (TfLiteInterpreterInvoke(eng->interpreter) != kTfLiteOk) {
+                LOG_ERROR("event=warmup_fallito");
+                engine_destroy(eng);
+                return -1;
+            }
+        }
+    }
+    times->warmup = gettimens() - start;
+    return 0;
+}
+
+void print_startup_times(const struct startup_times *times) {
+    LOG_INFO("event=avvio load_ms=%.3f delegate_ms=%.3f allocate_ms=%.3f warmup_ms=%.3f totale_ms=%.3f",
+           times->load / 1e6, times->delegate / 1e6, times->allocate / 1e6, times->warmup / 1e6,
+           (times->load + times->delegate + times->allocate + times->warmup) / 1e6);
+}
+
+/*
+ * Copia del flatbuffer sul nodo NUMA indicato, una per nodo e condivisa dai
+ * worker di quel nodo. Va chiamata dal thread gia' spostato sul nodo: le
+ * pagine nascono dove vengono scritte. Con le huge page il buffer e' mappato
+ * a 2 MB invece del file a pagine da 4 KB.
+ */
+static TfLiteModel *node_models[PLACEMENT_MAX_NODES];
+static struct placed_buffer node_buffers[PLACEMENT_MAX_NODES];
+
+TfLiteModel *model_local(const char *path, int node, int hugepages) {
+    if (node_models[node] != NULL)
+        return node_models[node];
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        LOG_ERROR("event=apertura_file_fallita path=%s error=\"%s\"", path, strerror(errno));
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    struct placed_buffer *buf = &node_buffers[node];
+    if (size <= 0 || placement_alloc(buf, size, hugepages) < 0 || fread(buf->data, 1, size, file) != (size_t)size) {
+        LOG_ERROR("event=copia_modello_fallita path=%s node=%d", path, node);
+        fclose(file);
+        placement_free(buf);
+        return NULL;
+    }
+    fclose(file);
+    // Il buffer deve sopravvivere al modello: resta mappato fino all'uscita
+    node_models[node] = TfLiteModelCreate(buf->data, buf->size);
+    if (node_models[node] == NULL) {
+        LOG_ERROR("event=load_fallito path=%s node=%d", path, node);
+        placement_free(buf);
+        return NULL;
+    }
+    LOG_INFO("event=placement_modello nodo=%d nodo_pagine=%d bytes=%zu mappati=%zu huge=%s", node, buf->node,
+             buf->size, buf->mapped, placement_huge_name(buf->huge));
+    return node_models[node];
+}
+
+// Esegue il modello su rows immagini consecutive, eng->batch per invoke, e
+// scrive le label predette; l'ultima invoke viene completata con righe nulle.
+// Se *cancel diventa diverso da zero si ferma prima dell'invoke successiva:
+// restituisce le righe effettivamente elaborate
+int predict(struct engine *eng, const float *features, int rows, int32_t *labels, const int *cancel) {
+    float *input = TfLiteTensorData(eng->input_tensor);
+    int first;
+
+    for (first = 0; first < rows; first += eng->batch) {
+        if (__atomic_load_n(cancel, __ATOMIC_RELAXED))
+            return first;
+        int n = rows - first < eng->batch ? rows - first : eng->batch;
+
+        // Copia i dati di input nel tensore di input
+        memcpy(input, features + (size_t)first * INPUT_SIZE, (size_t)n * INPUT_SIZE * sizeof(float));
+        if (n < eng->batch)
+            memset(input + (size_t)n * INPUT_SIZE, 0, (size_t)(eng->batch - n) * INPUT_SIZE * sizeof(float));
+
+        // Esegui l'interprete per ottenere le previsioni
+        TfLiteInterpreterInvoke(eng->interpreter);
+        const float *prediction = TfLiteTensorData(eng->output_tensor);
+
+        // Ottieni la label predetta di ogni riga
+        for (int r = 0; r < n; r++, prediction += OUTPUT_SIZE) {
+            float max = 0;
+            int predicted_label = 0;
+            for (int i = 0; i < OUTPUT_SIZE; i++) {
+                if (prediction[i] > max) {
+                    max = prediction[i];
+                    predicted_label = i;
+                }
+            }
+            labels[first + r] = predicted_label;
+        }
+    }
+    return rows;
+}
+
+static struct server_config cfg;
+static struct sched scheduler;
+static struct mem_budget memory;
+static struct capture capture;
+static struct telemetry telemetry;
+static pthread_mutex_t labels_lock = PTHREAD_MUTEX_INITIALIZER;
+
+enum cancel_reason {
+    CANCEL_NONE = 0,
+    CANCEL_DISCONNECT, // il client ha chiuso o resettato la connessione
+    CANCEL_DEADLINE,   // scaduto il tempo indicato dal client
+    CANCEL_REASONS
+};
+
+static const char *const cancel_names[CANCEL_REASONS] = {"nessuno", "disconnessione", "deadline"};
+
+// Richieste abbandonate e lavoro risparmiato, per il report periodico
+static struct {
+    pthread_mutex_t lock;
+    unsigned long requests[CANCEL_REASONS];
+    unsigned long batches;
+    unsigned long long rows;
+} cancellations = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Richiesta di un client: i batch vengono eseguiti dai worker mentre il
+// thread della connessione attende che siano tutti completati. Alla
+// cancellazione i batch ancora in coda escono dallo scheduler, quelli gia'
+// presi da un worker si interrompono tra un invoke e l'altro
+struct request {
+    struct sched_tenant *tenant;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int pending;
+    long long deadline_ns; // 0 = nessuna scadenza
+    int cancelled;         // cancel_reason, letto dai worker senza lock
+};
+
+// Unita' di lavoro schedulata: fino a batch_rows immagini consecutive.
+// Completato il batch restano valide solo le label: l'input puo' essere
+// riusato per un batch successivo della stessa richiesta
+struct batch {
+    struct sched_item item; // deve restare il primo membro
+    struct request *req;
+    const float *input;
+    int32_t *labels;
+    int rows;
+    int done;
+    struct batch *next;
+};
+
+// Accoda le etichette predette al file y_test.csv, terminate da -1
+int salva_labels(const struct batch *first) {
+    // Le richieste concorrenti non devono mescolare le proprie etichette
+    pthread_mutex_lock(&labels_lock);
+    //file y_test.csv da salvare con le etichette predette
+    FILE *labels_file = fopen("/var/data/ml_model_prova/labels/y_test.csv", "a");
+    if(labels_file == NULL){
+        LOG_ERROR("event=apertura_file_fallita path=%s error=\"%s\"", "/var/data/ml_model_prova/labels/y_test.csv", strerror(errno));
+        pthread_mutex_unlock(&labels_lock);
+        return -1;
+    }
+
+    int i = 0;
+    for (const struct batch *b = first; b != NULL; b = b->next) {
+        for (int r = 0; r < b->rows; r++, i++) {
+            LOG_DEBUG("event=label index=%d label=%d", i, b->labels[r]);
+            fprintf(labels_file, "%d\n", b->labels[r]);
+        }
+    }
+    fprintf(labels_file, "-1\n");
+    fclose(labels_file);
+    pthread_mutex_unlock(&labels_lock);
+    return 0;
+}
+
+struct worker {
+    pthread_t thread;
+    int id;
+    struct engine eng;
+};
+
+struct connection {
+    int fd;
+    int unix_socket;
+    char peer[INET_ADDRSTRLEN];
+};
+
+void request_init(struct request *req, struct sched_tenant *tenant) {
+    pthread_condattr_t attr;
+    req->tenant = tenant;
+    req->pending = 0;
+    req->deadline_ns = 0;
+    req->cancelled = CANCEL_NONE;
+    pthread_mutex_init(&req->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&req->done, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+void request_destroy(struct request *req) {
+    pthread_mutex_destroy(&req->lock);
+    pthread_cond_destroy(&req->done);
+}
+
+void request_submit(struct request *req, struct batch *b) {
+    b->req = req;
+    b->done = 0;
+    b->item.cost = b->rows;
+    pthread_mutex_lock(&req->lock);
+    req->pending++;
+    pthread_mutex_unlock(&req->lock);
+    sched_push(&scheduler, req->tenant, &b->item);
+}
+
+static int batch_of_request(const struct sched_item *item, void *arg) {
+    return ((const struct batch *)item)->req == arg;
+}
+
+// I batch ancora in coda non arrivano ai worker: escono dallo scheduler e
+// risultano completati, scartati come quelli interrotti dai worker
+static void request_unqueue(struct request *req) {
+    struct sched_item *item = sched_remove(&scheduler, req->tenant, batch_of_request, req);
+    unsigned long batches = 0;
+    unsigned long long rows = 0;
+    if (item == NULL)
+        return;
+    pthread_mutex_lock(&req->lock);
+    while (item != NULL) {
+        struct batch *b = (struct batch *)item;
+        item = item->next;
+        b->done = 1;
+        req->pending--;
+        batches++;
+        rows += b->rows;
+    }
+    pthread_cond_broadcast(&req->done);
+    pthread_mutex_unlock(&req->lock);
+
+    pthread_mutex_lock(&cancellations.lock);
+    cancellations.batches += batches;
+    cancellations.rows += rows;
+    pthread_mutex_unlock(&cancellations.lock);
+}
+
+// Solo il primo motivo conta: la cancellazione non si annulla. Da chiamare
+// senza req->lock
+void request_cancel(struct request *req, int reason) {
+    int expected = CANCEL_NONE;
+    if (!__atomic_compare_exchange_n(&req->cancelled, &expected, reason, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return;
+    pthread_mutex_lock(&cancellations.lock);
+    cancellations.requests[reason]++;
+    pthread_mutex_unlock(&cancellations.lock);
+    request_unqueue(req);
+}
+
+int request_cancelled(struct request *req) {
+    int reason = __atomic_load_n(&req->cancelled, __ATOMIC_RELAXED);
+    if (reason == CANCEL_NONE && req->deadline_ns > 0 && gettimens() >= req->deadline_ns) {
+        request_cancel(req, CANCEL_DEADLINE);
+        reason = __atomic_load_n(&req->cancelled, __ATOMIC_RELAXED);
+    }
+    return reason;
+}
+
+/*
+ * Il client si e' disconnesso se la socket ha un errore (reset) o e' chiusa
+ * in entrambe le direzioni. La chiusura in sola scrittura che termina
+ * l'upload TCP non basta: e' il protocollo normale.
+ */
+int peer_disconnected(int fd) {
+    struct pollfd pfd = {.fd = fd, .events = 0};
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLERR | POLLHUP));
+}
+
+// Attende al massimo CANCEL_POLL_MS un batch completato; con req->lock preso
+static void request_timedwait(struct request *req) {
+    struct timespec until;
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_nsec += CANCEL_POLL_MS * 1000000L;
+    if (until.tv_nsec >= NSEC_PER_SEC) {
+        until.tv_sec++;
+        until.tv_nsec -= NSEC_PER_SEC;
+    }
+    pthread_cond_timedwait(&req->done, &req->lock, &until);
+}
+
+// Con req->lock preso: cancella la richiesta scaduta o abbandonata dal client
+static void request_check(struct request *req, int fd) {
+    if (__atomic_load_n(&req->cancelled, __ATOMIC_RELAXED) != CANCEL_NONE)
+        return;
+    pthread_mutex_unlock(&req->lock);
+    if (request_cancelled(req) == CANCEL_NONE && fd >= 0 && peer_disconnected(fd))
+        request_cancel(req, CANCEL_DISCONNECT);
+    pthread_mutex_lock(&req->lock);
+}
+
+/*
+ * Attende tutti i batch della richiesta. Tra un batch e l'altro (e almeno
+ * ogni CANCEL_POLL_MS) controlla la connessione fd e la scadenza: una
+ * richiesta abbandonata viene cancellata e i batch rimasti escono dalla coda
+ * invece di essere eseguiti. Ritorna comunque solo quando nessun worker usa
+ * piu' i batch, perche' vivono nell'arena della richiesta.
+ */
+void request_wait(struct request *req, int fd) {
+    pthread_mutex_lock(&req->lock);
+    while (req->pending > 0) {
+        request_timedwait(req);
+        if (req->pending > 0)
+            request_check(req, fd);
+    }
+    pthread_mutex_unlock(&req->lock);
+}
 
-    char *token = strtok(line, ",");
-    for (int i = 0; i < INPUT_SIZE; i++) {
-        data->train_feature[i] = atof(token);
-        token = strtok(NULL, ",");
+// Dopo questa chiamata il batch puo' essere gia' stato riusato dalla connessione
+void request_batch_done(struct batch *b) {
+    struct request *req = b->req;
+    pthread_mutex_lock(&req->lock);
+    b->done = 1;
+    req->pending--;
+    pthread_cond_broadcast(&req->done);
+    pthread_mutex_unlock(&req->lock);
+}
+
+// Attende un singolo batch della richiesta con gli stessi controlli di
+// request_wait; -1 se la richiesta viene cancellata prima che sia eseguito
+int request_wait_batch(struct request *req, struct batch *b, int fd) {
+    pthread_mutex_lock(&req->lock);
+    while (!b->done && __atomic_load_n(&req->cancelled, __ATOMIC_RELAXED) == CANCEL_NONE) {
+        request_timedwait(req);
+        if (!b->done)
+            request_check(req, fd);
     }
+    int done = b->done;
+    pthread_mutex_unlock(&req->lock);
+    return done ? 0 : -1;
+}
+
+void *worker_main(void *arg) {
+    struct worker *w = arg;
+    struct sched_item *item;
+    char name[32];
+
+    snprintf(name, sizeof(name), "worker-%d", w->id);
+    name[15] = '\0'; // limite dei nomi dei thread
+    pthread_setname_np(pthread_self(), name);
+
+    while ((item = sched_pop(&scheduler)) != NULL) {
+        struct batch *b = (struct batch *)item;
+        int rows = 0;
+        if (request_cancelled(b->req) == CANCEL_NONE)
+            rows = predict(&w->eng, b->input, b->rows, b->labels, &b->req->cancelled);
+        if (rows < b->rows) {
+            pthread_mutex_lock(&cancellations.lock);
+            cancellations.batches++;
+            cancellations.rows += b->rows - rows;
+            pthread_mutex_unlock(&cancellations.lock);
+        }
+        sched_done(&scheduler, item);
+        request_batch_done(b);
+    }
+    return NULL;
+}
+
+// Stato della ricezione TCP: batch gia' in coda e batch in riempimento.
+// recycle e' il batch piu' vecchio che possiede ancora il proprio input
+struct tcp_upload {
+    struct request *req;
+    int fd; // per accorgersi della disconnessione mentre si attende un batch
+    struct arena *arena;
+    struct batch *first, *last, *cur, *recycle;
+    int count;
+    int recycled;
+    int rejected;
+};
+
+// Mette in coda il batch corrente, tenendo l'ordine di arrivo
+void upload_flush(struct tcp_upload *up) {
+    if (up->cur == NULL)
+        return;
+    if (up->cur->rows == 0)
+        return; // resta pronto per la prossima riga, la memoria e' dell'arena
+    if (up->last != NULL)
+        up->last->next = up->cur;
+    else
+        up->first = up->cur;
+    up->last = up->cur;
+    if (up->recycle == NULL)
+        up->recycle = up->cur;
+    request_submit(up->req, up->cur);
+    up->cur = NULL;
+}
+
+// Riprende l'input del batch inviato piu' vecchio se e' gia' stato eseguito;
+// con wait lo attende invece di rinunciare
+float *upload_recycle(struct tcp_upload *up, int wait) {
+    struct batch *b = up->recycle;
+    if (b == NULL)
+        return NULL;
+    if (wait) {
+        if (request_wait_batch(up->req, b, up->fd) < 0)
+            return NULL;
+    } else {
+        pthread_mutex_lock(&up->req->lock);
+        int done = b->done;
+        pthread_mutex_unlock(&up->req->lock);
+        if (!done)
+            return NULL;
+    }
+    float *input = (float *)b->input;
+    b->input = NULL;
+    up->recycle = b->next;
+    up->recycled++;
+    return input;
+}
+
+/*
+ * Nuovo batch dall'arena della richiesta. Le label restano fino alla
+ * risposta, mentre l'input di un batch gia' eseguito viene riusato: in questo
+ * modo una richiesta grande procede in streaming dentro il proprio budget.
+ * Solo se non c'e' nulla in volo da attendere la richiesta viene rifiutata.
+ */
+struct batch *upload_batch_new(struct tcp_upload *up) {
+    struct batch *b = arena_alloc(up->arena, sizeof(*b) + cfg.batch_rows * sizeof(int32_t));
+    if (b == NULL)
+        return NULL;
+    memset(b, 0, sizeof(*b));
+    b->labels = (int32_t *)(b + 1);
+
+    float *input = upload_recycle(up, 0);
+    if (input == NULL)
+        input = arena_alloc(up->arena, (size_t)cfg.batch_rows * INPUT_SIZE * sizeof(float));
+    if (input == NULL)
+        input = upload_recycle(up, 1);
+    if (input == NULL)
+        return NULL;
+    b->input = input;
+    return b;
+}
+
+// Il decoder scrive ogni immagine direttamente nella prossima riga libera del
+// batch; una richiesta cancellata interrompe l'upload senza contare come rifiuto
+float *upload_row_begin(void *ctx) {
+    struct tcp_upload *up = ctx;
+    if (up->cur == NULL) {
+        if (request_cancelled(up->req) != CANCEL_NONE)
+            return NULL;
+        if ((up->cur = upload_batch_new(up)) == NULL) {
+            // La cancellazione puo' arrivare mentre si attende un batch da riusare
+            if (request_cancelled(up->req) == CANCEL_NONE) {
+                LOG_WARN("event=budget_memoria_superato arena_kb=%zu", up->arena->used / 1024);
+                up->rejected = 1;
+            }
+            return NULL;
+        }
+    }
+    return (float *)up->cur->input + (size_t)up->cur->rows * INPUT_SIZE;
+}
+
+// Riga completa: il batch parte appena e' pieno
+int upload_row_end(void *ctx) {
+    struct tcp_upload *up = ctx;
+    up->cur->rows++;
+    up->count++;
+    if (up->cur->rows == cfg.batch_rows)
+        upload_flush(up);
     return 0;
 }
 
-/********************************************************/
-void gestore(int signo) {
-    int stato;
-    printf("esecuzione gestore di SIGCHLD\n");
-    wait(&stato);
+// Totali per combinazione di codifica e compressione, riportati da stats_main
+static struct payload_counters payload_totals[PAYLOAD_ENCODINGS][PAYLOAD_COMPRESSIONS];
+static int payload_requests[PAYLOAD_ENCODINGS][PAYLOAD_COMPRESSIONS];
+static pthread_mutex_t payload_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void payload_account(const struct payload_hello *mode, const struct payload_counters *c) {
+    double ratio = c->dense_bytes > 0 ? (double)c->wire_bytes / c->dense_bytes : 0.0;
+    LOG_INFO("event=payload encoding=%s compression=%s rows=%llu wire_bytes=%llu dense_bytes=%llu ratio=%.3f "
+             "decode_ms=%.3f decode_mb_s=%.1f",
+             payload_encoding_name(mode->encoding), payload_compression_name(mode->compression),
+             (unsigned long long)c->rows, (unsigned long long)c->wire_bytes, (unsigned long long)c->dense_bytes,
+             ratio, c->codec_ns / 1e6, c->codec_ns > 0 ? c->dense_bytes / (c->codec_ns / 1e3) : 0.0);
+
+    pthread_mutex_lock(&payload_lock);
+    struct payload_counters *t = &payload_totals[mode->encoding][mode->compression];
+    t->wire_bytes += c->wire_bytes;
+    t->dense_bytes += c->dense_bytes;
+    t->rows += c->rows;
+    t->codec_ns += c->codec_ns;
+    payload_requests[mode->encoding][mode->compression]++;
+    pthread_mutex_unlock(&payload_lock);
+}
+
+void payload_report(void) {
+    pthread_mutex_lock(&payload_lock);
+    for (int e = 0; e < PAYLOAD_ENCODINGS; e++) {
+        for (int c = 0; c < PAYLOAD_COMPRESSIONS; c++) {
+            const struct payload_counters *t = &payload_totals[e][c];
+            if (payload_requests[e][c] == 0)
+                continue;
+            LOG_INFO("event=payload_stats encoding=%s compression=%s requests=%d rows=%llu wire_bytes=%llu "
+                     "ratio=%.3f decode_mb_s=%.1f",
+                     payload_encoding_name(e), payload_compression_name(c), payload_requests[e][c],
+                     (unsigned long long)t->rows, (unsigned long long)t->wire_bytes,
+                     t->dense_bytes > 0 ? (double)t->wire_bytes / t->dense_bytes : 0.0,
+                     t->codec_ns > 0 ? t->dense_bytes / (t->codec_ns / 1e3) : 0.0);
+        }
+    }
+    pthread_mutex_unlock(&payload_lock);
+}
+
+int invia_tutto(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Scrittura bufferizzata della risposta; con fd < 0 conta solo i byte
+struct json_writer {
+    int fd;
+    size_t used;
+    size_t total;
+    int error;
+    char buf[8192];
+};
+
+void json_put(struct json_writer *w, const char *s, size_t n) {
+    w->total += n;
+    if (w->fd < 0)
+        return;
+    if (w->used + n > sizeof(w->buf)) {
+        if (invia_tutto(w->fd, w->buf, w->used) < 0)
+            w->error = 1;
+        w->used = 0;
+    }
+    memcpy(w->buf + w->used, s, n);
+    w->used += n;
+}
+
+void json_labels(struct json_writer *w, const struct batch *first) {
+    char num[16];
+    int n = 0;
+    json_put(w, "{ \"Labels\": [ ", 14);
+    for (const struct batch *b = first; b != NULL; b = b->next) {
+        for (int r = 0; r < b->rows; r++) {
+            int len = snprintf(num, sizeof(num), n++ > 0 ? ", %d" : "%d", b->labels[r]);
+            json_put(w, num, len);
+        }
+    }
+    json_put(w, n > 0 ? " ] }" : "] }", n > 0 ? 4 : 3);
+}
+
+/*
+ * Invia {"Labels": [...]} preceduto dalla lunghezza, nello stesso formato di
+ * json-c ma scritto direttamente dalle label dei batch: la lunghezza si
+ * ottiene con una prima passata che non produce nulla, cosi' la risposta
+ * non viene mai costruita per intero in memoria.
+ */
+int invia_labels(int fd, const struct batch *first) {
+    struct json_writer w = {.fd = -1};
+    json_labels(&w, first);
+    size_t json_size = w.total;
+
+    w.fd = fd;
+    w.total = 0;
+    if (invia_tutto(fd, &json_size, sizeof(json_size)) < 0)
+        return -1;
+    json_labels(&w, first);
+    json_put(&w, "", 1); // il terminatore fa parte del protocollo
+    if (invia_tutto(fd, w.buf, w.used) < 0)
+        w.error = 1;
+    LOG_INFO("event=etichette_inviate bytes=%zu", json_size);
+    return w.error ? -1 : 0;
+}
+
+// Risposta di errore nello stesso formato, per i client che leggono solo il JSON
+void invia_errore(int fd, const char *message) {
+    char json[256];
+    size_t json_size = snprintf(json, sizeof(json), "{ \"Error\": \"%s\" }", message);
+    if (invia_tutto(fd, &json_size, sizeof(json_size)) == 0)
+        invia_tutto(fd, json, json_size + 1);
+}
+
+// recv che rinuncia alla scadenza deadline_ns (0 = nessuna) con errno ETIMEDOUT
+ssize_t recv_until(int fd, void *buf, size_t len, long long deadline_ns) {
+    if (deadline_ns > 0) {
+        long long left = deadline_ns - gettimens();
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (left <= 0 || poll(&pfd, 1, (int)((left + 999999) / 1000000)) == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+    return recv(fd, buf, len, 0);
+}
+
+// Timeout delle recv bloccanti (MSG_WAITALL) fino a deadline_ns, 0 = nessun
+// timeout; -1 se la scadenza e' gia' passata
+int recv_timeout(int fd, long long deadline_ns) {
+    struct timeval tv = {0};
+    if (deadline_ns > 0) {
+        long long left_us = (deadline_ns - gettimens() + 999) / 1000;
+        if (left_us <= 0)
+            return -1;
+        tv.tv_sec = left_us / 1000000;
+        tv.tv_usec = left_us % 1000000;
+    }
+    return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+/*
+ * Gestione di una richiesta TCP: il client invia le immagini e chiude in
+ * scrittura, il server risponde con la dimensione e il JSON delle etichette
+ * predette. Il corpo e' il CSV storico oppure, se la connessione inizia con
+ * una payload_hello, la codifica negoziata (vedi payload.h). Le righe vengono
+ * decodificate man mano che arrivano e ogni batch completo entra subito nella
+ * coda del tenant, cosi' l'inferenza parte durante l'upload. Se il client si
+ * disconnette o supera la propria payload_deadline la richiesta viene
+ * cancellata: niente etichette salvate ne' risposta, solo l'errore per la
+ * scadenza a un client ancora connesso.
+ */
+int serve_tcp(int client_fd, const char *peer) {
+    struct request req;
+    struct arena arena;
+    struct tcp_upload up = {.req = &req, .fd = client_fd, .arena = &arena};
+    struct payload_hello mode = {.magic = PAYLOAD_MAGIC, .encoding = PAYLOAD_CSV};
+    struct payload_sink sink = {.row_begin = upload_row_begin, .row_end = upload_row_end, .ctx = &up};
+    struct payload_decoder dec;
+    struct capture_buf cbuf;
+    char buff[8192];
+    int bf = 0, ret = 0;
+
+    if (cfg.capture_path != NULL)
+        capture_begin(&capture, &cbuf);
+    long long arrival = gettimens();
+    uint32_t budget_ms = 0;
+    int has_deadline = payload_accept_deadline(client_fd, &budget_ms);
+    if (has_deadline < 0) {
+        LOG_ERROR("event=deadline_non_valida peer=%s", peer);
+        if (cfg.capture_path != NULL)
+            capture_discard(&capture, &cbuf);
+        return -1;
+    }
+
+    arena_init(&arena, &memory, cfg.request_budget);
+    request_init(&req, sched_tenant(&scheduler, peer));
+    if (has_deadline)
+        req.deadline_ns = arrival + budget_ms * 1000000LL;
+    // Anche hello e negoziazione entro la scadenza: un client fermo dopo la
+    // payload_deadline non tiene occupato il thread della connessione
+    uint32_t magic = 0;
+    int hello = 0;
+    if (recv_timeout(client_fd, req.deadline_ns) == 0) {
+        if (recv(client_fd, &magic, sizeof(magic), MSG_PEEK | MSG_WAITALL) == sizeof(magic) &&
+            magic == PAYLOAD_MAGIC)
+            hello = payload_accept(client_fd, &mode);
+        recv_timeout(client_fd, 0);
+    }
+    if (request_cancelled(&req) == CANCEL_NONE && hello < 0) {
+        LOG_ERROR("event=hello_non_valida peer=%s", peer);
+        if (cfg.capture_path != NULL)
+            capture_discard(&capture, &cbuf);
+        request_destroy(&req);
+        sched_tenant_put(&scheduler, req.tenant);
+        arena_release(&arena);
+        return -1;
+    }
+    LOG_INFO("event=previsioni_inizio transport=tcp tenant=%s encoding=%s compression=%s deadline_ms=%u",
+             req.tenant->name, payload_encoding_name(mode.encoding), payload_compression_name(mode.compression),
+             budget_ms);
+    long long start = gettimens();
+
+    payload_decoder_init(&dec, &mode, INPUT_SIZE, &sink);
+    while (ret == 0 && request_cancelled(&req) == CANCEL_NONE &&
+           (bf = recv_until(client_fd, buff, sizeof(buff), req.deadline_ns)) > 0) {
+        if (cfg.capture_path != NULL)
+            capture_append(&capture, &cbuf, buff, bf);
+        ret = payload_decode(&dec, buff, bf);
+    }
+    if (bf < 0 && errno == ETIMEDOUT) {
+        request_cancel(&req, CANCEL_DEADLINE);
+    } else if (bf < 0) {
+        LOG_ERROR("event=recv_fallita error=\"%s\"", strerror(errno));
+        request_cancel(&req, CANCEL_DISCONNECT);
+    }
+    // Un upload interrotto non si completa: i batch gia' in coda vengono scartati
+    int cancelled = request_cancelled(&req) != CANCEL_NONE;
+    if (ret == 0 && !cancelled)
+        ret = payload_decode_finish(&dec);
+    // Una richiesta rifiutata viene comunque letta fino in fondo, cosi' il
+    // client riceve l'errore invece di un reset a meta' upload
+    if (up.rejected && !cancelled) {
+        while ((bf = recv_until(client_fd, buff, sizeof(buff), req.deadline_ns)) > 0)
+            if (cfg.capture_path != NULL)
+                capture_append(&capture, &cbuf, buff, bf);
+        if (bf < 0 && errno == ETIMEDOUT) {
+            request_cancel(&req, CANCEL_DEADLINE);
+            cancelled = 1;
+        }
+    } else if (ret < 0 && !cancelled)
+        LOG_ERROR("event=payload_non_valido peer=%s encoding=%s", peer, payload_encoding_name(mode.encoding));
+    if (!cancelled)
+        upload_flush(&up);
+    payload_decoder_free(&dec);
+    int count = up.count;
+    LOG_INFO("event=dati_ricevuti bytes=%llu samples=%d", (unsigned long long)dec.counters.wire_bytes, count);
+    if (ret == 0)
+        payload_account(&mode, &dec.counters);
+
+    // Attende i worker: le etichette sono gia' nell'ordine originale lungo la lista dei batch
+    request_wait(&req, client_fd);
+    int reason = __atomic_load_n(&req.cancelled, __ATOMIC_RELAXED);
+    request_destroy(&req);
+    long long service_ns = gettimens() - start;
+    if (reason != CANCEL_NONE)
+        LOG_WARN("event=richiesta_cancellata transport=tcp tenant=%s motivo=%s samples=%d ms=%.3f", peer,
+                 cancel_names[reason], count, service_ns / 1e6);
+    else
+        LOG_INFO("event=previsioni_completate transport=tcp tenant=%s samples=%d ms=%.3f", peer, count,
+                 service_ns / 1e6);
+    if (cfg.capture_path != NULL) {
+        struct capture_request creq = {.wire_bytes = dec.counters.wire_bytes, .service_ns = service_ns,
+                                       .rows = count, .transport = CAPTURE_TCP,
+                                       .hello = magic == PAYLOAD_MAGIC, .cancelled = reason != CANCEL_NONE,
+                                       .mode = mode};
+        snprintf(creq.tenant, sizeof(creq.tenant), "%.*s", (int)sizeof(creq.tenant) - 1, req.tenant->name);
+        capture_end(&capture, &cbuf, &creq);
+    }
+    LOG_INFO("event=arena transport=tcp used_kb=%zu high_water_kb=%zu input_riusati=%d", arena.used / 1024,
+             arena.high_water / 1024, up.recycled);
+
+    if (reason == CANCEL_DEADLINE) {
+        invia_errore(client_fd, "deadline superata");
+        ret = -1;
+    } else if (reason == CANCEL_DISCONNECT)
+        ret = -1;
+    else if (up.rejected)
+        invia_errore(client_fd, "budget di memoria superato");
+    else if (ret == 0 && (salva_labels(up.first) < 0 || invia_labels(client_fd, up.first) < 0))
+        ret = -1;
+    sched_tenant_put(&scheduler, req.tenant);
+    arena_release(&arena);
+    return ret;
+}
+
+/*
+ * Gestione di una richiesta sulla socket Unix: il client passa un memfd con
+ * le immagini gia' in float32 e poi segnala gli slot pronti. Ogni slot viene
+ * diviso in batch che i worker eseguono leggendo gli input direttamente dalle
+ * pagine condivise e scrivendovi le etichette, senza copie sulla socket.
+ * Se il client chiude la socket mentre uno slot e' in esecuzione, i batch
+ * rimasti vengono scartati e le etichette non vengono salvate.
+ */
+int serve_shm(int client_fd) {
+    struct shm_region region;
+    struct shm_msg msg;
+    char tenant[SCHED_TENANT_NAME];
+    struct arena arena;
+    struct batch *first = NULL, *last = NULL;
+    struct capture_buf cbuf;
+    int memfd, count = 0, cancelled = 0;
+
+    if (shm_recv_msg(client_fd, &msg, &memfd) < 0 || msg.type != SHM_MSG_HELLO || memfd < 0) {
+        LOG_ERROR("event=handshake_unix_fallito");
+        if (memfd >= 0)
+            close(memfd);
+        return -1;
+    }
+    if (shm_region_attach(&region, memfd, INPUT_SIZE) < 0) {
+        shm_region_close(&region);
+        msg.type = SHM_MSG_ERROR;
+        shm_send_msg(client_fd, &msg, -1);
+        return -1;
+    }
+    snprintf(tenant, sizeof(tenant), "%.*s", (int)sizeof(region.info.tenant), region.info.tenant);
+    if (tenant[0] == '\0')
+        strcpy(tenant, "unix");
+    LOG_INFO("event=regione_condivisa slots=%u slot_rows=%u tenant=%s", region.info.slots, region.info.slot_rows,
+             tenant);
+    if (cfg.capture_path != NULL)
+        capture_begin(&capture, &cbuf);
+
+    // Gli input restano nel memfd del client: l'arena contiene solo i batch e le label
+    struct sched_tenant *t = sched_tenant(&scheduler, tenant);
+    int max_batches = (region.info.slot_rows + cfg.batch_rows - 1) / cfg.batch_rows;
+    arena_init(&arena, &memory, cfg.request_budget);
+    struct batch *batches = arena_alloc(&arena, max_batches * sizeof(struct batch));
+    if (batches != NULL)
+        memset(batches, 0, max_batches * sizeof(struct batch));
+    long long start = gettimens();
+
+    LOG_INFO("event=previsioni_inizio transport=unix tenant=%s", tenant);
+    while (batches != NULL && shm_recv_msg(client_fd, &msg, NULL) == 0 && msg.type == SHM_MSG_SUBMIT) {
+        if (msg.slot >= region.info.slots || msg.rows > region.info.slot_rows) {
+            LOG_ERROR("event=slot_non_valido slot=%u rows=%u", msg.slot, msg.rows);
+            msg.type = SHM_MSG_ERROR;
+            shm_send_msg(client_fd, &msg, -1);
+            break;
+        }
+        // Le label dello slot vengono copiate prima che il client lo riusi
+        struct batch *result = arena_alloc(&arena, sizeof(*result) + msg.rows * sizeof(int32_t));
+        if (result == NULL) {
+            LOG_WARN("event=budget_memoria_superato arena_kb=%zu", arena.used / 1024);
+            msg.type = SHM_MSG_ERROR;
+            shm_send_msg(client_fd, &msg, -1);
+            break;
+        }
+        memset(result, 0, sizeof(*result));
+        result->labels = (int32_t *)(result + 1);
+        result->rows = msg.rows;
+
+        const float *input = shm_slot_input(&region, msg.slot);
+        int32_t *labels = shm_slot_labels(&region, msg.slot);
+        // Le righe dello slot sono gia' nel formato della codifica RAW
+        if (cfg.capture_path != NULL)
+            capture_append(&capture, &cbuf, input, (size_t)msg.rows * INPUT_SIZE * sizeof(float));
+        struct request req;
+        request_init(&req, t);
+        for (int i = 0; i * cfg.batch_rows < (int)msg.rows; i++) {
+            struct batch *b = &batches[i];
+            int first = i * cfg.batch_rows;
+            b->input = input + (size_t)first * INPUT_SIZE;
+            b->labels = labels + first;
+            b->rows = (int)msg.rows - first < cfg.batch_rows ? (int)msg.rows - first : cfg.batch_rows;
+            request_submit(&req, b);
+        }
+        request_wait(&req, client_fd);
+        int reason = __atomic_load_n(&req.cancelled, __ATOMIC_RELAXED);
+        request_destroy(&req);
+        if (reason != CANCEL_NONE) {
+            LOG_WARN("event=richiesta_cancellata transport=unix tenant=%s motivo=%s slot=%u", tenant,
+                     cancel_names[reason], msg.slot);
+            cancelled = 1;
+            break;
+        }
+        memcpy(result->labels, labels, msg.rows * sizeof(int32_t));
+        if (last != NULL)
+            last->next = result;
+        else
+            first = result;
+        last = result;
+        count += msg.rows;
+
+        msg.type = SHM_MSG_DONE;
+        if (shm_send_msg(client_fd, &msg, -1) < 0) {
+            LOG_ERROR("event=send_fallita error=\"%s\"", strerror(errno));
+            break;
+        }
+    }
+    long long service_ns = gettimens() - start;
+    LOG_INFO("event=previsioni_completate transport=unix tenant=%s samples=%d ms=%.3f", tenant, count,
+             service_ns / 1e6);
+    if (cfg.capture_path != NULL) {
+        struct capture_request creq = {.wire_bytes = (uint64_t)count * INPUT_SIZE * sizeof(float),
+                                       .service_ns = service_ns, .rows = count, .transport = CAPTURE_UNIX,
+                                       .hello = 1, .cancelled = cancelled != 0, .mode = {.magic = PAYLOAD_MAGIC, .encoding = PAYLOAD_RAW}};
+        snprintf(creq.tenant, sizeof(creq.tenant), "%.*s", (int)sizeof(creq.tenant) - 1, tenant);
+        capture_end(&capture, &cbuf, &creq);
+    }
+
+    LOG_INFO("event=arena transport=unix used_kb=%zu high_water_kb=%zu", arena.used / 1024,
+             arena.high_water / 1024);
+
+    int ret = cancelled ? -1 : salva_labels(first);
+    sched_tenant_put(&scheduler, t);
+    arena_release(&arena);
+    shm_region_close(&region);
+    return ret;
+}
+
+void *connection_main(void *arg) {
+    struct connection *conn = arg;
+    pthread_setname_np(pthread_self(), "conn");
+
+    if (cfg.telemetry_path != NULL)
+        telemetry_socket_add(&telemetry, conn->fd);
+    int ret = conn->unix_socket ? serve_shm(conn->fd) : serve_tcp(conn->fd, conn->peer);
+    LOG_INFO("event=connessione_terminata transport=%s esito=%d", conn->unix_socket ? "unix" : "tcp", ret);
+    if (cfg.telemetry_path != NULL)
+        telemetry_socket_remove(&telemetry, conn->fd);
+    close(conn->fd);
+    free(conn);
+    return NULL;
+}
+
+// Memoria del processo e del budget condiviso dalle richieste
+void memory_report(void) {
+    long rss_kb = 0, hwm_kb = 0;
+    mem_rss_kb(&rss_kb, &hwm_kb);
+    pthread_mutex_lock(&memory.lock);
+    LOG_INFO("event=memoria rss_kb=%ld rss_max_kb=%ld budget_kb=%zu budget_usato_kb=%zu budget_max_kb=%zu "
+             "allocazioni_negate=%lu",
+             rss_kb, hwm_kb, memory.limit / 1024, memory.used / 1024, memory.high_water / 1024, memory.rejected);
+    pthread_mutex_unlock(&memory.lock);
+}
+
+void cancel_report(void) {
+    pthread_mutex_lock(&cancellations.lock);
+    LOG_INFO("event=cancellazioni disconnessioni=%lu deadline=%lu batch_scartati=%lu righe_scartate=%llu",
+             cancellations.requests[CANCEL_DISCONNECT], cancellations.requests[CANCEL_DEADLINE],
+             cancellations.batches, cancellations.rows);
+    pthread_mutex_unlock(&cancellations.lock);
+}
+
+// Report periodico di profondita' delle code e tempi di attesa per tenant
+void *stats_main(void *arg) {
+    (void)arg;
+    pthread_setname_np(pthread_self(), "stats");
+    for (;;) {
+        sleep(cfg.stats_interval);
+        sched_report(&scheduler);
+        payload_report();
+        memory_report();
+        cancel_report();
+        if (cfg.capture_path != NULL)
+            capture_report(&capture);
+        if (cfg.telemetry_path != NULL)
+            telemetry_report(&telemetry);
+    }
+    return NULL;
 }
-/********************************************************/
 
 int main(int argc, char **argv) {
     /* CONTROLLO ARGOMENTI ---------------------------------- */
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <model_path>\n", argv[0]);
+    const char *tenant_specs[argc];
+    int n_tenant_specs = 0;
+    int opt;
+
+    cfg.workers = sysconf(_SC_NPROCESSORS_ONLN);
+    cfg.batch_rows = 100;
+    cfg.stats_interval = 10;
+    cfg.tune = (struct tune_config){.threads = 1, .batch = 1, .xnnpack = 1};
+    cfg.autotune_objective = -1;
+    cfg.capture_max_payload = CAPTURE_DEFAULT_MAX_PAYLOAD;
+    cfg.request_budget = 64 << 20;
+    cfg.memory_budget = 1024 << 20;
+    cfg.telemetry_hz = TELEMETRY_DEFAULT_HZ;
+    cfg.telemetry_size = TELEMETRY_DEFAULT_SIZE;
+    while ((opt = getopt(argc, argv, "c:w:u:W:b:T:s:m:M:t:B:XA:Ra:C:P:i:k:NH:r:f:z:")) != -1) {
+        switch (opt) {
+        case 'c':
+            cfg.weight_cache_path = optarg;
+            break;
+        case 'w':
+            cfg.warmup_invokes = atoi(optarg);
+            break;
+        case 'u':
+            cfg.unix_path = optarg;
+            break;
+        case 'W':
+            cfg.workers = atoi(optarg);
+            break;
+        case 'b':
+            cfg.batch_rows = atoi(optarg);
+            break;
+        case 'T':
+            tenant_specs[n_tenant_specs++] = optarg;
+            break;
+        case 's':
+            cfg.stats_interval = atoi(optarg);
+            break;
+        case 'm':
+            cfg.request_budget = (size_t)atol(optarg) << 20;
+            break;
+        case 'M':
+            cfg.memory_budget = (size_t)atol(optarg) << 20; // 0 = nessun limite globale
+            break;
+        case 't':
+            cfg.tune.threads = atoi(optarg);
+            break;
+        case 'B':
+            cfg.tune.batch = atoi(optarg);
+            break;
+        case 'X':
+            cfg.tune.xnnpack = 0;
+            break;
+        case 'A':
+            if ((cfg.autotune_objective = autotune_parse_objective(optarg)) < 0) {
+                fprintf(stderr, "Obiettivo non valido: %s (throughput o p99)\n", optarg);
+                return 1;
+            }
+            break;
+        case 'R':
+            cfg.autotune_force = 1;
+            break;
+        case 'a':
+            cfg.autotune_path = optarg;
+            break;
+        case 'C':
+            cfg.capture_path = optarg;
+            break;
+        case 'P':
+            cfg.capture_max_payload = (size_t)atol(optarg) << 20;
+            break;
+        case 'i':
+        case 'k':
+            if (placement_parse_cpus(optarg, opt == 'i' ? &cfg.placement.io_cpus : &cfg.placement.worker_cpus) < 0) {
+                fprintf(stderr, "Lista di CPU non valida: %s (es. 0-3,8)\n", optarg);
+                return 1;
+            }
+            *(opt == 'i' ? &cfg.placement.io_set : &cfg.placement.worker_set) = 1;
+            break;
+        case 'N':
+            cfg.placement.numa = 1;
+            break;
+        case 'H':
+            if ((cfg.placement.hugepages = placement_parse_hugepages(optarg)) < 0) {
+                fprintf(stderr, "Huge page non valide: %s (thp o hugetlb)\n", optarg);
+                return 1;
+            }
+            break;
+        case 'r':
+            cfg.telemetry_path = optarg;
+            break;
+        case 'f':
+            cfg.telemetry_hz = atoi(optarg);
+            break;
+        case 'z':
+            cfg.telemetry_size = (size_t)atol(optarg) << 20;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-c weight_cache_path] [-w warmup_invokes] [-u unix_socket_path] [-W workers] [-b batch_rows]\n"
+                "          [-T tenant:weight[:priority]]... [-s stats_interval]\n"
+                "          [-m request_budget_mb] [-M memory_budget_mb]\n"
+                "          [-t threads] [-B invoke_batch] [-X] [-A throughput|p99 [-R] [-a autotune_path]]\n"
+                "          [-C capture_path [-P capture_max_payload_mb]]\n"
+                "          [-i io_cpus] [-k worker_cpus] [-N] [-H thp|hugetlb]\n"
+                "          [-r telemetry_path [-f sample_hz] [-z telemetry_mb]] <model_path>\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || cfg.workers < 1 || cfg.batch_rows < 1 || cfg.tune.threads < 1 || cfg.tune.batch < 1) {
+        fprintf(stderr, "Usage: %s [-c weight_cache_path] [-w warmup_invokes] [-u unix_socket_path] [-W workers] [-b batch_rows]\n"
+                "          [-T tenant:weight[:priority]]... [-s stats_interval]\n"
+                "          [-m request_budget_mb] [-M memory_budget_mb]\n"
+                "          [-t threads] [-B invoke_batch] [-X] [-A throughput|p99 [-R] [-a autotune_path]]\n"
+                "          [-C capture_path [-P capture_max_payload_mb]]\n"
+                "          [-i io_cpus] [-k worker_cpus] [-N] [-H thp|hugetlb]\n"
+                "          [-r telemetry_path [-f sample_hz] [-z telemetry_mb]] <model_path>\n", argv[0]);
+        return 1;
+    }
+    cfg.model_path = argv[optind];
+    log_init("server", STDOUT_FILENO);
+
+    // Una richiesta deve poter tenere almeno un batch di input piu' le label
+    size_t min_budget = (size_t)cfg.batch_rows * INPUT_SIZE * sizeof(float) + 2 * ARENA_CHUNK_SIZE;
+    if (cfg.request_budget < min_budget || (cfg.memory_budget > 0 && cfg.memory_budget < cfg.request_budget)) {
+        fprintf(stderr, "Budget di memoria insufficiente: almeno %zu KB per richiesta con -b %d, e -M >= -m\n",
+                min_budget / 1024, cfg.batch_rows);
+        return 1;
+    }
+    mem_budget_init(&memory, cfg.memory_budget);
+    if (cfg.capture_path != NULL && capture_open(&capture, cfg.capture_path, cfg.capture_max_payload, &memory) < 0)
         return 1;
+    if (cfg.telemetry_path != NULL &&
+        telemetry_open(&telemetry, cfg.telemetry_path, cfg.telemetry_size, cfg.telemetry_hz) < 0)
+        return 1;
+
+    // Il quantum del DRR e' un batch: un tenant con peso w riceve w batch per giro
+    sched_init(&scheduler, cfg.batch_rows);
+    for (int i = 0; i < n_tenant_specs; i++) {
+        if (sched_configure_tenant(&scheduler, tenant_specs[i]) < 0) {
+            fprintf(stderr, "Tenant non valido: %s (atteso nome:peso[:priorita'], priorita' 0-%d)\n",
+                    tenant_specs[i], SCHED_MAX_PRIORITY - 1);
+            return 1;
+        }
     }
 
-    struct sockaddr_in server_addr, client_addr;
-    int                port, nread, server_fd, client_fd, length, tot = 0, bf=0;
+    struct sockaddr_in server_addr;
+    struct sockaddr_un unix_addr;
+    struct sockaddr_in client_addr;
+    socklen_t addr_len;
+    int                server_fd, client_fd, unix_fd = -1;
     int sndbuf, rcvbuf;
-    char buff[8192];
     const int          on = 1;
-    const char *model_path = argv[1];
-    char a_capo='\n';
-    struct metadata data;
-    socklen_t addr_len = sizeof(client_addr);
 
     /* INIZIALIZZAZIONE INDIRIZZO SERVER ----------------------------------------- */
     memset((char *)&server_addr, 0, sizeof(server_addr));
@@ -80,211 +1290,235 @@ int main(int argc, char **argv) {
     /* CREAZIONE E SETTAGGI SOCKET TCP --------------------------------------- */
     server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd < 0) {
-        perror("Creazione socket ");
+        LOG_ERROR("event=socket_fallita error=\"%s\"", strerror(errno));
         exit(3);
     }
-    printf("Server: creata la socket d'ascolto per le richieste di ordinamento, fd=%d\n", server_fd);
+    LOG_DEBUG("event=socket_creata fd=%d", server_fd);
 
     if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
-        perror("set opzioni socket d'ascolto");
+        LOG_ERROR("event=setsockopt_fallita error=\"%s\"", strerror(errno));
         exit(3);
     }
-    printf("Server: set opzioni socket d'ascolto ok\n");
+    LOG_DEBUG("event=setsockopt_ok");
 
     socklen_t optlen = sizeof(int);
     getsockopt(server_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen);
     getsockopt(server_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen);
-    printf("Buffer invio: %d, Buffer ricezione: %d\n", sndbuf, rcvbuf);
+    LOG_INFO("event=socket_buffer sndbuf=%d rcvbuf=%d", sndbuf, rcvbuf);
 
 
     if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("bind socket d'ascolto");
+        LOG_ERROR("event=bind_fallita error=\"%s\"", strerror(errno));
         exit(3);
     }
-    printf("Server: bind socket d'ascolto ok\n");
+    LOG_DEBUG("event=bind_ok");
 
-    if (listen(server_fd, 1) < 0) {
-        perror("listen");
+    if (listen(server_fd, 16) < 0) {
+        LOG_ERROR("event=listen_fallita error=\"%s\"", strerror(errno));
         exit(3);
     }
-    printf("Server: listen ok\n");
-    signal(SIGCHLD, gestore);
+    LOG_INFO("event=listen port=%d", 30080);
 
-    /* CICLO DI RICEZIONE RICHIESTE --------------------------------------------- */
-    struct hostent    *hostTcp, *hostUdp;
-
-    for (;;) {
-        if ((client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &addr_len)) < 0) {
-            if (errno == EINTR) {
-                perror("Forzo la continuazione della accept");
-                continue;
-            } else
-                exit(6);
+    /* SOCKET UNIX PER I CLIENT SULLO STESSO NODO ------------------------------- */
+    if (cfg.unix_path != NULL) {
+        memset(&unix_addr, 0, sizeof(unix_addr));
+        unix_addr.sun_family = AF_UNIX;
+        if (strlen(cfg.unix_path) >= sizeof(unix_addr.sun_path)) {
+            LOG_ERROR("event=unix_path_troppo_lungo path=%s", cfg.unix_path);
+            exit(3);
         }
-	setenv("HOSTALIASES", "/dev/null", 1); // Disabilita la risoluzione host
-        if (fork() == 0) {
-           /* hostTcp = gethostbyaddr((char *)&client_addr.sin_addr, sizeof(client_addr.sin_addr), AF_INET);
-            if (hostTcp == NULL) {
-                printf("client host information not found\n");
-                close(client_fd);
-                exit(6);
-            } else
-                printf("Server (figlio): host client e' %s \n", hostTcp->h_name);*/
+        strcpy(unix_addr.sun_path, cfg.unix_path);
+        unlink(cfg.unix_path);
 
-            // Carica il modello TensorFlow Lite
-            TfLiteModel *model = TfLiteModelCreateFromFile(model_path);
-            if (model == NULL) {
-                fprintf(stderr, "Failed to load model\n");
-                return 1;
-            }
-            printf("Modello caricato correttamente\n");
-
-            TfLiteInterpreterOptions *options = TfLiteInterpreterOptionsCreate();
-            TfLiteInterpreterOptionsSetNumThreads(options, 1); // Parametro thread utilizzati
-            TfLiteXNNPackDelegateOptions xnnpack_options = TfLiteXNNPackDelegateOptionsDefault();
-            TfLiteDelegate *xnnpack_delegate = TfLiteXNNPackDelegateCreate(&xnnpack_options);
+        unix_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (unix_fd < 0) {
+            LOG_ERROR("event=socket_fallita transport=unix error=\"%s\"", strerror(errno));
+            exit(3);
+        }
+        if (bind(unix_fd, (struct sockaddr *)&unix_addr, sizeof(unix_addr)) < 0) {
+            LOG_ERROR("event=bind_fallita transport=unix error=\"%s\"", strerror(errno));
+            exit(3);
+        }
+        if (listen(unix_fd, 5) < 0) {
+            LOG_ERROR("event=listen_fallita transport=unix error=\"%s\"", strerror(errno));
+            exit(3);
+        }
+        LOG_INFO("event=listen transport=unix path=%s", cfg.unix_path);
+    }
+    // Una connessione chiusa dal client non deve terminare l'intero server
+    signal(SIGPIPE, SIG_IGN);
+    setenv("HOSTALIASES", "/dev/null", 1); // Disabilita la risoluzione host
 
-            // Enable XNNPACK
-            TfLiteInterpreterOptionsAddDelegate(options, xnnpack_delegate);
+    /* AVVIO DEL MODELLO E DEI WORKER ------------------------------------------- */
+    // Il modello viene caricato una sola volta: il file e' mappato in memoria
+    // e tutti gli interpreti dei worker lo condividono
+    struct startup_times times = {0};
+    long long start = gettimens();
+    // I thread di I/O (questo, le connessioni, le statistiche) stanno sulle
+    // proprie CPU; senza -i sono quelle iniziali tolte quelle dei worker
+    const cpu_set_t *io_cpus = NULL;
+    if (cfg.placement.io_set || cfg.placement.worker_set) {
+        if (!cfg.placement.io_set) {
+            cpu_set_t initial;
+            sched_getaffinity(0, sizeof(initial), &initial);
+            CPU_ZERO(&cfg.placement.io_cpus);
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                if (CPU_ISSET(cpu, &initial) && !CPU_ISSET(cpu, &cfg.placement.worker_cpus))
+                    CPU_SET(cpu, &cfg.placement.io_cpus);
+            if (CPU_COUNT(&cfg.placement.io_cpus) == 0)
+                cfg.placement.io_cpus = initial;
+        }
+        io_cpus = &cfg.placement.io_cpus;
+        if (placement_enter(&cfg.placement, io_cpus) < 0)
+            return 1;
+        placement_leave(&cfg.placement, io_cpus);
+    }
 
-            // Crea l'interprete del modello
-            TfLiteInterpreter *interpreter = TfLiteInterpreterCreate(model, options);
-            if (interpreter == NULL) {
-                fprintf(stderr, "Failed to create interpreter\n");
-                return 1;
-            }
-            printf("Interpreter creato correttamente\n");
+    TfLiteModel *model = TfLiteModelCreateFromFile(cfg.model_path);
+    if (model == NULL) {
+        LOG_ERROR("event=load_fallito path=%s", cfg.model_path);
+        return 1;
+    }
+    times.load = gettimens() - start;
+    LOG_INFO("event=modello_caricato path=%s", cfg.model_path);
 
-            // Alloca i tensori dell'interprete
-            if (TfLiteInterpreterAllocateTensors(interpreter) != kTfLiteOk) {
-                fprintf(stderr, "Failed to allocate tensors\n");
-                return 1;
-            }
-            printf("Tensori allocati correttamente\n");
+    // Autotune: configurazione misurata su questo nodo, o riletta dal volume
+    if (cfg.autotune_objective >= 0) {
+        struct autotune_options tune_opts = {.path = cfg.autotune_path, .model_path = cfg.model_path,
+                                             .objective = cfg.autotune_objective, .input_size = INPUT_SIZE,
+                                             .workers = cfg.workers, .request_rows = cfg.batch_rows,
+                                             .force = cfg.autotune_force};
+        // Righe per invoke candidate, mai oltre la granularita' di scheduling
+        static const int batches[] = {1, 4, 16, 64};
+        for (size_t i = 0; i < sizeof(batches) / sizeof(batches[0]) && batches[i] <= cfg.batch_rows; i++)
+            tune_opts.batches[tune_opts.n_batches++] = batches[i];
+        // Misure sulle CPU dove gireranno i worker, non su quelle di I/O
+        placement_enter(&cfg.placement, cfg.placement.worker_set ? &cfg.placement.worker_cpus : NULL);
+        if (autotune(&tune_opts, model, &cfg.tune) < 0)
+            LOG_WARN("event=autotune_ignorato threads=%d batch=%d", cfg.tune.threads, cfg.tune.batch);
+        placement_leave(&cfg.placement, io_cpus);
+    }
 
-            // Ottieni i tensori di input e output
-            TfLiteTensor *input_tensor = TfLiteInterpreterGetInputTensor(interpreter, 0);
-            if (input_tensor == NULL) {
-                fprintf(stderr, "Failed to get input tensor\n");
-                return 1;
-            }
-            printf("Input tensor ottenuto\n");
-
-            // Leggi il file x_test.csv inviato dal client
-            FILE* x_test_file = fopen("/var/data/ml_model_prova/x_test.csv", "wb");
-            if(x_test_file != NULL){
-                while( (bf = recv(client_fd, buff, 8192,0))> 0 ) {
-                    tot+=bf;
-                    fwrite(buff, 1, bf, x_test_file);
-                }
+    // Ogni worker ha il proprio interprete gia' allocato e scaldato; con la
+    // cache XNNPACK i pesi impacchettati dal primo vengono riusati dagli altri
+    // Interprete, pool XNNPACK e thread del worker nascono gia' sulle CPU (e
+    // sul nodo) del worker: ne ereditano l'affinita', le pagine sono locali
+    struct worker *workers = calloc(cfg.workers, sizeof(struct worker));
+    char main_name[16], name[32];
+    pthread_getname_np(pthread_self(), main_name, sizeof(main_name));
+    for (int i = 0; i < cfg.workers; i++) {
+        cpu_set_t slice;
+        const cpu_set_t *worker_cpus = NULL;
+        if (cfg.placement.worker_set) {
+            placement_worker_cpus(&cfg.placement, i, cfg.tune.threads, &slice);
+            worker_cpus = &slice;
+        }
+        if (placement_enter(&cfg.placement, worker_cpus) < 0)
+            return 1;
+        int cpu = sched_getcpu();
+        int node = worker_cpus != NULL ? placement_set_node(worker_cpus) : placement_cpu_node(cpu < 0 ? 0 : cpu);
+        TfLiteModel *worker_model = model;
+        if (cfg.placement.numa || cfg.placement.hugepages != PLACEMENT_HUGE_NONE)
+            worker_model = model_local(cfg.model_path, node, cfg.placement.hugepages);
+        if (worker_model == NULL)
+            return 1;
 
-                printf("Received byte: %d\n",tot);
-                if (bf<0)
-                    perror("Receiving");
+        workers[i].id = i;
+        snprintf(name, sizeof(name), "infer-%d", i);
+        name[15] = '\0'; // limite dei nomi dei thread
+        pthread_setname_np(pthread_self(), name);
+        if (engine_create(&workers[i].eng, worker_model, &cfg, &times) < 0)
+            return 1;
+        print_startup_times(&times);
+        times.load = 0;
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            LOG_ERROR("event=worker_fallito id=%d", i);
+            return 1;
+        }
+        pthread_setname_np(pthread_self(), main_name);
+        placement_leave(&cfg.placement, io_cpus);
 
-                fclose(x_test_file);
-            } else {
-                perror("File");
-            }
-            
-            printf("Dati ricevuti e scritti su x_test.csv\n");
+        char cpus[256];
+        if (worker_cpus != NULL)
+            placement_format_cpus(worker_cpus, cpus, sizeof(cpus));
+        else
+            strcpy(cpus, "tutte");
+        LOG_INFO("event=placement_worker id=%d cpus=%s nodo=%d modello=%s huge=%s", i, cpus, node,
+                 worker_model == model ? "condiviso" : "locale",
+                 placement_huge_name(worker_model == model ? PLACEMENT_HUGE_NONE : node_buffers[node].huge));
+    }
+    LOG_INFO("event=worker_pronti workers=%d batch_rows=%d threads=%d invoke_batch=%d backend=%s", cfg.workers,
+             cfg.batch_rows, cfg.tune.threads, cfg.tune.batch, cfg.tune.xnnpack ? "xnnpack" : "builtin");
+    if (io_cpus != NULL) {
+        char cpus[256];
+        placement_format_cpus(io_cpus, cpus, sizeof(cpus));
+        LOG_INFO("event=placement_io cpus=%s", cpus);
+    }
+    placement_report();
+    // Il campionatore nasce sulle CPU di I/O e riconosce i thread dei worker
+    // gia' avviati dal nome
+    if (cfg.telemetry_path != NULL && telemetry_start(&telemetry, server_fd) < 0)
+        return 1;
 
-            // Riapri il file x_test.csv per leggere i dati
-            FILE *data_file = fopen("/var/data/ml_model_prova/x_test.csv", "r");
-            if (!data_file) {
-                perror("Failed to open file");
-                return 1;
-            }
-            printf("File x_test.csv riaperto per la lettura\n");
+    if (cfg.stats_interval > 0) {
+        pthread_t stats_thread;
+        pthread_create(&stats_thread, NULL, stats_main, NULL);
+        pthread_detach(stats_thread);
+    }
 
-            // Simulazione della lettura dei dati (per TensorFlow Lite)
-            int num_samples = 10000;  // Supponiamo di avere 10000 campioni
-            int count = 0;
-            int *predictions = (int *)malloc(num_samples * sizeof(int));
+    /* CICLO DI RICEZIONE RICHIESTE --------------------------------------------- */
+    fd_set rset;
+    int maxfd = server_fd > unix_fd ? server_fd : unix_fd;
 
-            // Inizializzazione delle metriche
-            const int input_size = sizeof(data.train_feature);
-            const int output_size = sizeof(data.prediction);
-            int predicted_label = 0;
+    for (;;) {
+        FD_ZERO(&rset);
+        FD_SET(server_fd, &rset);
+        if (unix_fd >= 0)
+            FD_SET(unix_fd, &rset);
+        if (select(maxfd + 1, &rset, NULL, NULL, NULL) < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("event=select_fallita error=\"%s\"", strerror(errno));
+            exit(6);
+        }
 
-            printf("Previsioni in corso...\n");
-            // Lettura dei dati e esecuzione delle previsioni
-            for (;;) {
-                if (get_data(data_file, &data) == -1){
-                    break;
-                }
+        int listen_fd = FD_ISSET(server_fd, &rset) ? server_fd : unix_fd;
+        addr_len = sizeof(client_addr);
+        if ((client_fd = accept(listen_fd, (struct sockaddr *)&client_addr, &addr_len)) < 0) {
+            if (errno == EINTR) {
+                LOG_DEBUG("event=accept_interrotta");
+                continue;
+            } else
+                exit(6);
+        }
 
-                float max = 0;
-                // Copia i dati di input nel tensore di input
-                TfLiteTensorCopyFromBuffer(input_tensor, data.train_feature, input_size);
-
-                // Esegui l'interprete per ottenere le previsioni
-                TfLiteInterpreterInvoke(interpreter);
-                // Estrai l'output
-                const TfLiteTensor *output_tensor = TfLiteInterpreterGetOutputTensor(interpreter, 0);
-                // Copia i risultati delle previsioni
-                TfLiteTensorCopyToBuffer(output_tensor, data.prediction, output_size);
-
-                // Ottieni la label predetta
-                for (int i = 0; i < OUTPUT_SIZE; i++) {
-                    if (data.prediction[i] > max) {
-                        max = data.prediction[i];
-                        predicted_label = i;
-                    }
-                }
-                predictions[count] = predicted_label;
-                count++;
-            }
-            
-            //file y_test.csv da salvare con le etichette predette
-            FILE *labels_file = fopen("/var/data/ml_model_prova/labels/y_test.csv", "a");
-            if(labels_file == NULL){
-                perror("Failed to open file");
-                return 1;
-            }
+        // Un thread per connessione per la sola I/O: l'inferenza la fanno i worker
+        struct connection *conn = calloc(1, sizeof(*conn));
+        conn->fd = client_fd;
+        conn->unix_socket = listen_fd != server_fd;
+        if (!conn->unix_socket)
+            inet_ntop(AF_INET, &client_addr.sin_addr, conn->peer, sizeof(conn->peer));
 
-            for(int i=0; i<num_samples; i++){
-                printf("Labels %d-esima: %d\n", i, predictions[i]);
-                fprintf(labels_file, "%d\n", predictions[i]);
-            }
-	    fprintf(labels_file, "-1\n");
-            fclose(labels_file);
-
-            printf("Previsioni completate\n");
-            // Invia le etichette predette al client in json
-            //creazione oggetto json
-            struct json_object *json_obj = json_object_new_object();
-            struct json_object *json_predictions = json_object_new_array();
-            //popolo array Json con interi
-            for (int i = 0; i < num_samples; i++) {
-                json_object_array_add(json_predictions, json_object_new_int(predictions[i]));
-            }
-            //aggiungo array json all'oggetto principale
-            json_object_object_add(json_obj, "Labels", json_predictions);
-            //converto in stringa e lo invio
-            const char *json_str = json_object_to_json_string(json_obj);
-            // Calcola la dimensione del JSON
-            size_t json_size = strlen(json_str);
-            //Invio dimensione al client
-            send(client_fd, &json_size, sizeof(json_size), 0);
-            //invio la stringa json al client
-            send(client_fd, json_str, strlen(json_str) + 1, 0);
-            printf("Etichette inviate al client\n");
-
-            // libera la memoria ed elimina il file x_test.csv
-            free(predictions);
-            fclose(data_file);
-            remove("/var/data/ml_model_prova/x_test.csv");
-            // Libera la memoria dell'interprete e del modello
-            TfLiteInterpreterDelete(interpreter);
-            TfLiteInterpreterOptionsDelete(options);
-            TfLiteModelDelete(model);
-            // Libero risorse
-            printf("Figlio TCP terminato, libero risorse e chiudo. \n");
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, connection_main, conn) != 0) {
+            LOG_ERROR("event=thread_connessione_fallito");
             close(client_fd);
-            exit(0);
-        }               // if fork
-        close(client_fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(thread);
     } // for
+
+    sched_close(&scheduler);
+    for (int i = 0; i < cfg.workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        engine_destroy(&workers[i].eng);
+    }
+    if (cfg.telemetry_path != NULL)
+        telemetry_close(&telemetry);
+    if (cfg.capture_path != NULL)
+        capture_close(&capture);
+    free(workers);
+    TfLiteModelDelete(model);
     return 0;
 } // main
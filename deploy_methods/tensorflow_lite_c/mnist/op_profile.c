@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tensorflow/lite/c/c_api_experimental.h"
+
+#include "op_profile.h"
+
+struct op_stats {
+    char *name;
+    int64_t node;
+    int64_t subgraph;
+    long long total_ns;
+    uint32_t *samples; // durate in ns di ogni esecuzione, per il p99
+    long n_samples, cap_samples;
+};
+
+struct op_event {
+    int stats; // indice in prof->stats, -1 = slot libero
+    long long start_ns;
+};
+
+static long long prof_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int stats_find(struct op_profile *prof, const char *name, int64_t node, int64_t subgraph) {
+    for (int i = 0; i < prof->n_stats; i++)
+        if (prof->stats[i].node == node && prof->stats[i].subgraph == subgraph)
+            return i;
+    if (prof->n_stats == prof->cap_stats) {
+        int cap = prof->cap_stats ? prof->cap_stats * 2 : 32;
+        struct op_stats *stats = realloc(prof->stats, cap * sizeof(*stats));
+        if (stats == NULL)
+            return -1;
+        prof->stats = stats;
+        prof->cap_stats = cap;
+    }
+    struct op_stats *s = &prof->stats[prof->n_stats];
+    memset(s, 0, sizeof(*s));
+    s->name = strdup(name != NULL ? name : "?");
+    s->node = node;
+    s->subgraph = subgraph;
+    return prof->n_stats++;
+}
+
+static void trace_event(struct op_profile *prof, const char *name, const char *cat, long long start_ns,
+                        long long dur_ns, int64_t node, int64_t subgraph) {
+    if (prof->trace == NULL)
+        return;
+    fprintf(prof->trace,
+            "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%lld,"
+            "\"args\":{\"node\":%lld}}",
+            prof->trace_events++ ? "," : "", name, cat, (start_ns - prof->origin_ns) / 1e3, dur_ns / 1e3,
+            (int)getpid(), (long long)subgraph, (long long)node);
+}
+
+static void stats_add(struct op_profile *prof, int idx, long long start_ns, long long dur_ns) {
+    struct op_stats *s = &prof->stats[idx];
+    if (s->n_samples == s->cap_samples) {
+        long cap = s->cap_samples ? s->cap_samples * 2 : 1024;
+        uint32_t *samples = realloc(s->samples, cap * sizeof(*samples));
+        if (samples == NULL)
+            return;
+        s->samples = samples;
+        s->cap_samples = cap;
+    }
+    s->samples[s->n_samples++] = dur_ns > UINT32_MAX ? UINT32_MAX : (uint32_t)dur_ns;
+    s->total_ns += dur_ns;
+    trace_event(prof, s->name, "op", start_ns, dur_ns, s->node, s->subgraph);
+}
+
+static uint32_t begin_op(struct TfLiteTelemetryProfilerStruct *iface, const char *op_name, int64_t op_idx,
+                         int64_t subgraph_idx) {
+    struct op_profile *prof = iface->data;
+    if (prof->suspended)
+        return 0;
+    int idx = stats_find(prof, op_name, op_idx, subgraph_idx);
+    if (idx < 0)
+        return 0;
+    if (prof->n_open == prof->cap_open) {
+        int cap = prof->cap_open ? prof->cap_open * 2 : 8;
+        struct op_event *open = realloc(prof->open, cap * sizeof(*open));
+        if (open == NULL)
+            return 0;
+        prof->open = open;
+        prof->cap_open = cap;
+    }
+    prof->open[prof->n_open] = (struct op_event){.stats = idx, .start_ns = prof_now_ns()};
+    return ++prof->n_open; // handle = posizione + 1, 0 = evento non registrato
+}
+
+static void end_op(struct TfLiteTelemetryProfilerStruct *iface, uint32_t handle) {
+    struct op_profile *prof = iface->data;
+    long long now = prof_now_ns();
+    if (handle == 0 || handle > (uint32_t)prof->n_open || prof->open[handle - 1].stats < 0)
+        return;
+    struct op_event *ev = &prof->open[handle - 1];
+    stats_add(prof, ev->stats, ev->start_ns, now - ev->start_ns);
+    ev->stats = -1;
+    // Gli eventi si chiudono in ordine inverso: si liberano gli slot in coda
+    while (prof->n_open > 0 && prof->open[prof->n_open - 1].stats < 0)
+        prof->n_open--;
+}
+
+// Eventi gia' misurati dall'interprete, elapsed_time in microsecondi
+static void op_elapsed(struct TfLiteTelemetryProfilerStruct *iface, const char *op_name, uint64_t elapsed_time,
+                       int64_t op_idx, int64_t subgraph_idx) {
+    struct op_profile *prof = iface->data;
+    if (prof->suspended)
+        return;
+    int idx = stats_find(prof, op_name, op_idx, subgraph_idx);
+    long long dur_ns = (long long)elapsed_time * 1000;
+    if (idx >= 0)
+        stats_add(prof, idx, prof_now_ns() - dur_ns, dur_ns);
+}
+
+int op_profile_init(struct op_profile *prof, const char *trace_path) {
+    memset(prof, 0, sizeof(*prof));
+    prof->iface.data = prof;
+    prof->iface.ReportBeginOpInvokeEvent = begin_op;
+    prof->iface.ReportEndOpInvokeEvent = end_op;
+    prof->iface.ReportOpInvokeEvent = op_elapsed;
+    prof->origin_ns = prof_now_ns();
+    if (trace_path != NULL) {
+        if ((prof->trace = fopen(trace_path, "w")) == NULL)
+            return -1;
+        fprintf(prof->trace, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    }
+    return 0;
+}
+
+void op_profile_attach(struct op_profile *prof, TfLiteInterpreterOptions *options) {
+    TfLiteInterpreterOptionsSetTelemetryProfiler(options, &prof->iface);
+}
+
+void op_profile_invoke_begin(struct op_profile *prof) {
+    prof->invoke_start_ns = prof_now_ns();
+}
+
+void op_profile_invoke_end(struct op_profile *prof) {
+    long long dur_ns = prof_now_ns() - prof->invoke_start_ns;
+    prof->invoke_total_ns += dur_ns;
+    prof->invokes++;
+    trace_event(prof, "Invoke", "invoke", prof->invoke_start_ns, dur_ns, -1, 0);
+}
+
+void op_profile_suspend(struct op_profile *prof, int suspended) {
+    prof->suspended = suspended;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_total(const void *a, const void *b) {
+    const struct op_stats *x = *(const struct op_stats *const *)a, *y = *(const struct op_stats *const *)b;
+    return (x->total_ns < y->total_ns) - (x->total_ns > y->total_ns);
+}
+
+void op_profile_report(struct op_profile *prof, FILE *out) {
+    struct op_stats **sorted = malloc((prof->n_stats + 1) * sizeof(*sorted));
+    long long ops_ns = 0;
+    if (sorted == NULL)
+        return;
+    for (int i = 0; i < prof->n_stats; i++) {
+        sorted[i] = &prof->stats[i];
+        ops_ns += prof->stats[i].total_ns;
+    }
+    qsort(sorted, prof->n_stats, sizeof(*sorted), cmp_total);
+
+    // La quota e' sul tempo totale di invoke; senza invoke delimitate, sulla somma dei nodi
+    double total = prof->invoke_total_ns > 0 ? prof->invoke_total_ns : ops_ns;
+    fprintf(out, "%-32s %6s %8s %10s %12s %12s %8s\n", "op", "nodo", "subgraph", "chiamate", "media_us", "p99_us",
+            "quota");
+    for (int i = 0; i < prof->n_stats; i++) {
+        struct op_stats *s = sorted[i];
+        if (s->n_samples == 0)
+            continue;
+        // Il p99 si calcola ordinando in place le durate registrate
+        qsort(s->samples, s->n_samples, sizeof(uint32_t), cmp_u32);
+        long p = (long)(0.99 * (s->n_samples - 1));
+        fprintf(out, "%-32s %6lld %8lld %10ld %12.2f %12.2f %7.1f%%\n", s->name, (long long)s->node,
+                (long long)s->subgraph, s->n_samples, s->total_ns / 1e3 / s->n_samples, s->samples[p] / 1e3,
+                total > 0 ? 100.0 * s->total_ns / total : 0.0);
+    }
+    if (prof->invokes > 0)
+        fprintf(out, "\nInvoke: %lld, media %.2f us, fuori dai nodi %.1f%%\n", prof->invokes,
+                prof->invoke_total_ns / 1e3 / prof->invokes,
+                total > 0 ? 100.0 * (prof->invoke_total_ns - ops_ns) / total : 0.0);
+    free(sorted);
+}
+
+void op_profile_destroy(struct op_profile *prof) {
+    if (prof->trace != NULL) {
+        fprintf(prof->trace, "\n]}\n");
+        fclose(prof->trace);
+    }
+    for (int i = 0; i < prof->n_stats; i++) {
+        free(prof->stats[i].name);
+        free(prof->stats[i].samples);
+    }
+    free(prof->stats);
+    free(prof->open);
+    memset(prof, 0, sizeof(*prof));
+}
@@ -0,0 +1,53 @@
+#ifndef OP_PROFILE_H
+#define OP_PROFILE_H
+
+#include <stdio.h>
+
+#include "tensorflow/lite/c/c_api.h"
+#include "tensorflow/lite/profiling/telemetry/c/profiler.h"
+
+/*
+ * Profilazione per operatore di un interprete TFLite.
+ *
+ * Il profiler si aggancia alle opzioni dell'interprete (telemetry profiler
+ * dell'API C sperimentale, TensorFlow Lite >= 2.13) e riceve inizio e fine di
+ * ogni nodo eseguito: operatori builtin e partizioni delegate, che compaiono
+ * come un unico nodo con il nome del delegate (es. TfLiteXNNPackDelegate).
+ * Per ogni (subgraph, nodo) accumula le durate di tutte le invoke; a fine
+ * esecuzione op_profile_report stampa la tabella aggregata (tipo, nodo, media,
+ * p99, quota del tempo totale di invoke). Con un file di trace ogni nodo e
+ * ogni invoke diventano un evento "X" del formato Chrome trace, apribile con
+ * chrome://tracing o Perfetto.
+ */
+
+struct op_stats;
+struct op_event;
+
+struct op_profile {
+    struct TfLiteTelemetryProfilerStruct iface; // da passare alle opzioni dell'interprete
+    FILE *trace;                 // NULL = niente timeline
+    long long origin_ns;         // istante zero della timeline
+    long long invoke_start_ns;
+    long long invoke_total_ns;
+    long long invokes;
+    struct op_stats *stats;      // una voce per (subgraph, nodo)
+    int n_stats, cap_stats;
+    struct op_event *open;       // eventi iniziati e non ancora chiusi
+    int n_open, cap_open;
+    int trace_events;
+    int suspended;               // operatori eseguiti ora da non contare
+};
+
+// trace_path NULL disabilita la timeline; -1 se il file non si apre
+int op_profile_init(struct op_profile *prof, const char *trace_path);
+void op_profile_attach(struct op_profile *prof, TfLiteInterpreterOptions *options);
+// Delimitano una TfLiteInterpreterInvoke
+void op_profile_invoke_begin(struct op_profile *prof);
+void op_profile_invoke_end(struct op_profile *prof);
+// Esclude dal profilo le invoke eseguite finche' suspended e' diverso da zero
+void op_profile_suspend(struct op_profile *prof, int suspended);
+void op_profile_report(struct op_profile *prof, FILE *out);
+// Chiude la timeline e libera le statistiche
+void op_profile_destroy(struct op_profile *prof);
+
+#endif
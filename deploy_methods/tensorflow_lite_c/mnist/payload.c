@@ -0,0 +1,489 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "payload.h"
+
+// Limite sul blocco compresso accettato dal server: copre il caso peggiore
+// di LZ4 e Zstd su un blocco da PAYLOAD_BLOCK_SIZE
+#define PAYLOAD_MAX_COMPRESSED (PAYLOAD_BLOCK_SIZE + PAYLOAD_BLOCK_SIZE / 128 + 1024)
+#define PAYLOAD_ZSTD_LEVEL 1
+
+static const char *encoding_names[] = {"csv", "raw", "sparse"};
+static const char *compression_names[] = {"none", "lz4", "zstd"};
+
+static long long payload_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+const char *payload_encoding_name(int encoding) {
+    return encoding >= 0 && encoding < PAYLOAD_ENCODINGS ? encoding_names[encoding] : "?";
+}
+
+const char *payload_compression_name(int compression) {
+    return compression >= 0 && compression < PAYLOAD_COMPRESSIONS ? compression_names[compression] : "?";
+}
+
+int payload_compression_supported(int compression) {
+    switch (compression) {
+    case PAYLOAD_NONE:
+        return 1;
+#ifdef HAVE_LZ4
+    case PAYLOAD_LZ4:
+        return 1;
+#endif
+#ifdef HAVE_ZSTD
+    case PAYLOAD_ZSTD:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+int payload_parse_mode(const char *spec, struct payload_hello *mode) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    memset(mode, 0, sizeof(*mode));
+    mode->magic = PAYLOAD_MAGIC;
+    mode->encoding = PAYLOAD_ENCODINGS;
+
+    char *colon = strchr(buf, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+        mode->level = atoi(colon + 1);
+    }
+    char *plus = strchr(buf, '+');
+    if (plus != NULL)
+        *plus++ = '\0';
+    for (int i = 0; i < PAYLOAD_ENCODINGS; i++)
+        if (strcasecmp(buf, encoding_names[i]) == 0)
+            mode->encoding = i;
+    if (mode->encoding == PAYLOAD_ENCODINGS)
+        return -1;
+    if (plus == NULL)
+        return 0;
+    for (int i = 0; i < PAYLOAD_COMPRESSIONS; i++)
+        if (strcasecmp(plus, compression_names[i]) == 0) {
+            mode->compression = i;
+            return 0;
+        }
+    return -1;
+}
+
+static int send_all(int sock, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Lato client: propone la codifica e la sostituisce con quella accettata
+int payload_negotiate(int sock, struct payload_hello *mode) {
+    struct payload_hello reply;
+    if (send_all(sock, mode, sizeof(*mode)) < 0 ||
+        recv(sock, &reply, sizeof(reply), MSG_WAITALL) != sizeof(reply) || reply.magic != PAYLOAD_MAGIC ||
+        reply.encoding != mode->encoding)
+        return -1;
+    *mode = reply;
+    return 0;
+}
+
+// Lato server: legge la hello e risponde con la combinazione supportata
+int payload_accept(int sock, struct payload_hello *mode) {
+    if (recv(sock, mode, sizeof(*mode), MSG_WAITALL) != sizeof(*mode) || mode->magic != PAYLOAD_MAGIC ||
+        mode->encoding >= PAYLOAD_ENCODINGS)
+        return -1;
+    if (!payload_compression_supported(mode->compression))
+        mode->compression = PAYLOAD_NONE;
+    return send_all(sock, mode, sizeof(*mode));
+}
+
+int payload_send_deadline(int sock, uint32_t budget_ms) {
+    struct payload_deadline deadline = {.magic = PAYLOAD_DEADLINE_MAGIC, .budget_ms = budget_ms};
+    return send_all(sock, &deadline, sizeof(deadline));
+}
+
+int payload_accept_deadline(int sock, uint32_t *budget_ms) {
+    struct payload_deadline deadline;
+    uint32_t magic = 0;
+    if (recv(sock, &magic, sizeof(magic), MSG_PEEK | MSG_WAITALL) != sizeof(magic) ||
+        magic != PAYLOAD_DEADLINE_MAGIC)
+        return 0; // corpo vuoto o senza scadenza: lo gestisce la lettura normale
+    if (recv(sock, &deadline, sizeof(deadline), MSG_WAITALL) != sizeof(deadline))
+        return -1;
+    *budget_ms = deadline.budget_ms;
+    return 1;
+}
+
+// Converte una riga del CSV nelle input_size feature dell'immagine
+static void parse_row(const char *line, float *row, int input_size) {
+    char *p = (char *)line;
+    for (int i = 0; i < input_size; i++) {
+        row[i] = strtof(p, &p);
+        if (*p == ',')
+            p++;
+    }
+}
+
+void payload_decoder_init(struct payload_decoder *dec, const struct payload_hello *mode, int input_size,
+                          const struct payload_sink *sink) {
+    memset(dec, 0, sizeof(*dec));
+    dec->mode = *mode;
+    dec->sink = *sink;
+    dec->input_size = input_size;
+}
+
+void payload_decoder_free(struct payload_decoder *dec) {
+    free(dec->block);
+    free(dec->plain);
+    free(dec->line);
+    dec->block = dec->plain = dec->line = NULL;
+}
+
+static int decode_csv_line(struct payload_decoder *dec) {
+    dec->line[dec->line_len] = '\0';
+    dec->line_len = 0;
+    if (dec->line[0] == '\0' || dec->line[0] == '\r')
+        return 0;
+    float *row = dec->sink.row_begin(dec->sink.ctx);
+    if (row == NULL)
+        return -1;
+    parse_row(dec->line, row, dec->input_size);
+    dec->counters.rows++;
+    return dec->sink.row_end(dec->sink.ctx);
+}
+
+static int decode_csv(struct payload_decoder *dec, const char *p, const char *end) {
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        size_t n = (nl != NULL ? nl : end) - p;
+        if (dec->line_len + n + 1 > dec->line_cap) {
+            size_t cap = (dec->line_len + n + 1) * 2;
+            char *line = realloc(dec->line, cap);
+            if (line == NULL)
+                return -1;
+            dec->line = line;
+            dec->line_cap = cap;
+        }
+        memcpy(dec->line + dec->line_len, p, n);
+        dec->line_len += n;
+        p += n;
+        if (nl == NULL)
+            break; // riga a cavallo tra due frammenti
+        p++;
+        if (decode_csv_line(dec) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// I float arrivano gia' nel formato del tensore: si copiano nella riga di destinazione
+static int decode_raw(struct payload_decoder *dec, const char *p, const char *end) {
+    size_t row_bytes = (size_t)dec->input_size * sizeof(float);
+    while (p < end) {
+        if (dec->row == NULL) {
+            if ((dec->row = dec->sink.row_begin(dec->sink.ctx)) == NULL)
+                return -1;
+            dec->row_off = 0;
+        }
+        size_t n = row_bytes - dec->row_off;
+        if (n > (size_t)(end - p))
+            n = end - p;
+        memcpy((char *)dec->row + dec->row_off, p, n);
+        dec->row_off += n;
+        p += n;
+        if (dec->row_off == row_bytes) {
+            dec->row = NULL;
+            dec->counters.rows++;
+            if (dec->sink.row_end(dec->sink.ctx) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+// Riga sparsa: header con il numero di pixel non nulli, poi le coppie (indice, valore)
+static int decode_sparse(struct payload_decoder *dec, const char *p, const char *end) {
+    while (p < end) {
+        int need = dec->row == NULL ? (int)sizeof(uint16_t) : (int)(sizeof(uint16_t) + sizeof(float));
+        int n = need - dec->tmp_len;
+        if (n > end - p)
+            n = end - p;
+        memcpy(dec->tmp + dec->tmp_len, p, n);
+        dec->tmp_len += n;
+        p += n;
+        if (dec->tmp_len < need)
+            break;
+        dec->tmp_len = 0;
+
+        if (dec->row == NULL) {
+            uint16_t nnz;
+            memcpy(&nnz, dec->tmp, sizeof(nnz));
+            if (nnz > dec->input_size || (dec->row = dec->sink.row_begin(dec->sink.ctx)) == NULL)
+                return -1;
+            memset(dec->row, 0, (size_t)dec->input_size * sizeof(float));
+            dec->nnz = nnz;
+        } else {
+            uint16_t index;
+            memcpy(&index, dec->tmp, sizeof(index));
+            if (index >= dec->input_size)
+                return -1;
+            memcpy(&dec->row[index], dec->tmp + sizeof(index), sizeof(float));
+            dec->nnz--;
+        }
+        if (dec->nnz == 0) {
+            dec->row = NULL;
+            dec->counters.rows++;
+            if (dec->sink.row_end(dec->sink.ctx) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+static int decode_plain(struct payload_decoder *dec, const char *data, size_t len) {
+    switch (dec->mode.encoding) {
+    case PAYLOAD_RAW:
+        return decode_raw(dec, data, data + len);
+    case PAYLOAD_SPARSE:
+        return decode_sparse(dec, data, data + len);
+    default:
+        return decode_csv(dec, data, data + len);
+    }
+}
+
+static int decompress_block(struct payload_decoder *dec, const struct payload_block *hdr) {
+    const char *src __attribute__((unused)) = dec->block + sizeof(*hdr);
+    if (dec->plain == NULL && (dec->plain = malloc(PAYLOAD_BLOCK_SIZE)) == NULL)
+        return -1;
+    switch (dec->mode.compression) {
+#ifdef HAVE_LZ4
+    case PAYLOAD_LZ4:
+        if (LZ4_decompress_safe(src, dec->plain, hdr->compressed_len, PAYLOAD_BLOCK_SIZE) != (int)hdr->raw_len)
+            return -1;
+        break;
+#endif
+#ifdef HAVE_ZSTD
+    case PAYLOAD_ZSTD: {
+        size_t n = ZSTD_decompress(dec->plain, PAYLOAD_BLOCK_SIZE, src, hdr->compressed_len);
+        if (ZSTD_isError(n) || n != hdr->raw_len)
+            return -1;
+        break;
+    }
+#endif
+    default:
+        return -1;
+    }
+    return decode_plain(dec, dec->plain, hdr->raw_len);
+}
+
+// Accumula i blocchi compressi e li decodifica appena sono completi
+static int decode_blocks(struct payload_decoder *dec, const char *p, const char *end) {
+    struct payload_block hdr;
+    while (p < end) {
+        size_t need = sizeof(hdr);
+        if (dec->block_len >= sizeof(hdr)) {
+            memcpy(&hdr, dec->block, sizeof(hdr));
+            need += hdr.compressed_len;
+        }
+        if (dec->block == NULL &&
+            (dec->block_cap = sizeof(hdr) + PAYLOAD_MAX_COMPRESSED, dec->block = malloc(dec->block_cap)) == NULL)
+            return -1;
+        size_t n = need - dec->block_len;
+        if (n > (size_t)(end - p))
+            n = end - p;
+        memcpy(dec->block + dec->block_len, p, n);
+        dec->block_len += n;
+        p += n;
+        if (dec->block_len < need)
+            break;
+
+        memcpy(&hdr, dec->block, sizeof(hdr));
+        if (need == sizeof(hdr)) {
+            // Header appena completato: se ne controllano i limiti prima del corpo
+            if (hdr.raw_len == 0 || hdr.raw_len > PAYLOAD_BLOCK_SIZE || hdr.compressed_len == 0 ||
+                hdr.compressed_len > PAYLOAD_MAX_COMPRESSED)
+                return -1;
+            continue;
+        }
+        if (decompress_block(dec, &hdr) < 0)
+            return -1;
+        dec->block_len = 0;
+    }
+    return 0;
+}
+
+int payload_decode(struct payload_decoder *dec, const char *data, size_t len) {
+    long long start = payload_now_ns();
+    dec->counters.wire_bytes += len;
+    int ret = dec->mode.compression == PAYLOAD_NONE ? decode_plain(dec, data, len)
+                                                    : decode_blocks(dec, data, data + len);
+    dec->counters.codec_ns += payload_now_ns() - start;
+    return ret;
+}
+
+int payload_decode_finish(struct payload_decoder *dec) {
+    int ret = 0;
+    if (dec->block_len > 0 || dec->row != NULL || dec->tmp_len > 0)
+        ret = -1; // corpo troncato
+    else if (dec->line_len > 0)
+        ret = decode_csv_line(dec); // ultima riga senza a capo finale
+    dec->counters.dense_bytes = dec->counters.rows * dec->input_size * sizeof(float);
+    return ret;
+}
+
+int payload_encoder_init(struct payload_encoder *enc, const struct payload_hello *mode, int input_size, int sock) {
+    memset(enc, 0, sizeof(*enc));
+    enc->mode = *mode;
+    enc->sock = sock;
+    enc->input_size = input_size;
+    if ((enc->plain = malloc(PAYLOAD_BLOCK_SIZE)) == NULL)
+        return -1;
+    switch (mode->compression) {
+#ifdef HAVE_LZ4
+    case PAYLOAD_LZ4:
+        enc->out_cap = LZ4_compressBound(PAYLOAD_BLOCK_SIZE);
+        break;
+#endif
+#ifdef HAVE_ZSTD
+    case PAYLOAD_ZSTD:
+        enc->out_cap = ZSTD_compressBound(PAYLOAD_BLOCK_SIZE);
+        break;
+#endif
+    case PAYLOAD_NONE:
+        return 0;
+    default:
+        return -1;
+    }
+    enc->out = malloc(sizeof(struct payload_block) + enc->out_cap);
+    return enc->out != NULL ? 0 : -1;
+}
+
+void payload_encoder_free(struct payload_encoder *enc) {
+    free(enc->plain);
+    free(enc->out);
+    enc->plain = enc->out = NULL;
+}
+
+// Invia il blocco accumulato, compresso se richiesto
+static int flush_block(struct payload_encoder *enc) {
+    if (enc->plain_len == 0)
+        return 0;
+    if (enc->mode.compression == PAYLOAD_NONE) {
+        enc->counters.wire_bytes += enc->plain_len;
+        int ret = send_all(enc->sock, enc->plain, enc->plain_len);
+        enc->plain_len = 0;
+        return ret;
+    }
+
+    long long start = payload_now_ns();
+    struct payload_block hdr = {.raw_len = enc->plain_len};
+    char *dst __attribute__((unused)) = enc->out + sizeof(hdr);
+    switch (enc->mode.compression) {
+#ifdef HAVE_LZ4
+    case PAYLOAD_LZ4: {
+        int n = LZ4_compress_default(enc->plain, dst, enc->plain_len, enc->out_cap);
+        if (n <= 0)
+            return -1;
+        hdr.compressed_len = n;
+        break;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case PAYLOAD_ZSTD: {
+        size_t n = ZSTD_compress(dst, enc->out_cap, enc->plain, enc->plain_len,
+                                 enc->mode.level > 0 ? enc->mode.level : PAYLOAD_ZSTD_LEVEL);
+        if (ZSTD_isError(n))
+            return -1;
+        hdr.compressed_len = n;
+        break;
+    }
+#endif
+    default:
+        return -1;
+    }
+    enc->counters.codec_ns += payload_now_ns() - start;
+    memcpy(enc->out, &hdr, sizeof(hdr));
+    enc->counters.wire_bytes += hdr.compressed_len;
+    enc->plain_len = 0;
+    return send_all(enc->sock, enc->out, sizeof(hdr) + hdr.compressed_len);
+}
+
+static int encode_bytes(struct payload_encoder *enc, const char *data, size_t len) {
+    while (len > 0) {
+        size_t n = PAYLOAD_BLOCK_SIZE - enc->plain_len;
+        if (n > len)
+            n = len;
+        memcpy(enc->plain + enc->plain_len, data, n);
+        enc->plain_len += n;
+        data += n;
+        len -= n;
+        if (enc->plain_len == PAYLOAD_BLOCK_SIZE && flush_block(enc) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int payload_encode_row(struct payload_encoder *enc, const float *row) {
+    enc->counters.rows++;
+    if (enc->mode.encoding == PAYLOAD_RAW)
+        return encode_bytes(enc, (const char *)row, (size_t)enc->input_size * sizeof(float));
+
+    // Riga sparsa scritta direttamente nel blocco, che viene chiuso prima se
+    // non c'e' spazio per il caso peggiore
+    size_t worst = sizeof(uint16_t) + (size_t)enc->input_size * (sizeof(uint16_t) + sizeof(float));
+    if (PAYLOAD_BLOCK_SIZE - enc->plain_len < worst && flush_block(enc) < 0)
+        return -1;
+    long long start = payload_now_ns();
+    char *hdr = enc->plain + enc->plain_len;
+    char *p = hdr + sizeof(uint16_t);
+    uint16_t nnz = 0;
+    for (uint16_t i = 0; i < enc->input_size; i++) {
+        if (row[i] == 0.0f)
+            continue;
+        memcpy(p, &i, sizeof(i));
+        memcpy(p + sizeof(i), &row[i], sizeof(float));
+        p += sizeof(i) + sizeof(float);
+        nnz++;
+    }
+    memcpy(hdr, &nnz, sizeof(nnz));
+    enc->plain_len = p - enc->plain;
+    enc->counters.codec_ns += payload_now_ns() - start;
+    return 0;
+}
+
+int payload_encode_text(struct payload_encoder *enc, const char *text, size_t len) {
+    for (const char *p = text, *end = text + len; (p = memchr(p, '\n', end - p)) != NULL; p++)
+        enc->counters.rows++;
+    if (len > 0)
+        enc->open_line = text[len - 1] != '\n';
+    return encode_bytes(enc, text, len);
+}
+
+int payload_encoder_finish(struct payload_encoder *enc) {
+    if (enc->open_line)
+        enc->counters.rows++;
+    enc->open_line = 0;
+    enc->counters.dense_bytes = enc->counters.rows * enc->input_size * sizeof(float);
+    return flush_block(enc);
+}
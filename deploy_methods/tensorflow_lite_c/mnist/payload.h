@@ -0,0 +1,148 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Codifiche negoziate per l'upload TCP delle immagini.
+ *
+ * Un client che vuole una codifica diversa dal CSV storico apre la
+ * connessione con una payload_hello; il server risponde con la combinazione
+ * accettata (la compressione scende a NONE se non e' compilata) e da li' in
+ * poi il client invia il corpo codificato e chiude in scrittura. Un client
+ * che invia subito il CSV resta compatibile: il server riconosce la hello
+ * dal magic iniziale, che non puo' comparire in testa a un CSV numerico.
+ *
+ * Codifiche delle righe:
+ *   CSV     testo come nel protocollo storico
+ *   RAW     INPUT_SIZE float32 per riga, per collegamenti locali veloci
+ *   SPARSE  per riga un uint16 con il numero di pixel non nulli seguito da
+ *           altrettante coppie (uint16 indice, float32 valore); il server
+ *           azzera la riga e scrive i valori direttamente nel tensore
+ *
+ * Con LZ4 o Zstd il flusso codificato viene diviso in blocchi indipendenti
+ * di al massimo PAYLOAD_BLOCK_SIZE byte, ognuno preceduto da una
+ * payload_block. I numeri sono nell'ordine dei byte nativo (little endian su
+ * tutti i nodi del cluster). Il supporto alla compressione si abilita in
+ * compilazione con -DHAVE_LZ4 -llz4 e -DHAVE_ZSTD -lzstd.
+ *
+ * Prima della hello (o del CSV) il client puo' inviare una payload_deadline:
+ * il tempo massimo in millisecondi, contato dall'arrivo al server, entro cui
+ * la risposta gli serve ancora. Scaduto quel tempo il server smette di
+ * elaborare la richiesta e risponde con un errore. E' un tempo relativo
+ * perche' gli orologi di client e server non sono sincronizzati.
+ */
+
+#define PAYLOAD_MAGIC 0x31504e4du // "MNP1"
+#define PAYLOAD_DEADLINE_MAGIC 0x31444e4du // "MND1"
+#define PAYLOAD_BLOCK_SIZE (256 * 1024)
+
+enum payload_encoding {
+    PAYLOAD_CSV = 0,
+    PAYLOAD_RAW,
+    PAYLOAD_SPARSE,
+    PAYLOAD_ENCODINGS
+};
+
+enum payload_compression {
+    PAYLOAD_NONE = 0,
+    PAYLOAD_LZ4,
+    PAYLOAD_ZSTD,
+    PAYLOAD_COMPRESSIONS
+};
+
+struct payload_hello {
+    uint32_t magic;
+    uint8_t encoding;
+    uint8_t compression;
+    uint16_t level; // livello Zstd richiesto (0 = predefinito)
+};
+
+struct payload_deadline {
+    uint32_t magic;
+    uint32_t budget_ms;
+};
+
+struct payload_block {
+    uint32_t raw_len;
+    uint32_t compressed_len;
+};
+
+// Byte scambiati e tempo di codifica/decodifica di una richiesta
+struct payload_counters {
+    uint64_t wire_bytes;  // byte effettivamente trasferiti, header esclusi
+    uint64_t dense_bytes; // stessi dati come float32 densi
+    uint64_t rows;
+    long long codec_ns;
+};
+
+// Destinazione delle righe decodificate: row_begin restituisce dove scrivere
+// la prossima immagine, row_end la segnala completa
+struct payload_sink {
+    float *(*row_begin)(void *ctx);
+    int (*row_end)(void *ctx);
+    void *ctx;
+};
+
+struct payload_decoder {
+    struct payload_hello mode;
+    struct payload_sink sink;
+    int input_size;
+    struct payload_counters counters;
+    // livello di compressione: blocco in arrivo e blocco decompresso
+    char *block;
+    size_t block_len, block_cap;
+    char *plain;
+    size_t plain_cap;
+    // livello di codifica: riga CSV parziale o riga binaria in corso
+    char *line;
+    size_t line_len, line_cap;
+    float *row;
+    size_t row_off;
+    unsigned char tmp[8];
+    int tmp_len;
+    int nnz;
+};
+
+struct payload_encoder {
+    struct payload_hello mode;
+    int sock;
+    int input_size;
+    struct payload_counters counters;
+    char *plain; // blocco non ancora compresso e inviato
+    size_t plain_len;
+    char *out;
+    size_t out_cap;
+    int open_line; // l'ultimo testo CSV non terminava con un a capo
+};
+
+const char *payload_encoding_name(int encoding);
+const char *payload_compression_name(int compression);
+// Interpreta "sparse", "raw+lz4", "csv+zstd:3" ...
+int payload_parse_mode(const char *spec, struct payload_hello *mode);
+int payload_compression_supported(int compression);
+
+// Scambio della hello: il client propone, il server risponde con cio' che accetta
+int payload_negotiate(int sock, struct payload_hello *mode);
+int payload_accept(int sock, struct payload_hello *mode);
+int payload_send_deadline(int sock, uint32_t budget_ms);
+// 1 se la connessione inizia con una payload_deadline (consumata), 0 se no, -1 errore
+int payload_accept_deadline(int sock, uint32_t *budget_ms);
+
+void payload_decoder_init(struct payload_decoder *dec, const struct payload_hello *mode, int input_size,
+                          const struct payload_sink *sink);
+// Consuma un frammento arbitrario del corpo ricevuto
+int payload_decode(struct payload_decoder *dec, const char *data, size_t len);
+// Fine del corpo: completa l'ultima riga CSV, errore se resta un blocco troncato
+int payload_decode_finish(struct payload_decoder *dec);
+void payload_decoder_free(struct payload_decoder *dec);
+
+int payload_encoder_init(struct payload_encoder *enc, const struct payload_hello *mode, int input_size, int sock);
+// Aggiunge un'immagine (RAW e SPARSE) o testo CSV grezzo (CSV)
+int payload_encode_row(struct payload_encoder *enc, const float *row);
+int payload_encode_text(struct payload_encoder *enc, const char *text, size_t len);
+int payload_encoder_finish(struct payload_encoder *enc);
+void payload_encoder_free(struct payload_encoder *enc);
+
+#endif
@@ -0,0 +1,180 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "perturb.h"
+
+#define PERTURB_MAX_PIXELS 4096
+
+static inline uint64_t splitmix64(uint64_t z) {
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Uniforme in (0, 1]: mai zero, per il logaritmo di Box-Muller
+static inline float uniform(uint64_t key, uint64_t counter) {
+    // Via int32: la conversione da 64 bit a float non ha un'istruzione vettoriale
+    return (float)(int32_t)((splitmix64(key ^ splitmix64(counter)) >> 40) + 1) * 0x1.0p-24f;
+}
+
+int perturb_parse(const char *spec, struct perturb_level *level) {
+    memset(level, 0, sizeof(*level));
+    snprintf(level->name, sizeof(level->name), "%s", spec);
+    if (strcmp(spec, "clean") == 0)
+        return 0;
+
+    const char *p = spec;
+    while (*p != '\0') {
+        struct perturb_step step;
+        const char *colon = strchr(p, ':');
+        if (colon == NULL || level->n_steps == PERTURB_MAX_STEPS)
+            return -1;
+        size_t len = colon - p;
+        if (len == 5 && strncmp(p, "noise", len) == 0)
+            step.kind = PERTURB_NOISE;
+        else if (len == 4 && strncmp(p, "mask", len) == 0)
+            step.kind = PERTURB_MASK;
+        else if (len == 7 && strncmp(p, "denoise", len) == 0)
+            step.kind = PERTURB_DENOISE;
+        else
+            return -1;
+        char *end;
+        step.amount = strtof(colon + 1, &end);
+        if (end == colon + 1 || step.amount < 0 || (step.kind == PERTURB_MASK && step.amount > 1))
+            return -1;
+        level->steps[level->n_steps++] = step;
+        if (*end == '+')
+            end++;
+        else if (*end != '\0')
+            return -1;
+        p = end;
+    }
+    return level->n_steps > 0 ? 0 : -1;
+}
+
+#define NOISE_BLOCK 256 // coppie di pixel per passata
+
+static inline float bits_float(uint32_t i) {
+    float f;
+    memcpy(&f, &i, sizeof(f));
+    return f;
+}
+
+static inline uint32_t float_bits(float f) {
+    uint32_t i;
+    memcpy(&i, &f, sizeof(i));
+    return i;
+}
+
+// logf per x in (0, 1]: la mantissa si porta in [sqrt(2)/2, sqrt(2)) con
+// sole operazioni sui bit (come la logf di musl) e va nel polinomio di Cephes
+static inline float log_unit(float x) {
+    uint32_t i = float_bits(x);
+    uint32_t t = i - 0x3f3504f3u;
+    float e = (float)((int32_t)t >> 23);
+    float f = bits_float(i - (t & 0xff800000u)) - 1.0f, z = f * f;
+    float y = ((((((((7.0376836292e-2f * f - 1.1514610310e-1f) * f + 1.1676998740e-1f) * f - 1.2420140846e-1f) * f +
+                   1.4249322787e-1f) * f - 1.6668057665e-1f) * f + 2.0000714765e-1f) * f - 2.4999993993e-1f) * f +
+               3.3333331174e-1f) * f * z;
+    y += -2.12194440e-4f * e - 0.5f * z;
+    return f + y + 0.693359375f * e;
+}
+
+// Seno e coseno di 2*pi*t: t si riduce in modo esatto al quarto di giro piu'
+// vicino, poi i polinomi di Cephes su [-pi/4, pi/4]. Scambio e segni del
+// quadrante sono maschere sui bit, senza salti
+static inline void sincos_turn(float t, float *s, float *c) {
+    int32_t q = (int32_t)(t * 4.0f + 0.5f);
+    float x = (t - 0.25f * (float)q) * 6.28318530718f;
+    float z = x * x;
+    uint32_t ps = float_bits(x + x * z * (-1.6666654611e-1f + z * (8.3321608736e-3f + z * -1.9515295891e-4f)));
+    uint32_t pc = float_bits(1.0f - 0.5f * z +
+                             z * z * (4.166664568298827e-2f + z * (-1.388731625493765e-3f + z * 2.443315711809948e-5f)));
+    uint32_t swap = 0u - ((uint32_t)q & 1u);
+    *s = bits_float(((pc & swap) | (ps & ~swap)) ^ (((uint32_t)q & 2u) << 30));
+    *c = bits_float(((ps & swap) | (pc & ~swap)) ^ (((uint32_t)q + 1u) & 2u) << 30);
+}
+
+/*
+ * Box-Muller su coppie di pixel, a blocchi di NOISE_BLOCK coppie. Il
+ * generatore a contatore non ha stato, quindi le uniformi si calcolano prima
+ * in due array contigui; la trasformazione usa logaritmo, seno e coseno
+ * polinomiali (niente chiamate alla libm) e gira su array a passo unitario, e
+ * i pixel pari e dispari si aggiornano in due passate separate. A -O3 (con
+ * -fno-math-errno per sqrtf, vedi CMakeLists.txt) la trasformazione e le
+ * passate vengono vettorizzate gia' con SSE2, le uniformi, che moltiplicano a
+ * 64 bit, da AVX2. Il rumore non dipende dalla libm della build.
+ */
+static void add_noise(float *pixels, int n, float sigma, uint64_t key) {
+    float u1[NOISE_BLOCK], u2[NOISE_BLOCK], dx[NOISE_BLOCK], dy[NOISE_BLOCK];
+    int pairs = (n + 1) / 2; // con n dispari l'ultimo pixel usa solo il coseno
+
+    for (int base = 0; base < pairs; base += NOISE_BLOCK) {
+        int m = pairs - base < NOISE_BLOCK ? pairs - base : NOISE_BLOCK;
+        int odd = n / 2 - base < m ? n / 2 - base : m;
+        for (int j = 0; j < m; j++) {
+            uint64_t counter = 2 * (uint64_t)(base + j);
+            u1[j] = uniform(key, counter);
+            u2[j] = uniform(key, counter + 1);
+        }
+        for (int j = 0; j < m; j++) {
+            float r = sigma * sqrtf(-2.0f * log_unit(u1[j]));
+            float s, c;
+            sincos_turn(u2[j], &s, &c);
+            dx[j] = r * c;
+            dy[j] = r * s;
+        }
+        float *block = pixels + 2 * base;
+        for (int j = 0; j < m; j++) {
+            float a = block[2 * j] + dx[j];
+            block[2 * j] = a < 0.0f ? 0.0f : a > 1.0f ? 1.0f : a;
+        }
+        for (int j = 0; j < odd; j++) {
+            float b = block[2 * j + 1] + dy[j];
+            block[2 * j + 1] = b < 0.0f ? 0.0f : b > 1.0f ? 1.0f : b;
+        }
+    }
+}
+
+// Fisher-Yates parziale: esattamente k pixel distinti, come np.random.choice senza ripetizione
+static void mask_pixels(float *pixels, int n, float fraction, uint64_t key) {
+    uint16_t index[PERTURB_MAX_PIXELS];
+    int k = (int)(fraction * n);
+    if (n > PERTURB_MAX_PIXELS)
+        n = PERTURB_MAX_PIXELS;
+    for (int i = 0; i < n; i++)
+        index[i] = i;
+    for (int i = 0; i < k && i < n; i++) {
+        int j = i + splitmix64(key ^ splitmix64(i)) % (uint64_t)(n - i);
+        uint16_t t = index[i];
+        index[i] = index[j];
+        index[j] = t;
+        pixels[index[i]] = 0.0f;
+    }
+}
+
+static void denoise(float *pixels, int n, float threshold) {
+    for (int i = 0; i < n; i++)
+        pixels[i] = pixels[i] < threshold ? 0.0f : pixels[i];
+}
+
+void perturb_apply(const struct perturb_level *level, uint64_t seed, uint64_t row, float *pixels, int n) {
+    for (int s = 0; s < level->n_steps; s++) {
+        const struct perturb_step *step = &level->steps[s];
+        uint64_t key = splitmix64(seed ^ splitmix64(row * PERTURB_MAX_STEPS + s));
+        switch (step->kind) {
+        case PERTURB_NOISE:
+            add_noise(pixels, n, step->amount, key);
+            break;
+        case PERTURB_MASK:
+            mask_pixels(pixels, n, step->amount, key);
+            break;
+        case PERTURB_DENOISE:
+            denoise(pixels, n, step->amount);
+            break;
+        }
+    }
+}
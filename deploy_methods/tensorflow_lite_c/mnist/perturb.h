@@ -0,0 +1,46 @@
+#ifndef PERTURB_H
+#define PERTURB_H
+
+#include <stdint.h>
+
+/*
+ * Perturbazioni delle immagini applicate in linea prima dell'invoke, al
+ * posto di rumore.py, elimina_pixel.py e rimuovi_rumore.py.
+ *
+ * Un livello e' una catena di passi separati da '+', applicati in ordine:
+ *   noise:S    rumore gaussiano di deviazione standard S, valori in [0,1]
+ *   mask:P     azzera esattamente P * pixel scelti a caso in ogni immagine
+ *   denoise:T  azzera i pixel sotto la soglia T (toglie il rumore di fondo)
+ *   clean      nessuna perturbazione
+ * Es. "noise:0.3", "mask:0.2", "noise:0.3+denoise:0.4".
+ *
+ * I numeri casuali dipendono solo da (seed, riga, passo, pixel): la stessa
+ * riga riceve la stessa realizzazione del rumore a ogni esecuzione e in ogni
+ * livello, cosi' i livelli differiscono solo per l'intensita'.
+ */
+
+#define PERTURB_MAX_STEPS 4
+#define PERTURB_NAME 64
+
+enum perturb_kind {
+    PERTURB_NOISE = 0,
+    PERTURB_MASK,
+    PERTURB_DENOISE
+};
+
+struct perturb_step {
+    int kind;
+    float amount;
+};
+
+struct perturb_level {
+    char name[PERTURB_NAME];
+    struct perturb_step steps[PERTURB_MAX_STEPS];
+    int n_steps;
+};
+
+int perturb_parse(const char *spec, struct perturb_level *level);
+// Perturba in place le n feature della riga row
+void perturb_apply(const struct perturb_level *level, uint64_t seed, uint64_t row, float *pixels, int n);
+
+#endif
@@ -0,0 +1,293 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "placement.h"
+
+// Da numaif.h, senza dipendere da libnuma
+#define MPOL_DEFAULT 0
+#define MPOL_PREFERRED 1
+
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+int placement_parse_cpus(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p != '\0') {
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+        if (end == p)
+            return -1;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p)
+                return -1;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE)
+            return -1;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -1;
+        p = end;
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+int placement_parse_hugepages(const char *name) {
+    if (strcmp(name, "thp") == 0)
+        return PLACEMENT_HUGE_THP;
+    if (strcmp(name, "hugetlb") == 0)
+        return PLACEMENT_HUGE_HUGETLB;
+    return -1;
+}
+
+const char *placement_huge_name(int huge) {
+    static const char *names[] = {"no", "thp", "hugetlb"};
+    return huge >= 0 && huge <= PLACEMENT_HUGE_HUGETLB ? names[huge] : "?";
+}
+
+void placement_format_cpus(const cpu_set_t *set, char *buf, size_t len) {
+    size_t used = 0;
+    buf[0] = '\0';
+    for (int cpu = 0; cpu < CPU_SETSIZE && used < len; cpu++) {
+        if (!CPU_ISSET(cpu, set))
+            continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+            last++;
+        if (last > cpu)
+            used += snprintf(buf + used, len - used, used ? ",%d-%d" : "%d-%d", cpu, last);
+        else
+            used += snprintf(buf + used, len - used, used ? ",%d" : "%d", cpu);
+        cpu = last;
+    }
+}
+
+int placement_cpu_node(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return 0;
+    int node = 0;
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL)
+        if (sscanf(e->d_name, "node%d", &node) == 1)
+            break;
+    closedir(dir);
+    return node >= 0 && node < PLACEMENT_MAX_NODES ? node : 0;
+}
+
+int placement_set_node(const cpu_set_t *set) {
+    int count[PLACEMENT_MAX_NODES] = {0}, best = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, set))
+            continue;
+        int node = placement_cpu_node(cpu);
+        if (++count[node] > count[best])
+            best = node;
+    }
+    return best;
+}
+
+/*
+ * Le CPU dei worker ordinate per nodo: fette consecutive in questo ordine
+ * restano in un solo nodo quando threads divide le CPU del nodo.
+ */
+void placement_worker_cpus(const struct placement_config *cfg, int index, int threads, cpu_set_t *out) {
+    int cpus[CPU_SETSIZE], n = 0;
+    for (int node = 0; node < PLACEMENT_MAX_NODES; node++)
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &cfg->worker_cpus) && placement_cpu_node(cpu) == node)
+                cpus[n++] = cpu;
+    CPU_ZERO(out);
+    if (n == 0)
+        return;
+    if (threads > n)
+        threads = n;
+    for (int i = 0; i < threads; i++)
+        CPU_SET(cpus[(index * threads + i) % n], out);
+}
+
+static void set_preferred_node(int node) {
+    unsigned long mask[PLACEMENT_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    // ENOSYS/EINVAL su kernel senza NUMA: si continua con la politica di default
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, PLACEMENT_MAX_NODES + 1) < 0 && errno != ENOSYS)
+        LOG_DEBUG("event=mempolicy_fallita node=%d error=\"%s\"", node, strerror(errno));
+}
+
+int placement_enter(const struct placement_config *cfg, const cpu_set_t *cpus) {
+    if (cpus != NULL && pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), cpus) != 0) {
+        char list[256];
+        placement_format_cpus(cpus, list, sizeof(list));
+        LOG_ERROR("event=affinita_fallita cpus=%s", list);
+        return -1;
+    }
+    if (cfg->numa) {
+        int cpu = sched_getcpu();
+        set_preferred_node(cpus != NULL ? placement_set_node(cpus) : placement_cpu_node(cpu < 0 ? 0 : cpu));
+    }
+    return 0;
+}
+
+void placement_leave(const struct placement_config *cfg, const cpu_set_t *cpus) {
+    if (cpus != NULL)
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), cpus);
+    if (cfg->numa)
+        syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+}
+
+int placement_page_node(const void *addr) {
+    void *page = (void *)((unsigned long)addr & ~(unsigned long)(sysconf(_SC_PAGESIZE) - 1));
+    int status = -1;
+    if (syscall(SYS_move_pages, 0, 1UL, &page, NULL, &status, 0) < 0)
+        return -1;
+    return status;
+}
+
+// Mappa anonima allineata a 2 MB, condizione perche' il kernel usi huge page trasparenti
+static void *map_aligned(size_t size) {
+    size_t span = size + HUGE_PAGE_SIZE;
+    char *p = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    char *aligned = (char *)(((unsigned long)p + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+    if (aligned > p)
+        munmap(p, aligned - p);
+    if (aligned + size < p + span)
+        munmap(aligned + size, p + span - (aligned + size));
+    return aligned;
+}
+
+int placement_alloc(struct placed_buffer *buf, size_t size, int hugepages) {
+    memset(buf, 0, sizeof(*buf));
+    buf->size = size;
+    buf->node = -1;
+    if (hugepages == PLACEMENT_HUGE_HUGETLB) {
+        buf->mapped = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        buf->data = mmap(NULL, buf->mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (buf->data != MAP_FAILED) {
+            buf->huge = PLACEMENT_HUGE_HUGETLB;
+        } else {
+            LOG_WARN("event=hugetlb_non_disponibile bytes=%zu error=\"%s\" fallback=thp", buf->mapped,
+                     strerror(errno));
+            buf->data = NULL;
+            hugepages = PLACEMENT_HUGE_THP;
+        }
+    }
+    if (buf->data == NULL && hugepages == PLACEMENT_HUGE_THP) {
+        buf->mapped = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        if ((buf->data = map_aligned(buf->mapped)) == NULL)
+            return -1;
+        buf->huge = madvise(buf->data, buf->mapped, MADV_HUGEPAGE) == 0 ? PLACEMENT_HUGE_THP : PLACEMENT_HUGE_NONE;
+    }
+    if (buf->data == NULL) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        buf->mapped = (size + page - 1) & ~(page - 1);
+        buf->data = mmap(NULL, buf->mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf->data == MAP_FAILED) {
+            buf->data = NULL;
+            return -1;
+        }
+    }
+    // Prima scrittura qui: le pagine nascono sul nodo preferito dal chiamante
+    memset(buf->data, 0, buf->mapped);
+    buf->node = placement_page_node(buf->data);
+    return 0;
+}
+
+void placement_free(struct placed_buffer *buf) {
+    if (buf->data != NULL)
+        munmap(buf->data, buf->mapped);
+    memset(buf, 0, sizeof(*buf));
+}
+
+void placement_advise_range(const void *start, const void *end) {
+    unsigned long first = (unsigned long)start & ~(HUGE_PAGE_SIZE - 1);
+    unsigned long last = ((unsigned long)end + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    // Parte dell'intervallo puo' non essere mappato: l'avviso vale per il resto
+    madvise((void *)first, last - first, MADV_HUGEPAGE);
+#ifdef MADV_COLLAPSE
+    // Linux >= 6.1: le pagine gia' toccate vengono unite subito, non da khugepaged
+    madvise((void *)first, last - first, MADV_COLLAPSE);
+#endif
+}
+
+static void read_line_value(const char *path, const char *key, char *out, size_t len) {
+    char line[512];
+    size_t klen = strlen(key);
+    out[0] = '\0';
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, key, klen) == 0) {
+            char *v = line + klen;
+            while (*v == ' ' || *v == '\t')
+                v++;
+            v[strcspn(v, "\n")] = '\0';
+            snprintf(out, len, "%s", v);
+            break;
+        }
+    }
+    fclose(f);
+}
+
+void placement_report(void) {
+    DIR *dir = opendir("/proc/self/task");
+    struct dirent *e;
+    char path[300], comm[32], allowed[256], stat[1024];
+    while (dir != NULL && (e = readdir(dir)) != NULL) {
+        if (e->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "/proc/self/task/%s/comm", e->d_name);
+        FILE *f = fopen(path, "r");
+        if (f == NULL)
+            continue;
+        if (fgets(comm, sizeof(comm), f) == NULL)
+            comm[0] = '\0';
+        comm[strcspn(comm, "\n")] = '\0';
+        fclose(f);
+        snprintf(path, sizeof(path), "/proc/self/task/%s/status", e->d_name);
+        read_line_value(path, "Cpus_allowed_list:", allowed, sizeof(allowed));
+
+        // Campo 39 di stat: ultima CPU su cui il thread e' stato eseguito
+        int cpu = -1;
+        snprintf(path, sizeof(path), "/proc/self/task/%s/stat", e->d_name);
+        if ((f = fopen(path, "r")) != NULL) {
+            if (fgets(stat, sizeof(stat), f) != NULL && strrchr(stat, ')') != NULL) {
+                char *p = strrchr(stat, ')') + 2;
+                for (int field = 3; field < 39 && p != NULL; field++)
+                    if ((p = strchr(p, ' ')) != NULL)
+                        p++;
+                if (p != NULL)
+                    cpu = atoi(p);
+            }
+            fclose(f);
+        }
+        LOG_INFO("event=placement_thread tid=%s nome=%s cpus=%s cpu=%d nodo=%d", e->d_name, comm, allowed, cpu,
+                 cpu >= 0 ? placement_cpu_node(cpu) : -1);
+    }
+    if (dir != NULL)
+        closedir(dir);
+
+    char anon_huge[64], hugetlb_private[64], hugetlb_shared[64];
+    read_line_value("/proc/self/smaps_rollup", "AnonHugePages:", anon_huge, sizeof(anon_huge));
+    read_line_value("/proc/self/smaps_rollup", "Private_Hugetlb:", hugetlb_private, sizeof(hugetlb_private));
+    read_line_value("/proc/self/smaps_rollup", "Shared_Hugetlb:", hugetlb_shared, sizeof(hugetlb_shared));
+    LOG_INFO("event=placement_huge_page anon_huge_kb=%ld hugetlb_kb=%ld", atol(anon_huge),
+             atol(hugetlb_private) + atol(hugetlb_shared));
+}
@@ -0,0 +1,77 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <sched.h> // cpu_set_t: richiede _GNU_SOURCE nel file che include
+#include <stddef.h>
+
+/*
+ * Posizionamento di thread e memoria del server.
+ *
+ * I thread di I/O (accept, connessioni, statistiche) restano sulle CPU di
+ * io_cpus, i worker di inferenza su worker_cpus: ogni worker riceve una
+ * fetta di tune.threads CPU, possibilmente tutte dello stesso nodo NUMA, e
+ * il pool di XNNPACK la eredita perche' viene creato dal thread gia' spostato.
+ * Con numa le allocazioni fatte durante la creazione dell'interprete
+ * (pesi impacchettati, arena dei tensori) preferiscono il nodo del worker e
+ * ogni nodo ha la propria copia del flatbuffer del modello.
+ *
+ * Le huge page sono opzionali: thp chiede le huge page trasparenti con
+ * madvise, hugetlb usa quelle riservate (vm.nr_hugepages) e ripiega su thp
+ * se non ce ne sono. Valgono per le copie del modello e per le attivazioni.
+ */
+
+#define PLACEMENT_MAX_NODES 64
+
+enum placement_huge {
+    PLACEMENT_HUGE_NONE = 0,
+    PLACEMENT_HUGE_THP,
+    PLACEMENT_HUGE_HUGETLB
+};
+
+struct placement_config {
+    cpu_set_t io_cpus;
+    cpu_set_t worker_cpus;
+    int io_set;     // io_cpus indicato da riga di comando
+    int worker_set; // worker_cpus indicato da riga di comando
+    int numa;
+    int hugepages;
+};
+
+// Memoria ottenuta da placement_alloc
+struct placed_buffer {
+    void *data;
+    size_t size;   // richiesta
+    size_t mapped; // arrotondata alla pagina effettiva
+    int huge;      // PLACEMENT_HUGE_* effettivamente ottenuto
+    int node;      // nodo della prima pagina, -1 se non noto
+};
+
+// "0-3,8,10-11"
+int placement_parse_cpus(const char *list, cpu_set_t *set);
+// "thp" o "hugetlb"
+int placement_parse_hugepages(const char *name);
+const char *placement_huge_name(int huge);
+void placement_format_cpus(const cpu_set_t *set, char *buf, size_t len);
+
+int placement_cpu_node(int cpu);
+// Fetta di threads CPU per il worker index, a rotazione su worker_cpus
+void placement_worker_cpus(const struct placement_config *cfg, int index, int threads, cpu_set_t *out);
+// Nodo NUMA prevalente di un insieme di CPU (0 se il sistema non e' NUMA)
+int placement_set_node(const cpu_set_t *set);
+
+// Sposta il thread chiamante sulle CPU indicate e, con numa, preferisce il
+// loro nodo per le allocazioni successive; leave torna al default
+int placement_enter(const struct placement_config *cfg, const cpu_set_t *cpus);
+void placement_leave(const struct placement_config *cfg, const cpu_set_t *cpus);
+
+// Memoria anonima toccata subito (prima scrittura = nodo del chiamante)
+int placement_alloc(struct placed_buffer *buf, size_t size, int hugepages);
+void placement_free(struct placed_buffer *buf);
+// Chiede huge page trasparenti per un intervallo gia' allocato da altri
+void placement_advise_range(const void *start, const void *end);
+int placement_page_node(const void *addr);
+
+// Un evento per thread (CPU permesse, ultima CPU, nodo) e i totali di huge page
+void placement_report(void);
+
+#endif
@@ -3,10 +3,14 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <errno.h>
 #include <json-c/json.h>
 
+#include "log.h"
+
 #define PORT 9090
 #define OUTPUT_SIZE 10
+#define MAX_JSON_SIZE (64 << 20) // la dimensione arriva dalla rete: oltre si scarta la risposta
 
 // Funzione per calcolare l'accuracy
 float calculate_accuracy(float error_rate) {
@@ -36,7 +40,7 @@ float calculate_f1_score(float precision, float recall) {
 void get_labels(const char *filename, int *labels, int num_samples) {
     FILE *file = fopen(filename, "r");
     if (!file) {
-        perror("Failed to open file");
+        LOG_ERROR("event=apertura_file_fallita path=%s error=\"%s\"", filename, strerror(errno));
         exit(1);
     }
 
@@ -46,16 +50,31 @@ void get_labels(const char *filename, int *labels, int num_samples) {
             break;
         }
         labels[i] = atoi(line);
-        printf("Labels %d: %d\n", i, labels[i]);
+        LOG_DEBUG("event=label index=%d label=%d", i, labels[i]);
     }
     fclose(file);
 }
 
+// Riceve esattamente len byte, anche se arrivano in piu' segmenti
+int recv_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
 void calculate_confusion_matrix(int *true_labels, int *predicted_labels, int num_samples, int confusion_matrix[OUTPUT_SIZE][OUTPUT_SIZE]) {
     for (int i = 0; i < num_samples; i++) {
         int true_label = true_labels[i];
         int predicted_label = predicted_labels[i];
-        if (true_label < OUTPUT_SIZE && predicted_label < OUTPUT_SIZE) {
+        if (true_label >= 0 && true_label < OUTPUT_SIZE && predicted_label >= 0 && predicted_label < OUTPUT_SIZE) {
             confusion_matrix[true_label][predicted_label]++;
         }
     }
@@ -78,6 +97,8 @@ int main(int argc, char *argv[]) {
     }
 
     const char *y_test_path = argv[1];
+    // Le metriche restano su stdout, i log vanno su stderr
+    log_init("controller", STDERR_FILENO);
     int num_samples = 10000;  // Supponiamo di avere 10000 campioni
 
     int server_fd, client_fd;
@@ -87,7 +108,7 @@ int main(int argc, char *argv[]) {
     // Creazione del socket
     server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd < 0) {
-        perror("Failed to create socket");
+        LOG_ERROR("event=socket_fallita error=\"%s\"", strerror(errno));
         return 1;
     }
 
@@ -97,63 +118,83 @@ int main(int argc, char *argv[]) {
 
     // Binding del socket
     if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Failed to bind socket");
+        LOG_ERROR("event=bind_fallita error=\"%s\"", strerror(errno));
         close(server_fd);
         return 1;
     }
 
     // Ascolto del socket
     if (listen(server_fd, 5) < 0) {
-        perror("Failed to listen on socket");
+        LOG_ERROR("event=listen_fallita error=\"%s\"", strerror(errno));
         close(server_fd);
         return 1;
     }
 
-    printf("Controller listening on port %d...\n", PORT);
+    LOG_INFO("event=listen port=%d", PORT);
 
     while (1) {
         // Accettare la connessione dal server
         client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &addr_len);
         if (client_fd < 0) {
-            perror("Failed to accept connection");
+            LOG_ERROR("event=accept_fallita error=\"%s\"", strerror(errno));
             return 1;
         }
 
         // Ricevere la dimensione del JSON
         size_t json_size;
-        if (recv(client_fd, &json_size, sizeof(json_size), 0) < 0) {
-            perror("Failed to receive JSON size");
+        if (recv_all(client_fd, &json_size, sizeof(json_size)) < 0) {
+            LOG_ERROR("event=recv_fallita what=size error=\"%s\"", strerror(errno));
             close(client_fd);
             return 1;
         }
+        // La dimensione non e' fidata: niente buffer sullo stack dimensionati dalla rete
+        if (json_size > MAX_JSON_SIZE) {
+            LOG_WARN("event=json_troppo_grande size=%zu max=%d", json_size, MAX_JSON_SIZE);
+            close(client_fd);
+            continue;
+        }
 
         // Ricevere il JSON
-        char buffer[json_size + 1];
-        ssize_t bytes_received = recv(client_fd, buffer, json_size, 0);
-        if (bytes_received < 0) {
-            perror("Failed to receive JSON data");
+        char *buffer = malloc(json_size + 1);
+        if (buffer == NULL || recv_all(client_fd, buffer, json_size) < 0) {
+            LOG_ERROR("event=recv_fallita what=json error=\"%s\"", strerror(errno));
+            free(buffer);
             close(client_fd);
             return 1;
         }
-        buffer[bytes_received] = '\0';
+        buffer[json_size] = '\0';
 
         // Parsare il file JSON
         struct json_object *parsed_json = json_tokener_parse(buffer);
+        free(buffer);
         struct json_object *json_predictions;
-        json_object_object_get_ex(parsed_json, "Labels", &json_predictions);
+        if (parsed_json == NULL || !json_object_object_get_ex(parsed_json, "Labels", &json_predictions)) {
+            LOG_WARN("event=json_non_valido");
+            json_object_put(parsed_json);
+            close(client_fd);
+            continue;
+        }
 
-        int predicted_labels[num_samples];
-        for (int i = 0; i < num_samples; i++) {
+        // Si valutano solo le etichette effettivamente ricevute
+        int count = json_object_array_length(json_predictions);
+        if (count > num_samples)
+            count = num_samples;
+        int *predicted_labels = malloc((count > 0 ? count : 1) * sizeof(int));
+        int *true_labels = calloc(count > 0 ? count : 1, sizeof(int));
+        if (predicted_labels == NULL || true_labels == NULL) {
+            LOG_ERROR("event=memoria_esaurita");
+            return 1;
+        }
+        for (int i = 0; i < count; i++) {
             predicted_labels[i] = json_object_get_int(json_object_array_get_idx(json_predictions, i));
         }
 
         // Leggere il file y_test.csv
-        int true_labels[num_samples];
-        get_labels(y_test_path, true_labels, num_samples);
+        get_labels(y_test_path, true_labels, count);
 
         // Calcolare la matrice di confusione
         int confusione_matrix[OUTPUT_SIZE][OUTPUT_SIZE] = {0};
-        calculate_confusion_matrix(true_labels, predicted_labels, num_samples, confusione_matrix);
+        calculate_confusion_matrix(true_labels, predicted_labels, count, confusione_matrix);
 
         // Stampare la matrice di confusione
         print_confusion_matrix(confusione_matrix);
@@ -221,6 +262,8 @@ int main(int argc, char *argv[]) {
         printf("F1-Score Complessivo: %.2f\n", overall_f1_score);
 
         // Pulire
+        free(predicted_labels);
+        free(true_labels);
         json_object_put(parsed_json);
         close(client_fd);
     }
@@ -0,0 +1,343 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "log.h"
+#include "payload.h"
+
+#define PORT 30080
+#define INPUT_SIZE 784
+#define DEFAULT_CONNECTIONS 32
+
+/*
+ * Riproduce contro un server una registrazione fatta con mnist_server -C,
+ * rispettando gli istanti di arrivo originali divisi per la velocita' (-s 2 =
+ * doppia velocita', -s 0 = il prima possibile con al massimo -c connessioni
+ * aperte). Ogni corpo viene rinviato byte per byte con la stessa payload_hello.
+ * La latenza si misura dall'istante in cui la richiesta avrebbe dovuto
+ * partire, cosi' un replay in ritardo non nasconde le attese accumulate.
+ * Le richieste che il server aveva cancellato (client disconnesso o scadenza
+ * superata) hanno un corpo forse troncato: vengono saltate e solo contate.
+ * Con -g non serve una registrazione: si inviano N richieste sintetiche di
+ * righe nulle, tutte pronte all'istante zero (carico fisso per i test di
+ * prestazione). Con -o si scrivono i tempi per richiesta nello stesso formato
+ * timestamp[ns],inference_time[ns] dei programmi di inferenza.
+ */
+
+struct replay_result {
+    long long latency_ns; // dall'istante previsto alla risposta completa
+    long long lag_ns;     // ritardo della partenza rispetto all'istante previsto
+    long long start_ns;   // partenza effettiva
+    int ok;
+};
+
+struct replay {
+    const struct capture_trace *trace;
+    struct sockaddr_in addr;
+    double speed;
+    long long t0;
+    pthread_mutex_t lock;
+    size_t next;
+    struct replay_result *results;
+    unsigned long mismatched, synthesized;
+};
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int ricevi_tutto(int sock, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = recv(sock, p, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int invia_tutto(int sock, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Righe nulle in RAW al posto di un corpo non salvato nella registrazione
+static int invia_sintetico(int sock, uint32_t rows) {
+    static const float zero[INPUT_SIZE];
+    for (uint32_t r = 0; r < rows; r++)
+        if (invia_tutto(sock, zero, sizeof(zero)) < 0)
+            return -1;
+    return 0;
+}
+
+// Esegue una richiesta registrata; 0 se il server ha risposto con le label
+static int esegui(struct replay *rp, const struct capture_request *req) {
+    const struct capture_trace *trace = rp->trace;
+    const char *body = NULL;
+    uint32_t body_len = 0;
+    struct payload_hello mode = req->mode;
+    int hello = req->hello;
+
+    if (req->payload_id > 0 && req->payload_id < trace->n_payloads && trace->payloads[req->payload_id] != NULL) {
+        body = trace->payloads[req->payload_id];
+        body_len = trace->payload_len[req->payload_id];
+    } else {
+        mode = (struct payload_hello){.magic = PAYLOAD_MAGIC, .encoding = PAYLOAD_RAW};
+        hello = 1;
+        __atomic_fetch_add(&rp->synthesized, 1, __ATOMIC_RELAXED);
+    }
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&rp->addr, sizeof(rp->addr)) < 0) {
+        LOG_DEBUG("event=connect_fallita error=\"%s\"", strerror(errno));
+        if (sock >= 0)
+            close(sock);
+        return -1;
+    }
+    struct payload_hello wanted = mode;
+    int ret = 0;
+    if (hello && (payload_negotiate(sock, &mode) < 0 || mode.compression != wanted.compression)) {
+        // Il corpo registrato e' compresso con un codec che il server non ha
+        __atomic_fetch_add(&rp->mismatched, 1, __ATOMIC_RELAXED);
+        ret = -1;
+    } else if (body != NULL ? invia_tutto(sock, body, body_len) < 0 : invia_sintetico(sock, req->rows) < 0) {
+        ret = -1;
+    }
+    shutdown(sock, SHUT_WR);
+
+    size_t json_size = 0;
+    if (ret == 0 && (ricevi_tutto(sock, &json_size, sizeof(json_size)) < 0 || json_size > (1u << 30)))
+        ret = -1;
+    if (ret == 0) {
+        char *json = malloc(json_size + 1);
+        if (json == NULL || ricevi_tutto(sock, json, json_size + 1) < 0)
+            ret = -1;
+        else if (strstr(json, "\"Error\"") != NULL)
+            ret = -1;
+        free(json);
+    }
+    close(sock);
+    return ret;
+}
+
+static void *replay_main(void *arg) {
+    struct replay *rp = arg;
+    struct timespec ts;
+    for (;;) {
+        pthread_mutex_lock(&rp->lock);
+        size_t i = rp->next++;
+        pthread_mutex_unlock(&rp->lock);
+        if (i >= rp->trace->n_requests)
+            break;
+
+        const struct capture_request *req = &rp->trace->requests[i];
+        long long target = rp->speed > 0 ? rp->t0 + (long long)(req->arrival_ns / rp->speed) : now_ns();
+        ts.tv_sec = target / 1000000000LL;
+        ts.tv_nsec = target % 1000000000LL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+        long long start = now_ns();
+        int ok = esegui(rp, req) == 0;
+        rp->results[i] = (struct replay_result){.latency_ns = now_ns() - target, .lag_ns = start - target,
+                                                 .start_ns = start, .ok = ok};
+    }
+    return NULL;
+}
+
+// Traccia di n richieste RAW senza corpo: esegui() le riempie di righe nulle
+static int genera_traccia(struct capture_trace *trace, size_t n, uint32_t rows) {
+    memset(trace, 0, sizeof(*trace));
+    trace->requests = calloc(n, sizeof(struct capture_request));
+    if (trace->requests == NULL)
+        return -1;
+    for (size_t i = 0; i < n; i++)
+        trace->requests[i] = (struct capture_request){.rows = rows, .hello = 1};
+    trace->n_requests = n;
+    return 0;
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_ms(const long long *sorted, size_t n, double q) {
+    return n > 0 ? sorted[(size_t)(q * (n - 1))] / 1e6 : 0.0;
+}
+
+int main(int argc, char **argv) {
+    const char *host = "127.0.0.1";
+    int port = PORT, connections = DEFAULT_CONNECTIONS;
+    double speed = 1.0;
+    size_t generated = 0;
+    uint32_t generated_rows = 1;
+    const char *times_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:s:c:g:o:")) != -1) {
+        switch (opt) {
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 's':
+            speed = atof(optarg);
+            break;
+        case 'c':
+            connections = atoi(optarg);
+            break;
+        case 'g': {
+            char *end;
+            generated = strtoull(optarg, &end, 10);
+            if (*end == ':')
+                generated_rows = strtoul(end + 1, NULL, 10);
+            break;
+        }
+        case 'o':
+            times_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-p port] [-s speed (0 = massima)] [-c connections] [-o times.csv] "
+                        "<capture_file | -g requests[:rows]>\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if ((optind >= argc && generated == 0) || connections < 1 || speed < 0 || generated_rows < 1) {
+        fprintf(stderr, "Usage: %s [-h host] [-p port] [-s speed (0 = massima)] [-c connections] [-o times.csv] "
+                        "<capture_file | -g requests[:rows]>\n",
+                argv[0]);
+        return 1;
+    }
+    log_init("replay", STDERR_FILENO);
+
+    struct capture_trace trace;
+    if (generated > 0 ? genera_traccia(&trace, generated, generated_rows) < 0 : capture_load(argv[optind], &trace) < 0)
+        exit(3);
+    size_t skipped = 0;
+    for (size_t i = 0; i < trace.n_requests; i++) {
+        if (trace.requests[i].cancelled)
+            skipped++;
+        else
+            trace.requests[i - skipped] = trace.requests[i];
+    }
+    trace.n_requests -= skipped;
+    if (trace.n_requests == 0) {
+        LOG_ERROR("event=capture_vuota path=%s", argv[optind]);
+        exit(3);
+    }
+    FILE *times_file = NULL;
+    if (times_path != NULL && (times_file = fopen(times_path, "w")) == NULL) {
+        LOG_ERROR("event=apertura_file_fallita path=%s error=\"%s\"", times_path, strerror(errno));
+        exit(3);
+    }
+    if (times_file != NULL)
+        fprintf(times_file, "timestamp[ns],inference_time[ns]\n");
+
+    struct replay rp = {.trace = &trace, .speed = speed};
+    pthread_mutex_init(&rp.lock, NULL);
+    rp.addr.sin_family = AF_INET;
+    rp.addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &rp.addr.sin_addr) != 1) {
+        struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM}, *res;
+        if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+            LOG_ERROR("event=host_non_risolto host=%s", host);
+            exit(3);
+        }
+        rp.addr.sin_addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+        freeaddrinfo(res);
+    }
+    rp.results = calloc(trace.n_requests, sizeof(*rp.results));
+    pthread_t *threads = calloc(connections, sizeof(*threads));
+    if (rp.results == NULL || threads == NULL) {
+        LOG_ERROR("event=memoria_insufficiente requests=%zu", trace.n_requests);
+        exit(3);
+    }
+    double span_s = trace.requests[trace.n_requests - 1].arrival_ns / 1e9;
+    LOG_INFO("event=replay_inizio requests=%zu cancellate_saltate=%zu payloads=%zu durata_originale_s=%.3f speed=%g "
+             "connections=%d",
+             trace.n_requests, skipped, trace.n_payloads > 0 ? trace.n_payloads - 1 : 0, span_s, speed, connections);
+
+    // Il replay inizia dalla prima richiesta, non dall'avvio della registrazione
+    rp.t0 = now_ns() - (long long)(trace.requests[0].arrival_ns / (speed > 0 ? speed : 1.0));
+    long long start = now_ns();
+    for (int i = 0; i < connections; i++)
+        pthread_create(&threads[i], NULL, replay_main, &rp);
+    for (int i = 0; i < connections; i++)
+        pthread_join(threads[i], NULL);
+    double elapsed_s = (now_ns() - start) / 1e9;
+
+    // Percentili sulle richieste riuscite; il servizio registrato come confronto
+    long long *latency = malloc(trace.n_requests * sizeof(long long));
+    long long *lag = malloc(trace.n_requests * sizeof(long long));
+    long long *service = malloc(trace.n_requests * sizeof(long long));
+    if (latency == NULL || lag == NULL || service == NULL)
+        exit(3);
+    size_t ok = 0;
+    unsigned long long rows = 0;
+    for (size_t i = 0; i < trace.n_requests; i++) {
+        service[i] = trace.requests[i].service_ns;
+        lag[i] = rp.results[i].lag_ns;
+        if (!rp.results[i].ok)
+            continue;
+        if (times_file != NULL)
+            fprintf(times_file, "%lld,%lld\n", rp.results[i].start_ns,
+                    rp.results[i].latency_ns - rp.results[i].lag_ns);
+        latency[ok++] = rp.results[i].latency_ns;
+        rows += trace.requests[i].rows;
+    }
+    qsort(latency, ok, sizeof(long long), cmp_ll);
+    qsort(lag, trace.n_requests, sizeof(long long), cmp_ll);
+    qsort(service, trace.n_requests, sizeof(long long), cmp_ll);
+
+    LOG_INFO("event=replay_completato requests=%zu ok=%zu errori=%zu codec_mancanti=%lu sintetiche=%lu s=%.3f "
+             "req_s=%.1f rows_s=%.1f",
+             trace.n_requests, ok, trace.n_requests - ok, rp.mismatched, rp.synthesized, elapsed_s,
+             ok / elapsed_s, rows / elapsed_s);
+    LOG_INFO("event=replay_latenza p50_ms=%.3f p90_ms=%.3f p99_ms=%.3f p999_ms=%.3f max_ms=%.3f",
+             percentile_ms(latency, ok, 0.50), percentile_ms(latency, ok, 0.90), percentile_ms(latency, ok, 0.99),
+             percentile_ms(latency, ok, 0.999), percentile_ms(latency, ok, 1.0));
+    LOG_INFO("event=replay_ritardo p50_ms=%.3f p99_ms=%.3f max_ms=%.3f", percentile_ms(lag, trace.n_requests, 0.50),
+             percentile_ms(lag, trace.n_requests, 0.99), percentile_ms(lag, trace.n_requests, 1.0));
+    LOG_INFO("event=servizio_registrato p50_ms=%.3f p99_ms=%.3f max_ms=%.3f",
+             percentile_ms(service, trace.n_requests, 0.50), percentile_ms(service, trace.n_requests, 0.99),
+             percentile_ms(service, trace.n_requests, 1.0));
+
+    if (times_file != NULL)
+        fclose(times_file);
+    free(latency);
+    free(lag);
+    free(service);
+    free(threads);
+    free(rp.results);
+    int failed = ok != trace.n_requests;
+    capture_trace_free(&trace);
+    log_flush();
+    return failed;
+}
@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "scheduler.h"
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void sched_init(struct sched *s, int quantum) {
+    memset(s, 0, sizeof(*s));
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->ready, NULL);
+    s->quantum = quantum > 0 ? quantum : 1;
+}
+
+static void activate(struct sched *s, struct sched_tenant *t);
+static void deactivate(struct sched *s, struct sched_tenant *t);
+
+static unsigned bucket(const char *name) {
+    unsigned h = 2166136261u; // FNV-1a
+    for (int i = 0; i < SCHED_TENANT_NAME && name[i] != '\0'; i++)
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    return h % SCHED_BUCKETS;
+}
+
+static void idle_remove(struct sched *s, struct sched_tenant *t) {
+    if (t->prev_idle != NULL)
+        t->prev_idle->next_idle = t->next_idle;
+    else
+        s->idle_head = t->next_idle;
+    if (t->next_idle != NULL)
+        t->next_idle->prev_idle = t->prev_idle;
+    else
+        s->idle_tail = t->prev_idle;
+    t->next_idle = t->prev_idle = NULL;
+    t->idle_ns = 0;
+}
+
+// Libera i tenant inutilizzati da piu' di SCHED_IDLE_TTL_NS; con il lock preso.
+// La lista idle e' in ordine di inattivita', basta guardarne la testa
+static void reap(struct sched *s, long long now) {
+    struct sched_tenant *t;
+    while ((t = s->idle_head) != NULL && now - t->idle_ns >= SCHED_IDLE_TTL_NS) {
+        idle_remove(s, t);
+        struct sched_tenant **p = &s->buckets[bucket(t->name)];
+        while (*p != t)
+            p = &(*p)->next;
+        *p = t->next;
+        LOG_DEBUG("event=tenant_rimosso tenant=%s completed=%lld", t->name, t->completed);
+        free(t);
+    }
+}
+
+// Cerca o crea un tenant; da chiamare con il lock preso
+static struct sched_tenant *lookup(struct sched *s, const char *name) {
+    struct sched_tenant **head = &s->buckets[bucket(name)];
+    for (struct sched_tenant *t = *head; t != NULL; t = t->next)
+        if (strncmp(t->name, name, sizeof(t->name)) == 0)
+            return t;
+
+    struct sched_tenant *t = calloc(1, sizeof(*t));
+    if (t == NULL)
+        return NULL;
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    t->weight = 1;
+    t->next = *head;
+    *head = t;
+    return t;
+}
+
+int sched_configure_tenant(struct sched *s, const char *spec) {
+    char name[SCHED_TENANT_NAME];
+    int weight = 1, priority = 0;
+
+    if (sscanf(spec, "%47[^:]:%d:%d", name, &weight, &priority) < 2 || weight <= 0 || priority < 0 ||
+        priority >= SCHED_MAX_PRIORITY)
+        return -1;
+
+    pthread_mutex_lock(&s->lock);
+    struct sched_tenant *t = lookup(s, name);
+    if (t != NULL) {
+        t->configured = 1;
+        if (t->idle_ns != 0)
+            idle_remove(s, t);
+        // Un tenant attivo va spostato nel giro del nuovo livello
+        int was_active = t->active;
+        if (was_active)
+            deactivate(s, t);
+        t->weight = weight;
+        t->priority = priority;
+        if (was_active)
+            activate(s, t);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return t != NULL ? 0 : -1;
+}
+
+struct sched_tenant *sched_tenant(struct sched *s, const char *name) {
+    pthread_mutex_lock(&s->lock);
+    reap(s, now_ns());
+    struct sched_tenant *t = lookup(s, name);
+    if (t != NULL) {
+        if (t->idle_ns != 0)
+            idle_remove(s, t);
+        t->refs++;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return t;
+}
+
+// A questo punto i batch della richiesta sono gia' tutti usciti dalla coda
+void sched_tenant_put(struct sched *s, struct sched_tenant *t) {
+    if (t == NULL)
+        return;
+    pthread_mutex_lock(&s->lock);
+    if (--t->refs == 0 && !t->configured && t->depth == 0) {
+        t->idle_ns = now_ns();
+        t->prev_idle = s->idle_tail;
+        if (s->idle_tail != NULL)
+            s->idle_tail->next_idle = t;
+        else
+            s->idle_head = t;
+        s->idle_tail = t;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Il tenant entra in fondo al giro del suo livello di priorita'
+static void activate(struct sched *s, struct sched_tenant *t) {
+    struct sched_tenant **cursor = &s->cursor[t->priority];
+    t->active = 1;
+    t->visited = 0;
+    t->deficit = 0;
+    if (*cursor == NULL) {
+        t->next_active = t->prev_active = t;
+        *cursor = t;
+    } else {
+        t->next_active = *cursor;
+        t->prev_active = (*cursor)->prev_active;
+        (*cursor)->prev_active->next_active = t;
+        (*cursor)->prev_active = t;
+    }
+}
+
+static void deactivate(struct sched *s, struct sched_tenant *t) {
+    struct sched_tenant **cursor = &s->cursor[t->priority];
+    t->active = 0;
+    if (t->next_active == t) {
+        *cursor = NULL;
+    } else {
+        t->prev_active->next_active = t->next_active;
+        t->next_active->prev_active = t->prev_active;
+        if (*cursor == t)
+            *cursor = t->next_active;
+    }
+}
+
+void sched_push(struct sched *s, struct sched_tenant *t, struct sched_item *item) {
+    item->next = NULL;
+    item->tenant = t;
+    item->enqueued_ns = now_ns();
+
+    pthread_mutex_lock(&s->lock);
+    if (t->tail != NULL)
+        t->tail->next = item;
+    else
+        t->head = item;
+    t->tail = item;
+    t->depth++;
+    t->enqueued++;
+    if (t->depth > t->max_depth)
+        t->max_depth = t->depth;
+    if (!t->active)
+        activate(s, t);
+    pthread_cond_signal(&s->ready);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Deficit round robin sul livello: ogni visita aggiunge quantum * weight di
+// credito, il tenant resta sotto il cursore finche' il credito copre il batch
+static struct sched_item *pick(struct sched *s, int priority) {
+    for (;;) {
+        struct sched_tenant *t = s->cursor[priority];
+        if (t == NULL)
+            return NULL;
+
+        if (!t->visited) {
+            t->deficit += (long)s->quantum * t->weight;
+            t->visited = 1;
+        }
+        struct sched_item *item = t->head;
+        if (item->cost <= t->deficit) {
+            t->deficit -= item->cost;
+            t->head = item->next;
+            if (t->head == NULL) {
+                t->tail = NULL;
+                deactivate(s, t);
+            }
+            t->depth--;
+            return item;
+        }
+        t->visited = 0;
+        s->cursor[priority] = t->next_active;
+    }
+}
+
+struct sched_item *sched_pop(struct sched *s) {
+    struct sched_item *item = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    while (!s->closed) {
+        for (int p = SCHED_MAX_PRIORITY - 1; p >= 0 && item == NULL; p--)
+            item = pick(s, p);
+        if (item != NULL)
+            break;
+        pthread_cond_wait(&s->ready, &s->lock);
+    }
+    if (item != NULL) {
+        long long wait = now_ns() - item->enqueued_ns;
+        item->tenant->wait_ns_total += wait;
+        if (wait > item->tenant->wait_ns_max)
+            item->tenant->wait_ns_max = wait;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return item;
+}
+
+void sched_done(struct sched *s, struct sched_item *item) {
+    pthread_mutex_lock(&s->lock);
+    item->tenant->completed++;
+    pthread_mutex_unlock(&s->lock);
+}
+
+struct sched_item *sched_remove(struct sched *s, struct sched_tenant *t,
+                                int (*match)(const struct sched_item *item, void *arg), void *arg) {
+    struct sched_item *removed = NULL, **last = &removed;
+
+    pthread_mutex_lock(&s->lock);
+    struct sched_item **p = &t->head, *prev = NULL;
+    while (*p != NULL) {
+        struct sched_item *item = *p;
+        if (!match(item, arg)) {
+            prev = item;
+            p = &item->next;
+            continue;
+        }
+        *p = item->next;
+        item->next = NULL;
+        *last = item;
+        last = &item->next;
+        t->depth--;
+        t->removed++;
+    }
+    t->tail = prev;
+    if (t->head == NULL && t->active)
+        deactivate(s, t);
+    pthread_mutex_unlock(&s->lock);
+    return removed;
+}
+
+void sched_close(struct sched *s) {
+    pthread_mutex_lock(&s->lock);
+    s->closed = 1;
+    pthread_cond_broadcast(&s->ready);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Profondita' e attese per tenant; i massimi si azzerano a ogni report.
+// I tenant inutilizzati compaiono solo se hanno avuto traffico dall'ultimo
+void sched_report(struct sched *s) {
+    pthread_mutex_lock(&s->lock);
+    reap(s, now_ns());
+    for (int i = 0; i < SCHED_BUCKETS; i++)
+        for (struct sched_tenant *t = s->buckets[i]; t != NULL; t = t->next) {
+            if (t->idle_ns != 0 && t->enqueued == t->reported)
+                continue;
+            long long started = t->enqueued - t->depth - t->removed;
+            LOG_INFO("event=tenant_stats tenant=%s weight=%d priority=%d depth=%d max_depth=%d enqueued=%lld "
+                     "completed=%lld removed=%lld wait_mean_ms=%.3f wait_max_ms=%.3f",
+                     t->name, t->weight, t->priority, t->depth, t->max_depth, t->enqueued, t->completed,
+                     t->removed, started > 0 ? t->wait_ns_total / 1e6 / started : 0.0, t->wait_ns_max / 1e6);
+            t->max_depth = t->depth;
+            t->wait_ns_max = 0;
+            t->reported = t->enqueued;
+        }
+    pthread_mutex_unlock(&s->lock);
+}
@@ -0,0 +1,86 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <pthread.h>
+
+/*
+ * Scheduler dei batch di inferenza tra client concorrenti.
+ *
+ * Ogni tenant (un client, o un gruppo di client con lo stesso nome) ha la sua
+ * coda di batch. I worker prelevano con deficit round robin pesato: a ogni
+ * giro un tenant riceve quantum * weight righe di credito e serve i batch che
+ * ci stanno, quindi un job enorme non blocca quelli piccoli degli altri
+ * tenant. Le priorita' sono strette: un livello piu' alto viene sempre
+ * servito prima, il DRR vale all'interno dello stesso livello.
+ * I tenant non configurati con -T (uno per indirizzo dei client TCP) vengono
+ * liberati quando restano senza richieste per SCHED_IDLE_TTL_NS.
+ */
+
+#define SCHED_MAX_PRIORITY 4
+#define SCHED_TENANT_NAME 48
+#define SCHED_BUCKETS 64
+// Un tenant non configurato e senza richieste viene rimosso dopo questo tempo
+#define SCHED_IDLE_TTL_NS (60 * 1000000000LL)
+
+// Da includere come primo membro della struttura del batch
+struct sched_item {
+    struct sched_item *next;
+    struct sched_tenant *tenant;
+    long long enqueued_ns;
+    int cost; // righe del batch
+};
+
+struct sched_tenant {
+    char name[SCHED_TENANT_NAME];
+    int weight;
+    int priority;
+    long deficit;
+    int visited;
+    int active;
+    int configured; // creato con -T: non viene mai rimosso
+    int refs;       // richieste che lo usano
+    long long idle_ns;
+    struct sched_item *head, *tail;
+    struct sched_tenant *next_active, *prev_active;
+    struct sched_tenant *next_idle, *prev_idle;
+    struct sched_tenant *next; // catena del bucket
+
+    // Statistiche
+    int depth;
+    int max_depth;
+    long long enqueued;
+    long long completed;
+    long long removed; // tolti dalla coda senza essere eseguiti
+    long long wait_ns_total;
+    long long wait_ns_max;
+    long long reported; // enqueued all'ultimo report
+};
+
+struct sched {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    int quantum;
+    int closed;
+    struct sched_tenant *buckets[SCHED_BUCKETS];
+    struct sched_tenant *idle_head, *idle_tail; // tenant rimovibili, dal piu' vecchio
+    struct sched_tenant *cursor[SCHED_MAX_PRIORITY]; // ring dei tenant attivi per livello
+};
+
+void sched_init(struct sched *s, int quantum);
+// name:weight[:priority]
+int sched_configure_tenant(struct sched *s, const char *spec);
+// Ogni sched_tenant va chiuso con sched_tenant_put quando la richiesta termina
+struct sched_tenant *sched_tenant(struct sched *s, const char *name);
+void sched_tenant_put(struct sched *s, struct sched_tenant *t);
+void sched_push(struct sched *s, struct sched_tenant *t, struct sched_item *item);
+// Blocca finche' c'e' un batch da eseguire; NULL dopo sched_close
+struct sched_item *sched_pop(struct sched *s);
+void sched_done(struct sched *s, struct sched_item *item);
+// Toglie dalla coda di t i batch per cui match e' vero (es. quelli di una
+// richiesta cancellata) e li restituisce concatenati con next
+struct sched_item *sched_remove(struct sched *s, struct sched_tenant *t,
+                                int (*match)(const struct sched_item *item, void *arg), void *arg);
+void sched_close(struct sched *s);
+void sched_report(struct sched *s);
+
+#endif
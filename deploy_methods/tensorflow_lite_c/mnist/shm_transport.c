@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shm_transport.h"
+
+static size_t slot_stride(uint32_t slot_rows, uint32_t input_size) {
+    size_t bytes = (size_t)slot_rows * input_size * sizeof(float) + (size_t)slot_rows * sizeof(int32_t);
+    return (bytes + 63) & ~(size_t)63; // slot allineati a 64 byte
+}
+
+size_t shm_region_size(uint32_t slots, uint32_t slot_rows, uint32_t input_size) {
+    return SHM_HEADER_SIZE + (size_t)slots * slot_stride(slot_rows, input_size);
+}
+
+// Lato client: crea il memfd, lo dimensiona e scrive l'header
+int shm_region_create(struct shm_region *region, uint32_t slots, uint32_t slot_rows, uint32_t input_size,
+                      const char *tenant) {
+    memset(region, 0, sizeof(*region));
+    region->size = shm_region_size(slots, slot_rows, input_size);
+    region->slot_stride = slot_stride(slot_rows, input_size);
+
+    region->fd = memfd_create("mnist_shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (region->fd < 0) {
+        perror("memfd_create");
+        return -1;
+    }
+    if (ftruncate(region->fd, region->size) < 0) {
+        perror("ftruncate memfd");
+        close(region->fd);
+        return -1;
+    }
+    // La dimensione viene bloccata: il server mappa la regione e un ftruncate
+    // successivo gli farebbe ricevere SIGBUS
+    if (fcntl(region->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        perror("sigilli memfd");
+        close(region->fd);
+        return -1;
+    }
+    region->base = mmap(NULL, region->size, PROT_READ | PROT_WRITE, MAP_SHARED, region->fd, 0);
+    if (region->base == MAP_FAILED) {
+        perror("mmap memfd");
+        close(region->fd);
+        return -1;
+    }
+    region->info.magic = SHM_MAGIC;
+    region->info.slots = slots;
+    region->info.slot_rows = slot_rows;
+    region->info.input_size = input_size;
+    // Campo non terminato se il nome lo riempie: il server lo legge con %.*s
+    if (tenant != NULL)
+        memcpy(region->info.tenant, tenant, strnlen(tenant, sizeof(region->info.tenant)));
+    memcpy(region->base, &region->info, sizeof(region->info));
+    return 0;
+}
+
+// Lato server: mappa il memfd ricevuto e controlla che l'header sia coerente
+// con la dimensione reale, dato che arriva da un processo non fidato
+int shm_region_attach(struct shm_region *region, int fd, uint32_t input_size) {
+    struct stat st;
+    struct shm_header hdr;
+
+    memset(region, 0, sizeof(*region));
+    region->fd = fd;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < SHM_HEADER_SIZE ||
+        (fcntl(fd, F_GET_SEALS) & F_SEAL_SHRINK) == 0) {
+        fprintf(stderr, "Regione condivisa non valida\n");
+        return -1;
+    }
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || hdr.magic != SHM_MAGIC ||
+        hdr.input_size != input_size || hdr.slots == 0 || hdr.slots > SHM_MAX_SLOTS ||
+        hdr.slot_rows == 0 || hdr.slot_rows > SHM_MAX_SLOT_ROWS ||
+        shm_region_size(hdr.slots, hdr.slot_rows, hdr.input_size) > (size_t)st.st_size) {
+        fprintf(stderr, "Header della regione condivisa non valido\n");
+        return -1;
+    }
+    region->size = shm_region_size(hdr.slots, hdr.slot_rows, hdr.input_size);
+    region->slot_stride = slot_stride(hdr.slot_rows, hdr.input_size);
+    region->base = mmap(NULL, region->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (region->base == MAP_FAILED) {
+        perror("mmap memfd");
+        region->base = NULL;
+        return -1;
+    }
+    // Da qui in poi si usa solo la copia validata: il client potrebbe
+    // riscrivere l'header in memoria condivisa dopo il controllo
+    region->info = hdr;
+    return 0;
+}
+
+void shm_region_close(struct shm_region *region) {
+    if (region->base != NULL)
+        munmap(region->base, region->size);
+    if (region->fd >= 0)
+        close(region->fd);
+    memset(region, 0, sizeof(*region));
+    region->fd = -1;
+}
+
+float *shm_slot_input(const struct shm_region *region, uint32_t slot) {
+    return (float *)((char *)region->base + SHM_HEADER_SIZE + slot * region->slot_stride);
+}
+
+int32_t *shm_slot_labels(const struct shm_region *region, uint32_t slot) {
+    return (int32_t *)(shm_slot_input(region, slot) + (size_t)region->info.slot_rows * region->info.input_size);
+}
+
+// Invia un messaggio di controllo, con un file descriptor allegato se fd >= 0
+int shm_send_msg(int sock, const struct shm_msg *msg, int fd) {
+    struct iovec iov = {.iov_base = (void *)msg, .iov_len = sizeof(*msg)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1};
+
+    if (fd >= 0) {
+        memset(&control, 0, sizeof(control));
+        mh.msg_control = control.buf;
+        mh.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &mh, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n == sizeof(*msg) ? 0 : -1;
+}
+
+// Riceve un messaggio di controllo; se fd != NULL vi salva l'eventuale descrittore allegato
+int shm_recv_msg(int sock, struct shm_msg *msg, int *fd) {
+    struct iovec iov = {.iov_base = msg, .iov_len = sizeof(*msg)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                        .msg_controllen = sizeof(control.buf)};
+
+    if (fd != NULL)
+        *fd = -1;
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &mh, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n != sizeof(*msg))
+        return -1;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh); cmsg != NULL; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int received;
+            memcpy(&received, CMSG_DATA(cmsg), sizeof(int));
+            if (fd != NULL)
+                *fd = received;
+            else
+                close(received);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef SHM_TRANSPORT_H
+#define SHM_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Trasporto locale client/server sullo stesso nodo.
+ *
+ * Il client crea una regione di memoria condivisa (memfd) e la passa al server
+ * sulla socket Unix con SCM_RIGHTS; da li' in poi sulla socket viaggiano solo
+ * piccoli messaggi di controllo. La regione e' un ring di slot: ogni slot
+ * contiene fino a slot_rows immagini in float32 (gia' nel formato del tensore
+ * di input) e lo spazio per le etichette predette dal server.
+ *
+ *   [ shm_header | pad fino a 4096 ][ slot 0 ][ slot 1 ] ... [ slot N-1 ]
+ *   slot = float input[slot_rows][input_size] | int32 labels[slot_rows]
+ */
+
+#define SHM_MAGIC 0x4d4e5348u // "MNSH"
+#define SHM_HEADER_SIZE 4096
+#define SHM_DEFAULT_SLOTS 4
+#define SHM_DEFAULT_SLOT_ROWS 1000
+#define SHM_MAX_SLOTS 64
+#define SHM_MAX_SLOT_ROWS 65536
+#define SHM_DEFAULT_SOCKET_PATH "/var/data/ml_model_prova/mnist.sock"
+
+struct shm_header {
+    uint32_t magic;
+    uint32_t slots;
+    uint32_t slot_rows;
+    uint32_t input_size;
+    char tenant[32]; // nome del tenant per lo scheduler, non necessariamente terminato
+};
+
+// Tipi dei messaggi di controllo
+enum shm_msg_type {
+    SHM_MSG_HELLO = 1, // client -> server, accompagna il memfd
+    SHM_MSG_SUBMIT,    // client -> server, slot pronto con rows immagini
+    SHM_MSG_DONE,      // server -> client, etichette dello slot scritte
+    SHM_MSG_END,       // client -> server, nessun altro slot
+    SHM_MSG_ERROR      // server -> client, richiesta rifiutata
+};
+
+struct shm_msg {
+    uint32_t type;
+    uint32_t slot;
+    uint32_t rows;
+    uint32_t seq;
+};
+
+struct shm_region {
+    int fd;
+    void *base;
+    size_t size;
+    struct shm_header info; // copia locale dell'header, validata in attach
+    size_t slot_stride;
+};
+
+size_t shm_region_size(uint32_t slots, uint32_t slot_rows, uint32_t input_size);
+int shm_region_create(struct shm_region *region, uint32_t slots, uint32_t slot_rows, uint32_t input_size,
+                      const char *tenant);
+int shm_region_attach(struct shm_region *region, int fd, uint32_t input_size);
+void shm_region_close(struct shm_region *region);
+
+float *shm_slot_input(const struct shm_region *region, uint32_t slot);
+int32_t *shm_slot_labels(const struct shm_region *region, uint32_t slot);
+
+int shm_send_msg(int sock, const struct shm_msg *msg, int fd);
+int shm_recv_msg(int sock, struct shm_msg *msg, int *fd);
+
+#endif
@@ -0,0 +1,343 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "telemetry.h"
+
+_Static_assert(sizeof(struct telemetry_header) == 64, "telemetry_header deve restare di 64 byte");
+_Static_assert(sizeof(struct telemetry_record) == 64, "telemetry_record deve restare di 64 byte");
+
+// File di un thread aperti una volta sola: ogni campione e' solo una pread
+struct telemetry_thread {
+    int id; // worker
+    int stat_fd, status_fd, schedstat_fd;
+};
+
+static long long telemetry_now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Legge un file di /proc dall'inizio; -1 se il thread non esiste piu'
+static int read_proc(int fd, char *buf, size_t len) {
+    ssize_t n = pread(fd, buf, len - 1, 0);
+    if (n <= 0)
+        return -1;
+    buf[n] = '\0';
+    return 0;
+}
+
+static unsigned long long status_value(const char *status, const char *key) {
+    const char *p = strstr(status, key);
+    return p != NULL ? strtoull(p + strlen(key), NULL, 10) : 0;
+}
+
+int telemetry_open(struct telemetry *tel, const char *path, size_t size, int hz) {
+    memset(tel, 0, sizeof(*tel));
+    tel->statm_fd = tel->listen_fd = -1;
+    pthread_mutex_init(&tel->sockets_lock, NULL);
+    if (hz < 1 || hz > 10000 || size < sizeof(struct telemetry_header) + 64 * sizeof(struct telemetry_record)) {
+        LOG_ERROR("event=telemetria_parametri_non_validi hz=%d size=%zu", hz, size);
+        return -1;
+    }
+    uint32_t capacity = (size - sizeof(struct telemetry_header)) / sizeof(struct telemetry_record);
+    tel->mapped = sizeof(struct telemetry_header) + (size_t)capacity * sizeof(struct telemetry_record);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || ftruncate(fd, tel->mapped) < 0) {
+        LOG_ERROR("event=telemetria_apertura_fallita path=%s error=\"%s\"", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, tel->mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG_ERROR("event=telemetria_mmap_fallita path=%s error=\"%s\"", path, strerror(errno));
+        return -1;
+    }
+    tel->header = map;
+    tel->records = (struct telemetry_record *)(tel->header + 1);
+    tel->period_ns = 1000000000LL / hz;
+    tel->start_ns = telemetry_now_ns(CLOCK_MONOTONIC);
+    *tel->header = (struct telemetry_header){.magic = TELEMETRY_MAGIC, .version = TELEMETRY_VERSION,
+                                             .record_size = sizeof(struct telemetry_record),
+                                             .capacity = capacity, .period_ns = tel->period_ns,
+                                             .start_unix_ns = telemetry_now_ns(CLOCK_REALTIME)};
+
+    tel->statm_fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    LOG_INFO("event=telemetria_aperta path=%s hz=%d capacity=%u", path, hz, capacity);
+    return 0;
+}
+
+static void add_thread(struct telemetry *tel, int id, const char *tid) {
+    char path[300];
+    if (tel->n_threads == TELEMETRY_MAX_THREADS)
+        return;
+    struct telemetry_thread *t = &tel->threads[tel->n_threads];
+    t->id = id;
+    snprintf(path, sizeof(path), "/proc/self/task/%s/stat", tid);
+    t->stat_fd = open(path, O_RDONLY | O_CLOEXEC);
+    snprintf(path, sizeof(path), "/proc/self/task/%s/status", tid);
+    t->status_fd = open(path, O_RDONLY | O_CLOEXEC);
+    snprintf(path, sizeof(path), "/proc/self/task/%s/schedstat", tid);
+    t->schedstat_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (t->stat_fd < 0) {
+        if (t->status_fd >= 0)
+            close(t->status_fd);
+        if (t->schedstat_fd >= 0)
+            close(t->schedstat_fd);
+        return;
+    }
+    tel->n_threads++;
+    if (id >= tel->workers)
+        tel->workers = id + 1;
+}
+
+// Thread dei worker riconosciuti dal nome: worker-N e, se il worker usa piu'
+// thread, il pool XNNPACK infer-N creato dallo stesso thread
+static void find_threads(struct telemetry *tel) {
+    DIR *dir = opendir("/proc/self/task");
+    struct dirent *e;
+    char path[300], comm[32];
+    while (dir != NULL && (e = readdir(dir)) != NULL) {
+        int id;
+        if (e->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "/proc/self/task/%s/comm", e->d_name);
+        FILE *f = fopen(path, "r");
+        if (f == NULL)
+            continue;
+        if (fgets(comm, sizeof(comm), f) == NULL)
+            comm[0] = '\0';
+        fclose(f);
+        if (sscanf(comm, "worker-%d", &id) == 1 || sscanf(comm, "infer-%d", &id) == 1)
+            if (id >= 0 && id < 65536)
+                add_thread(tel, id, e->d_name);
+    }
+    if (dir != NULL)
+        closedir(dir);
+}
+
+static void sample_process(struct telemetry *tel, struct telemetry_record *rec) {
+    struct rusage ru;
+    char statm[128];
+    getrusage(RUSAGE_SELF, &ru);
+    rec->kind = TELEMETRY_PROCESS;
+    rec->usage.user_us = ru.ru_utime.tv_sec * 1000000ULL + ru.ru_utime.tv_usec;
+    rec->usage.system_us = ru.ru_stime.tv_sec * 1000000ULL + ru.ru_stime.tv_usec;
+    rec->usage.minflt = ru.ru_minflt;
+    rec->usage.majflt = ru.ru_majflt;
+    rec->usage.vcsw = ru.ru_nvcsw;
+    rec->usage.ivcsw = ru.ru_nivcsw;
+    // statm: dimensione e pagine residenti
+    if (tel->statm_fd >= 0 && read_proc(tel->statm_fd, statm, sizeof(statm)) == 0) {
+        unsigned long pages = 0;
+        sscanf(statm, "%*u %lu", &pages);
+        rec->count = pages * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+}
+
+static void sample_thread(const struct telemetry_thread *t, struct telemetry_record *rec, long ticks) {
+    char buf[2048];
+    if (read_proc(t->stat_fd, buf, sizeof(buf)) < 0)
+        return; // thread terminato
+    // Dopo "(comm)": campo 3 stato, 10 minflt, 12 majflt, 14 utime, 15 stime
+    char *p = strrchr(buf, ')');
+    unsigned long minflt = 0, majflt = 0, utime = 0, stime = 0;
+    if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %lu %*u %lu %*u %lu %lu", &minflt, &majflt,
+                            &utime, &stime) != 4)
+        return;
+    rec->count++;
+    rec->usage.minflt += minflt;
+    rec->usage.majflt += majflt;
+    rec->usage.user_us += utime * 1000000ULL / ticks;
+    rec->usage.system_us += stime * 1000000ULL / ticks;
+    if (t->status_fd >= 0 && read_proc(t->status_fd, buf, sizeof(buf)) == 0) {
+        rec->usage.vcsw += status_value(buf, "\nvoluntary_ctxt_switches:");
+        rec->usage.ivcsw += status_value(buf, "nonvoluntary_ctxt_switches:");
+    }
+    // schedstat: tempo su CPU e in attesa in ns, piu' preciso dei tick di stat
+    unsigned long long run = 0, wait = 0;
+    if (t->schedstat_fd >= 0 && read_proc(t->schedstat_fd, buf, sizeof(buf)) == 0 &&
+        sscanf(buf, "%llu %llu", &run, &wait) == 2) {
+        rec->usage.run_ns += run;
+        rec->usage.wait_ns += wait;
+    }
+}
+
+/*
+ * Code delle socket senza passare da /proc/net/tcp, che il kernel rigenera
+ * scorrendo tutte le socket del namespace: TCP_INFO sulla socket in ascolto
+ * (tcpi_unacked e' la coda di accept, tcpi_sacked il suo massimo) e due
+ * ioctl per ogni connessione registrata dai thread delle connessioni.
+ */
+static void sample_sockets(struct telemetry *tel, struct telemetry_record *rec) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    rec->kind = TELEMETRY_SOCKET;
+    if (tel->listen_fd >= 0 && getsockopt(tel->listen_fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+        rec->sockets.listen_backlog = info.tcpi_unacked;
+        rec->sockets.listen_max = info.tcpi_sacked;
+    }
+    pthread_mutex_lock(&tel->sockets_lock);
+    for (int i = 0; i < tel->n_sockets; i++) {
+        int fd = tel->sockets[i], rx = 0, tx = 0;
+        len = sizeof(info);
+        // Le connessioni Unix non hanno TCP_INFO: contano come stabilite
+        if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 && info.tcpi_state == TCP_CLOSE_WAIT)
+            rec->sockets.close_wait++;
+        else
+            rec->count++;
+        ioctl(fd, SIOCINQ, &rx);
+        ioctl(fd, SIOCOUTQ, &tx);
+        rec->sockets.rx_queue += rx;
+        rec->sockets.tx_queue += tx;
+        rec->sockets.rx_max = (uint32_t)rx > rec->sockets.rx_max ? (uint32_t)rx : rec->sockets.rx_max;
+        rec->sockets.tx_max = (uint32_t)tx > rec->sockets.tx_max ? (uint32_t)tx : rec->sockets.tx_max;
+    }
+    pthread_mutex_unlock(&tel->sockets_lock);
+}
+
+void telemetry_socket_add(struct telemetry *tel, int fd) {
+    pthread_mutex_lock(&tel->sockets_lock);
+    if (tel->n_sockets == tel->cap_sockets) {
+        int cap = tel->cap_sockets ? 2 * tel->cap_sockets : 64;
+        int *sockets = realloc(tel->sockets, cap * sizeof(int));
+        if (sockets == NULL) {
+            pthread_mutex_unlock(&tel->sockets_lock);
+            return; // la connessione resta solo fuori dai campioni
+        }
+        tel->sockets = sockets;
+        tel->cap_sockets = cap;
+    }
+    tel->sockets[tel->n_sockets++] = fd;
+    pthread_mutex_unlock(&tel->sockets_lock);
+}
+
+void telemetry_socket_remove(struct telemetry *tel, int fd) {
+    pthread_mutex_lock(&tel->sockets_lock);
+    for (int i = 0; i < tel->n_sockets; i++) {
+        if (tel->sockets[i] == fd) {
+            tel->sockets[i] = tel->sockets[--tel->n_sockets];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&tel->sockets_lock);
+}
+
+static void sample(struct telemetry *tel, struct telemetry_record *batch, long ticks) {
+    int n = tel->workers + 2;
+    uint64_t t_ns = telemetry_now_ns(CLOCK_MONOTONIC) - tel->start_ns;
+
+    memset(batch, 0, n * sizeof(*batch));
+    sample_process(tel, &batch[0]);
+    for (int w = 0; w < tel->workers; w++) {
+        batch[1 + w].kind = TELEMETRY_WORKER;
+        batch[1 + w].id = w;
+    }
+    for (int i = 0; i < tel->n_threads; i++)
+        sample_thread(&tel->threads[i], &batch[1 + tel->threads[i].id], ticks);
+    sample_sockets(tel, &batch[n - 1]);
+
+    // I record vengono copiati prima di pubblicare il nuovo contatore: chi legge
+    // il file insieme al server non vede mai slot a meta'
+    uint64_t written = tel->header->written;
+    for (int i = 0; i < n; i++) {
+        batch[i].t_ns = t_ns;
+        tel->records[(written + i) % tel->header->capacity] = batch[i];
+    }
+    __atomic_store_n(&tel->header->written, written + n, __ATOMIC_RELEASE);
+}
+
+static void *telemetry_main(void *arg) {
+    struct telemetry *tel = arg;
+    struct telemetry_record *batch = malloc((tel->workers + 2) * sizeof(*batch));
+    long ticks = sysconf(_SC_CLK_TCK);
+    long long next = telemetry_now_ns(CLOCK_MONOTONIC);
+
+    pthread_setname_np(pthread_self(), "telemetry");
+    while (batch != NULL && !tel->stop) {
+        // Istanti assoluti: un giro lento non sposta quelli successivi
+        next += tel->period_ns;
+        struct timespec ts = {.tv_sec = next / 1000000000LL, .tv_nsec = next % 1000000000LL};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+        long long start = telemetry_now_ns(CLOCK_MONOTONIC);
+        if (start - next > tel->period_ns) {
+            __atomic_add_fetch(&tel->overruns, (start - next) / tel->period_ns, __ATOMIC_RELAXED);
+            next = start;
+        }
+        sample(tel, batch, ticks);
+        __atomic_add_fetch(&tel->busy_ns, telemetry_now_ns(CLOCK_MONOTONIC) - start, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&tel->ticks, 1, __ATOMIC_RELAXED);
+    }
+    free(batch);
+    return NULL;
+}
+
+int telemetry_start(struct telemetry *tel, int listen_fd) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    tel->listen_fd = listen_fd;
+    if (getsockname(listen_fd, (struct sockaddr *)&addr, &len) == 0 && addr.sin_family == AF_INET)
+        tel->header->port = ntohs(addr.sin_port);
+    tel->threads = calloc(TELEMETRY_MAX_THREADS, sizeof(*tel->threads));
+    if (tel->threads == NULL)
+        return -1;
+    find_threads(tel);
+    tel->header->workers = tel->workers;
+    if (pthread_create(&tel->thread, NULL, telemetry_main, tel) != 0) {
+        LOG_ERROR("event=telemetria_thread_fallito");
+        return -1;
+    }
+    // Ogni giro occupa workers + 2 record: l'anello copre storia_s secondi
+    LOG_INFO("event=telemetria_avviata workers=%d thread=%d port=%u storia_s=%.0f", tel->workers, tel->n_threads,
+             tel->header->port, tel->header->capacity * (tel->period_ns / 1e9) / (tel->workers + 2));
+    return 0;
+}
+
+void telemetry_close(struct telemetry *tel) {
+    if (tel->threads != NULL) {
+        tel->stop = 1;
+        pthread_join(tel->thread, NULL);
+        for (int i = 0; i < tel->n_threads; i++) {
+            close(tel->threads[i].stat_fd);
+            if (tel->threads[i].status_fd >= 0)
+                close(tel->threads[i].status_fd);
+            if (tel->threads[i].schedstat_fd >= 0)
+                close(tel->threads[i].schedstat_fd);
+        }
+        free(tel->threads);
+    }
+    if (tel->header != NULL)
+        munmap(tel->header, tel->mapped);
+    if (tel->statm_fd >= 0)
+        close(tel->statm_fd);
+    free(tel->sockets);
+    pthread_mutex_destroy(&tel->sockets_lock);
+    memset(tel, 0, sizeof(*tel));
+}
+
+void telemetry_report(struct telemetry *tel) {
+    unsigned long ticks = __atomic_load_n(&tel->ticks, __ATOMIC_RELAXED);
+    long long busy_ns = __atomic_load_n(&tel->busy_ns, __ATOMIC_RELAXED);
+    LOG_INFO("event=telemetria campioni=%lu giri_persi=%lu costo_medio_us=%.1f record=%llu", ticks,
+             __atomic_load_n(&tel->overruns, __ATOMIC_RELAXED), ticks > 0 ? busy_ns / 1e3 / ticks : 0.0,
+             (unsigned long long)__atomic_load_n(&tel->header->written, __ATOMIC_RELAXED));
+}
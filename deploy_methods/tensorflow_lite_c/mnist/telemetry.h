@@ -0,0 +1,119 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * Campionamento delle risorse del server dall'interno del processo.
+ *
+ * Un thread legge a frequenza fissa getrusage e /proc e scrive i campioni in
+ * un file ad anello mappato in memoria: una telemetry_header seguita da
+ * capacity record da 64 byte. Il record numero n sta nello slot
+ * n % capacity, quindi il file ha dimensione fissa e contiene sempre gli
+ * ultimi capacity campioni. Ogni giro produce:
+ *   TELEMETRY_PROCESS  getrusage(RUSAGE_SELF) e RSS da /proc/self/statm
+ *   TELEMETRY_WORKER   somma dei thread worker-N e infer-N (pool XNNPACK)
+ *                      del worker N, da /proc/self/task/<tid>/{stat,status,schedstat}
+ *   TELEMETRY_SOCKET   coda di accept della socket in ascolto e code delle
+ *                      connessioni aperte (TCP_INFO, SIOCINQ, SIOCOUTQ)
+ * I contatori sono cumulativi (i 32 bit possono ricominciare da zero: le
+ * differenze vanno fatte in aritmetica senza segno), telemetry_export li
+ * trasforma in tassi. Le pagine sono condivise con il file: i campioni
+ * sopravvivono a un crash del server e il file si puo' leggere mentre il
+ * server e' in esecuzione. Numeri nell'ordine dei byte nativo.
+ */
+
+#define TELEMETRY_MAGIC 0x31544e4du // "MNT1"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_DEFAULT_HZ 100
+#define TELEMETRY_DEFAULT_SIZE (16u << 20)
+#define TELEMETRY_MAX_THREADS 256
+
+enum telemetry_kind {
+    TELEMETRY_PROCESS = 1,
+    TELEMETRY_WORKER,
+    TELEMETRY_SOCKET
+};
+
+struct telemetry_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;     // record nell'anello
+    uint64_t period_ns;
+    int64_t start_unix_ns; // istante corrispondente a t_ns = 0
+    uint64_t written;      // record scritti dall'avvio, aggiornato dopo ogni giro
+    uint32_t workers;
+    uint32_t port;         // della socket in ascolto
+    uint64_t reserved[2];
+};
+
+// PROCESS e WORKER
+struct telemetry_usage {
+    uint64_t user_us;
+    uint64_t system_us;
+    uint64_t run_ns;  // tempo su CPU da schedstat, 0 se non disponibile (sempre per PROCESS)
+    uint64_t wait_ns; // attesa nella runqueue da schedstat
+    uint32_t minflt;
+    uint32_t majflt;
+    uint32_t vcsw;    // cambi di contesto volontari
+    uint32_t ivcsw;   // e forzati
+};
+
+// SOCKET: socket in ascolto TCP e connessioni registrate con telemetry_socket_add
+struct telemetry_sockets {
+    uint32_t listen_backlog; // connessioni in attesa di accept
+    uint32_t listen_max;
+    uint32_t close_wait;     // chiuse dal client e non ancora dal server
+    uint32_t rx_queue;       // byte ricevuti e non ancora letti, somma
+    uint32_t tx_queue;       // byte inviati e non ancora confermati, somma
+    uint32_t rx_max;
+    uint32_t tx_max;
+    uint32_t pad;
+};
+
+struct telemetry_record {
+    uint64_t t_ns;  // dall'avvio, CLOCK_MONOTONIC
+    uint16_t kind;
+    uint16_t id;    // indice del worker
+    uint32_t count; // PROCESS: RSS in KB, WORKER: thread del gruppo, SOCKET: connessioni stabilite
+    union {
+        struct telemetry_usage usage;
+        struct telemetry_sockets sockets;
+    };
+};
+
+struct telemetry_thread;
+
+struct telemetry {
+    pthread_t thread;
+    volatile int stop;
+    struct telemetry_header *header;
+    struct telemetry_record *records;
+    size_t mapped;
+    long long start_ns;
+    long long period_ns;
+    int statm_fd, listen_fd;
+    struct telemetry_thread *threads; // thread dei worker con i file gia' aperti
+    int n_threads, workers;
+    pthread_mutex_t sockets_lock;
+    int *sockets; // connessioni aperte
+    int n_sockets, cap_sockets;
+    // statistiche del campionatore
+    unsigned long ticks, overruns;
+    long long busy_ns; // tempo speso a campionare
+};
+
+// Crea (o tronca) il file ad anello di size byte
+int telemetry_open(struct telemetry *tel, const char *path, size_t size, int hz);
+// Avvia il campionamento: i worker vanno avviati prima, i loro thread
+// vengono riconosciuti dal nome
+int telemetry_start(struct telemetry *tel, int listen_fd);
+// Una connessione va tolta prima di chiuderne il descrittore
+void telemetry_socket_add(struct telemetry *tel, int fd);
+void telemetry_socket_remove(struct telemetry *tel, int fd);
+void telemetry_close(struct telemetry *tel);
+void telemetry_report(struct telemetry *tel);
+
+#endif
@@ -0,0 +1,242 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "log.h"
+#include "telemetry.h"
+
+/*
+ * Converte il file ad anello di mnist_server -r in CSV, un campione per riga,
+ * dal piu' vecchio ancora presente al piu' recente. I contatori cumulativi
+ * diventano percentuali e tassi rispetto al campione precedente della stessa
+ * entita' (vuoti nel primo). Il file si puo' leggere anche mentre il server
+ * lo sta scrivendo: i record che potrebbero essere stati sovrascritti durante
+ * la lettura vengono scartati.
+ *
+ * Con -c si aggiungono le richieste della registrazione fatta con
+ * mnist_server -C: quelle in corso all'istante del campione (con le loro
+ * righe) e quelle arrivate dal campione precedente. I due file sono allineati
+ * sull'ora di sistema registrata all'apertura di ciascuno.
+ */
+
+struct request_span {
+    long long start_unix_ns, end_unix_ns;
+    uint32_t rows;
+};
+
+// Richieste della registrazione ordinate per inizio e, a parte, per fine
+struct request_index {
+    struct request_span *by_start, *by_end;
+    size_t n, started, ended;
+    unsigned long long rows_started, rows_ended;
+};
+
+static int cmp_start(const void *a, const void *b) {
+    long long x = ((const struct request_span *)a)->start_unix_ns, y = ((const struct request_span *)b)->start_unix_ns;
+    return (x > y) - (x < y);
+}
+
+static int cmp_end(const void *a, const void *b) {
+    long long x = ((const struct request_span *)a)->end_unix_ns, y = ((const struct request_span *)b)->end_unix_ns;
+    return (x > y) - (x < y);
+}
+
+static int load_requests(const char *path, struct request_index *idx) {
+    struct capture_trace trace;
+    memset(idx, 0, sizeof(*idx));
+    if (capture_load(path, &trace) < 0)
+        return -1;
+    idx->n = trace.n_requests;
+    idx->by_start = calloc(idx->n + 1, sizeof(*idx->by_start));
+    idx->by_end = calloc(idx->n + 1, sizeof(*idx->by_end));
+    if (idx->by_start == NULL || idx->by_end == NULL) {
+        capture_trace_free(&trace);
+        return -1;
+    }
+    for (size_t i = 0; i < idx->n; i++) {
+        const struct capture_request *r = &trace.requests[i];
+        idx->by_start[i].start_unix_ns = trace.header.start_unix_ns + (long long)r->arrival_ns;
+        idx->by_start[i].end_unix_ns = idx->by_start[i].start_unix_ns + (long long)r->service_ns;
+        idx->by_start[i].rows = r->rows;
+    }
+    memcpy(idx->by_end, idx->by_start, idx->n * sizeof(*idx->by_start));
+    qsort(idx->by_start, idx->n, sizeof(*idx->by_start), cmp_start);
+    qsort(idx->by_end, idx->n, sizeof(*idx->by_end), cmp_end);
+    capture_trace_free(&trace);
+    return 0;
+}
+
+// Avanza fino all'istante t, che non deve mai diminuire tra una chiamata e l'altra
+static void requests_until(struct request_index *idx, long long t) {
+    while (idx->started < idx->n && idx->by_start[idx->started].start_unix_ns <= t)
+        idx->rows_started += idx->by_start[idx->started++].rows;
+    while (idx->ended < idx->n && idx->by_end[idx->ended].end_unix_ns <= t)
+        idx->rows_ended += idx->by_end[idx->ended++].rows;
+}
+
+static const char *kind_name(int kind) {
+    switch (kind) {
+    case TELEMETRY_PROCESS:
+        return "process";
+    case TELEMETRY_WORKER:
+        return "worker";
+    case TELEMETRY_SOCKET:
+        return "socket";
+    }
+    return "?";
+}
+
+static void print_usage(const struct telemetry_record *rec, const struct telemetry_record *prev) {
+    const struct telemetry_usage *u = &rec->usage;
+    if (prev == NULL || rec->t_ns <= prev->t_ns) {
+        printf(",,,,");
+    } else {
+        const struct telemetry_usage *p = &prev->usage;
+        double dt_us = (rec->t_ns - prev->t_ns) / 1e3;
+        double user = (u->user_us - p->user_us) / dt_us * 100, system = (u->system_us - p->system_us) / dt_us * 100;
+        // schedstat ha la precisione dei ns, stat solo quella dei tick
+        double cpu = u->run_ns > p->run_ns ? (u->run_ns - p->run_ns) / 1e3 / dt_us * 100 : user + system;
+        printf(",%.1f,%.1f,%.1f,%.1f", cpu, user, system, (u->wait_ns - p->wait_ns) / 1e3 / dt_us * 100);
+    }
+    if (rec->kind == TELEMETRY_PROCESS)
+        printf(",%u,", rec->count);
+    else
+        printf(",,%u", rec->count);
+    if (prev == NULL || rec->t_ns <= prev->t_ns) {
+        printf(",,,,");
+    } else {
+        const struct telemetry_usage *p = &prev->usage;
+        double dt_s = (rec->t_ns - prev->t_ns) / 1e9;
+        // Contatori a 32 bit: la differenza senza segno regge il giro
+        printf(",%.0f,%.0f,%.0f,%.0f", (uint32_t)(u->minflt - p->minflt) / dt_s,
+               (uint32_t)(u->majflt - p->majflt) / dt_s, (uint32_t)(u->vcsw - p->vcsw) / dt_s,
+               (uint32_t)(u->ivcsw - p->ivcsw) / dt_s);
+    }
+    printf(",,,,,,,,");
+}
+
+static void print_sockets(const struct telemetry_record *rec) {
+    const struct telemetry_sockets *s = &rec->sockets;
+    printf(",,,,,,,,,,%u,%u,%u,%u,%u,%u,%u,%u", rec->count, s->close_wait, s->listen_backlog, s->listen_max,
+           s->rx_queue, s->tx_queue, s->rx_max, s->tx_max);
+}
+
+int main(int argc, char **argv) {
+    const char *capture_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:")) != -1) {
+        switch (opt) {
+        case 'c':
+            capture_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-c capture_path] <telemetry_path>\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-c capture_path] <telemetry_path>\n", argv[0]);
+        return 1;
+    }
+    log_init("telemetry_export", STDERR_FILENO);
+
+    const char *path = argv[optind];
+    struct telemetry_header header;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        LOG_ERROR("event=apertura_file_fallita path=%s error=\"%s\"", path, fd < 0 ? strerror(errno) : "corto");
+        exit(3);
+    }
+    if (header.magic != TELEMETRY_MAGIC || header.version != TELEMETRY_VERSION ||
+        header.record_size != sizeof(struct telemetry_record) || header.capacity == 0) {
+        LOG_ERROR("event=telemetria_non_valida path=%s", path);
+        exit(3);
+    }
+    struct telemetry_record *records = malloc((size_t)header.capacity * sizeof(*records));
+    struct telemetry_record *workers = calloc(header.workers + 1, sizeof(*workers));
+    struct telemetry_record process = {0};
+    if (records == NULL || workers == NULL) {
+        LOG_ERROR("event=memoria_esaurita capacity=%u", header.capacity);
+        exit(3);
+    }
+    size_t size = (size_t)header.capacity * sizeof(*records);
+    if (pread(fd, records, size, sizeof(header)) != (ssize_t)size) {
+        LOG_ERROR("event=lettura_fallita path=%s", path);
+        exit(3);
+    }
+    // Contatore riletto dopo la copia: gli slot riscritti nel frattempo, e il
+    // giro che il server potrebbe star scrivendo, non sono affidabili
+    uint64_t written_after;
+    if (pread(fd, &written_after, sizeof(written_after), offsetof(struct telemetry_header, written)) !=
+        sizeof(written_after))
+        written_after = header.written;
+    close(fd);
+    uint64_t unsafe = written_after + header.workers + 2;
+    uint64_t first = unsafe > header.capacity ? unsafe - header.capacity : 0;
+    if (header.written > header.capacity && header.written - header.capacity > first)
+        first = header.written - header.capacity;
+
+    struct request_index requests = {0};
+    if (capture_path != NULL && load_requests(capture_path, &requests) < 0)
+        exit(3);
+
+    printf("timestamp[ns],t[ms],kind,id,cpu[%%],user[%%],system[%%],runqueue[%%],rss[kb],threads,minflt[/s],"
+           "majflt[/s],vcsw[/s],ivcsw[/s],connections,close_wait,listen_backlog,listen_max,rx_queue[bytes],"
+           "tx_queue[bytes],rx_max[bytes],tx_max[bytes]");
+    if (capture_path != NULL)
+        printf(",requests_active,rows_active,requests_arrived");
+    printf("\n");
+
+    size_t arrived_before = 0;
+    uint64_t last_t = UINT64_MAX;
+    unsigned long rows = 0;
+    for (uint64_t seq = first; seq < header.written; seq++) {
+        const struct telemetry_record *rec = &records[seq % header.capacity];
+        long long unix_ns = header.start_unix_ns + (long long)rec->t_ns;
+        printf("%lld,%.3f,%s,%u", unix_ns, rec->t_ns / 1e6, kind_name(rec->kind), rec->id);
+
+        struct telemetry_record *prev = NULL;
+        if (rec->kind == TELEMETRY_PROCESS)
+            prev = &process;
+        else if (rec->kind == TELEMETRY_WORKER && rec->id < header.workers)
+            prev = &workers[rec->id];
+        if (rec->kind == TELEMETRY_SOCKET) {
+            print_sockets(rec);
+        } else {
+            print_usage(rec, prev != NULL && prev->kind != 0 ? prev : NULL);
+            if (prev != NULL)
+                *prev = *rec;
+        }
+
+        if (capture_path != NULL) {
+            // Gli arrivi si contano una volta per giro, sul primo record; prima
+            // del primo campione non c'e' un intervallo da contare
+            if (rec->t_ns != last_t) {
+                if (last_t == UINT64_MAX)
+                    requests_until(&requests, unix_ns);
+                arrived_before = requests.started;
+                requests_until(&requests, unix_ns);
+                last_t = rec->t_ns;
+            }
+            printf(",%zu,%llu,%zu", requests.started - requests.ended, requests.rows_started - requests.rows_ended,
+                   requests.started - arrived_before);
+        }
+        printf("\n");
+        rows++;
+    }
+    LOG_INFO("event=telemetria_esportata path=%s righe=%lu record_scritti=%llu capacity=%u workers=%u", path, rows,
+             (unsigned long long)header.written, header.capacity, header.workers);
+
+    free(records);
+    free(workers);
+    free(requests.by_start);
+    free(requests.by_end);
+    log_flush();
+    return 0;
+}
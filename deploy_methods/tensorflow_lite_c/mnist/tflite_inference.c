@@ -5,13 +5,21 @@
 #include <string.h>
 #include <stdint.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
 // include tensorflow lite
 #include "tensorflow/lite/c/c_api.h"
 #include <tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h>
 
+#include "autotune.h"
+#include "log.h"
+#include "op_profile.h"
+#include "perturb.h"
+
 #define INPUT_SIZE 784 // Dimensioni delle funzionalità di input
 #define OUTPUT_SIZE 10 // Numero di classi (ad esempio, cifre 0-9)
+#define MAX_LEVELS 16  // Livelli di perturbazione valutati nello stesso passaggio
 
 // Struttura per contenere metadati per le previsioni
 struct metadata {
@@ -72,21 +80,124 @@ int get_label(FILE *file, struct metadata *data) {
     return 0; // Successo
 }
 
+static long long gettimens(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Copia una riga nel tensore, esegue l'invoke e restituisce la classe predetta
+static int classify(TfLiteInterpreter *interpreter, TfLiteTensor *input_tensor, const float *features,
+                    struct op_profile *prof, float *prediction) {
+    TfLiteTensorCopyFromBuffer(input_tensor, features, INPUT_SIZE * sizeof(float));
+    if (prof != NULL)
+        op_profile_invoke_begin(prof);
+    TfLiteInterpreterInvoke(interpreter);
+    if (prof != NULL)
+        op_profile_invoke_end(prof);
+    const TfLiteTensor *output_tensor = TfLiteInterpreterGetOutputTensor(interpreter, 0);
+    TfLiteTensorCopyToBuffer(output_tensor, prediction, OUTPUT_SIZE * sizeof(float));
+
+    int predicted_label = 0;
+    float max = 0;
+    for (int i = 0; i < OUTPUT_SIZE; i++) {
+        if (prediction[i] > max) {
+            max = prediction[i];
+            predicted_label = i;
+        }
+    }
+    return predicted_label;
+}
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <model_path>\n", argv[0]);
+    // Thread e backend fissi o scelti da autotune (una riga per invoke)
+    struct tune_config tune = {.threads = 1, .batch = 1, .xnnpack = 1};
+    int objective = -1;
+    const char *tune_path = NULL;
+    // Profilazione per operatore: tabella su stdout, timeline opzionale
+    int profile = 0;
+    const char *trace_path = NULL;
+    // Perturbazioni valutate in linea su ogni riga, oltre ai dati originali
+    struct perturb_level levels[MAX_LEVELS];
+    int n_levels = 0;
+    uint64_t seed = 42;
+    // Dati di test e tempi per riga nel formato timestamp[ns],inference_time[ns]
+    const char *data_path = "../../../mnist_test/x_test.csv";
+    const char *labels_path = "../../../mnist_test/y_test.csv";
+    const char *times_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:XA:a:pT:N:S:x:y:o:")) != -1) {
+        switch (opt) {
+        case 't':
+            tune.threads = atoi(optarg);
+            break;
+        case 'X':
+            tune.xnnpack = 0;
+            break;
+        case 'A':
+            if ((objective = autotune_parse_objective(optarg)) < 0) {
+                fprintf(stderr, "Obiettivo non valido: %s (throughput o p99)\n", optarg);
+                return 1;
+            }
+            break;
+        case 'a':
+            tune_path = optarg;
+            break;
+        case 'T':
+            trace_path = optarg;
+            // fallthrough
+        case 'p':
+            profile = 1;
+            break;
+        case 'N':
+            if (n_levels == MAX_LEVELS || perturb_parse(optarg, &levels[n_levels]) < 0) {
+                fprintf(stderr, "Perturbazione non valida: %s (es. noise:0.3, mask:0.2, noise:0.3+denoise:0.4)\n",
+                        optarg);
+                return 1;
+            }
+            n_levels++;
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'x':
+            data_path = optarg;
+            break;
+        case 'y':
+            labels_path = optarg;
+            break;
+        case 'o':
+            times_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t threads] [-X] [-A throughput|p99 [-a autotune_path]] [-p] [-T trace.json] "
+                        "[-N perturbazione]... [-S seed] [-x x_test.csv] [-y y_test.csv] [-o times.csv] <model_path>\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || tune.threads < 1) {
+        fprintf(stderr, "Usage: %s [-t threads] [-X] [-A throughput|p99 [-a autotune_path]] [-p] [-T trace.json] "
+                        "[-N perturbazione]... [-S seed] [-x x_test.csv] [-y y_test.csv] [-o times.csv] <model_path>\n", argv[0]);
         return 1;
     }
+    log_init("inference", STDERR_FILENO);
 
-    const char *model_path = argv[1];
+    const char *model_path = argv[optind];
     struct metadata data;
-    FILE *data_file = fopen("../../../mnist_test/x_test.csv", "r");
-    FILE *labels_file = fopen("../../../mnist_test/y_test.csv", "r");
-    if (!data_file && !labels_file) {
+    FILE *data_file = fopen(data_path, "r");
+    FILE *labels_file = fopen(labels_path, "r");
+    if (!data_file || !labels_file) {
         perror("Failed to open file");
         return 1;
     }
+    FILE *times_file = NULL;
+    if (times_path != NULL) {
+        if ((times_file = fopen(times_path, "w")) == NULL) {
+            perror("Failed to open times file");
+            return 1;
+        }
+        fprintf(times_file, "timestamp[ns],inference_time[ns]\n");
+    }
 
     // Carica il modello TensorFlow Lite
     TfLiteModel *model = TfLiteModelCreateFromFile(model_path);
@@ -95,14 +206,33 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    TfLiteInterpreterOptions *options = TfLiteInterpreterOptionsCreate();
-    TfLiteInterpreterOptionsSetNumThreads(options, 1); //parametro thread utilizzati
-    TfLiteXNNPackDelegateOptions xnnpack_options = TfLiteXNNPackDelegateOptionsDefault();
-    // crea xnnpackdelegate -> acceleratore per CPU (parametro utilizzabile)
-    TfLiteDelegate *xnnpack_delegate = TfLiteXNNPackDelegateCreate(&xnnpack_options);
+    if (objective >= 0) {
+        struct autotune_options tune_opts = {.path = tune_path, .model_path = model_path, .objective = objective,
+                                             .input_size = INPUT_SIZE, .workers = 1,
+                                             .batches = {1}, .n_batches = 1, .request_rows = 1};
+        autotune(&tune_opts, model, &tune);
+    }
 
-    // enable XNNPACK
-    TfLiteInterpreterOptionsAddDelegate(options, xnnpack_delegate);
+    TfLiteInterpreterOptions *options = TfLiteInterpreterOptionsCreate();
+    TfLiteInterpreterOptionsSetNumThreads(options, tune.threads); //parametro thread utilizzati
+    struct op_profile prof;
+    if (profile) {
+        if (op_profile_init(&prof, trace_path) < 0) {
+            perror("Failed to open trace file");
+            return 1;
+        }
+        op_profile_attach(&prof, options);
+    }
+    TfLiteDelegate *xnnpack_delegate = NULL;
+    if (tune.xnnpack) {
+        TfLiteXNNPackDelegateOptions xnnpack_options = TfLiteXNNPackDelegateOptionsDefault();
+        xnnpack_options.num_threads = tune.threads;
+        // crea xnnpackdelegate -> acceleratore per CPU (parametro utilizzabile)
+        xnnpack_delegate = TfLiteXNNPackDelegateCreate(&xnnpack_options);
+
+        // enable XNNPACK
+        TfLiteInterpreterOptionsAddDelegate(options, xnnpack_delegate);
+    }
 
     // Crea l'interprete del modello
     TfLiteInterpreter *interpreter = TfLiteInterpreterCreate(model, options);
@@ -125,10 +255,11 @@ int main(int argc, char *argv[]) {
     }
 
     // Inizializzazione metriche
-    const int input_size = sizeof(data.train_feature);
-    const int output_size = sizeof(data.prediction);
     int predicted_label = 0;
     int confusione_matrix[OUTPUT_SIZE][OUTPUT_SIZE] = {0}; //righe = reali, colonne = predetti
+    int level_correct[MAX_LEVELS] = {0};
+    int rows = 0;
+    float perturbed[INPUT_SIZE];
 
     // Lettura dei dati e esecuzione delle previsioni
     for(;;){
@@ -136,24 +267,26 @@ int main(int argc, char *argv[]) {
         if (get_data(data_file, &data) == -1 || get_label(labels_file, &data) == -1)
             break;
 
-        float max = 0; 
-        // Copia i dati di input nel tensore di input
-        TfLiteTensorCopyFromBuffer(input_tensor, data.train_feature, input_size);
-
-        // Esegui l'interprete per ottenere le previsioni
-        TfLiteInterpreterInvoke(interpreter);
-        // Estrai output
-        const TfLiteTensor *output_tensor = TfLiteInterpreterGetOutputTensor(interpreter, 0);
-        // Copia i risultati delle previsioni
-        TfLiteTensorCopyToBuffer(output_tensor, data.prediction, output_size);
-
-        // Ottieni la label predetta
-        for(int i=0; i<OUTPUT_SIZE; i++){
-            if(data.prediction[i] > max){
-                max = data.prediction[i];
-                predicted_label = i;
-            }
+        long long start = gettimens();
+        predicted_label = classify(interpreter, input_tensor, data.train_feature, profile ? &prof : NULL,
+                                   data.prediction);
+        if (times_file != NULL)
+            fprintf(times_file, "%lld,%lld\n", start, gettimens() - start);
+
+        // Stessa riga perturbata a ogni livello: nessun CSV intermedio su disco.
+        // Il profilo con -p resta quello delle sole righe originali
+        if (profile)
+            op_profile_suspend(&prof, 1);
+        for (int l = 0; l < n_levels; l++) {
+            memcpy(perturbed, data.train_feature, sizeof(perturbed));
+            perturb_apply(&levels[l], seed, rows, perturbed, INPUT_SIZE);
+            float prediction[OUTPUT_SIZE];
+            if (classify(interpreter, input_tensor, perturbed, NULL, prediction) == data.label)
+                level_correct[l]++;
         }
+        if (profile)
+            op_profile_suspend(&prof, 0);
+        rows++;
 
         // Aggiornamento della matrice di confusione
         for(int i=0; i<OUTPUT_SIZE; i++){
@@ -235,12 +368,34 @@ int main(int argc, char *argv[]) {
     float overall_f1_score = calculate_f1_score(overall_precision, overall_recall);
     printf("F1-Score Complessivo: %.2f\n", overall_f1_score);
 
+    if (n_levels > 0) {
+        char header[PERTURB_NAME];
+        snprintf(header, sizeof(header), "Perturbazione (seed %llu)", (unsigned long long)seed);
+        printf("\n%-36s %8s  Corrette/Totale\n", header, "Accuracy");
+        printf("%-36s %8.4f  %d/%d\n", "clean", rows > 0 ? (float)total_tp / rows : 0.0f, total_tp, rows);
+        for (int l = 0; l < n_levels; l++)
+            printf("%-36s %8.4f  %d/%d\n", levels[l].name, rows > 0 ? (float)level_correct[l] / rows : 0.0f,
+                   level_correct[l], rows);
+    }
+
+    if (profile) {
+        printf("\n");
+        op_profile_report(&prof, stdout);
+    }
+
     // Chiudi il file e pulisci le risorse
     fclose(data_file);
     fclose(labels_file);
+    if (times_file != NULL)
+        fclose(times_file);
     TfLiteInterpreterDelete(interpreter);
     TfLiteInterpreterOptionsDelete(options);
+    if (xnnpack_delegate != NULL)
+        TfLiteXNNPackDelegateDelete(xnnpack_delegate);
+    if (profile)
+        op_profile_destroy(&prof);
     TfLiteModelDelete(model);
+    log_flush();
 
     return 0;
 }
@@ -0,0 +1,568 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Controllo delle prestazioni per CTest.
+ *
+ *   perf_check gen-mnist [-n rows] [-s seed] x.csv y.csv
+ *       immagini e label sintetiche con seed fisso, nel formato di x_test.csv
+ *
+ *   perf_check run -n nome -b baseline [-r ripetizioni] [-w warmup] [-t tol]
+ *                  [-T tol_p99] [-a alpha] [-B build] [-U] [-S [-P port]] -- cmd... [-- carico...]
+ *       esegue il comando r volte; ogni esecuzione scrive i tempi per campione
+ *       nel formato timestamp[ns],inference_time[ns] (nel file @TIMES@ se
+ *       compare tra gli argomenti, altrimenti su stdout). Con -S il primo
+ *       comando e' un server: si attende la porta, si esegue il carico e lo si
+ *       termina con SIGTERM. Per ogni ripetizione si calcolano p50, p99 e
+ *       throughput; il confronto con la baseline usa la mediana delle
+ *       ripetizioni e il test di Mann-Whitney: una metrica regredisce solo se
+ *       peggiora oltre la tolleranza relativa E la differenza e' significativa.
+ *
+ * Codici di uscita: 0 ok, 1 regressione, 3 errore, 77 saltato (baseline
+ * assente o registrata su un'altra CPU o con un altro tipo di build, -B: il
+ * candidato viene scritto in nome.baseline).
+ */
+
+#define MAX_REPS 64
+#define BASELINE_VERSION 1
+#define EXIT_SKIP 77
+#define EXACT_LIMIT 400 // m*n oltre il quale si usa l'approssimazione normale
+
+enum { METRIC_P50 = 0, METRIC_P99, METRIC_THROUGHPUT, N_METRICS };
+
+static const struct metric_info {
+    const char *name;
+    int lower_better;
+} metrics[N_METRICS] = {{"p50_us", 1}, {"p99_us", 1}, {"throughput_s", 0}};
+
+struct series {
+    char cpu[160];
+    char build[32]; // CMAKE_BUILD_TYPE dei programmi misurati
+    int reps;
+    double values[N_METRICS][MAX_REPS];
+};
+
+struct run_options {
+    const char *name;
+    const char *baseline_path;
+    int reps, warmup;
+    double tolerance, tolerance_p99, alpha;
+    const char *build;
+    int update;
+    int server, port;
+    char **server_argv;
+    char **load_argv;
+};
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void cpu_model(char *buf, size_t len) {
+    char line[256];
+    snprintf(buf, len, "sconosciuta");
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (f == NULL)
+        return;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *colon = strchr(line, ':');
+        if (strncmp(line, "model name", 10) == 0 && colon != NULL) {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(buf, len, "%s x%ld", colon + 2, sysconf(_SC_NPROCESSORS_ONLN));
+            break;
+        }
+    }
+    fclose(f);
+}
+
+/* DATI SINTETICI ------------------------------------------------------------ */
+
+// Circa un quinto dei pixel acceso come nelle cifre MNIST; il contenuto non
+// cambia i tempi dei modelli densi, conta solo che sia sempre lo stesso
+static int gen_mnist(int argc, char **argv) {
+    long rows = 2000;
+    uint64_t seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            rows = atol(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            optind = argc + 1;
+        }
+    }
+    if (optind + 2 != argc || rows < 1) {
+        fprintf(stderr, "Usage: perf_check gen-mnist [-n rows] [-s seed] x.csv y.csv\n");
+        return 3;
+    }
+    FILE *x = fopen(argv[optind], "w"), *y = fopen(argv[optind + 1], "w");
+    if (x == NULL || y == NULL) {
+        fprintf(stderr, "event=apertura_file_fallita error=\"%s\"\n", strerror(errno));
+        return 3;
+    }
+    uint64_t state = seed;
+    for (long r = 0; r < rows; r++) {
+        for (int i = 0; i < 784; i++) {
+            uint64_t v = splitmix64(&state);
+            if (v % 5 == 0)
+                fprintf(x, i ? ",%.4f" : "%.4f", (v >> 40) * 0x1.0p-24);
+            else
+                fputs(i ? ",0" : "0", x);
+        }
+        fputc('\n', x);
+        fprintf(y, "%d\n", (int)(splitmix64(&state) % 10));
+    }
+    if (fclose(x) != 0 || fclose(y) != 0) {
+        fprintf(stderr, "event=scrittura_fallita error=\"%s\"\n", strerror(errno));
+        return 3;
+    }
+    return 0;
+}
+
+/* ESECUZIONE ---------------------------------------------------------------- */
+
+// stdout nel file indicato o, se NULL, insieme a stderr nel log
+static pid_t spawn(char **argv, const char *stdout_path, const char *log_path) {
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    int fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd >= 0) {
+        dup2(fd, STDERR_FILENO);
+        dup2(fd, STDOUT_FILENO);
+    }
+    if (stdout_path != NULL && (fd = open(stdout_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0)
+        dup2(fd, STDOUT_FILENO);
+    execvp(argv[0], argv);
+    fprintf(stderr, "event=exec_fallita cmd=%s error=\"%s\"\n", argv[0], strerror(errno));
+    _exit(127);
+}
+
+// Attende che il server accetti connessioni; -1 se termina o non risponde
+static int wait_port(int port, pid_t server, int timeout_s) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    for (int i = 0; i < timeout_s * 10; i++) {
+        int status;
+        if (waitpid(server, &status, WNOHANG) == server)
+            return -1;
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        int ok = sock >= 0 && connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (sock >= 0)
+            close(sock);
+        if (ok)
+            return 0;
+        usleep(100000);
+    }
+    return -1;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t n, double q) {
+    return sorted[(size_t)(q * (n - 1))];
+}
+
+// p50/p99 in microsecondi e campioni al secondo dai tempi di una ripetizione
+static long read_times(const char *path, int warmup, double out[N_METRICS]) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    size_t n = 0, cap = 4096;
+    double *latency = malloc(cap * sizeof(double));
+    long long first = 0, last = 0;
+    char line[512];
+    long seen = 0;
+    while (latency != NULL && fgets(line, sizeof(line), f) != NULL) {
+        char *end;
+        long long ts = strtoll(line, &end, 10);
+        if (end == line || *end != ',')
+            continue; // header
+        long long ns = strtoll(end + 1, NULL, 10);
+        if (seen++ < warmup)
+            continue;
+        if (n == cap)
+            latency = realloc(latency, (cap *= 2) * sizeof(double));
+        if (latency == NULL)
+            break;
+        latency[n++] = ns / 1e3;
+        if (n == 1 || ts < first)
+            first = ts;
+        if (n == 1 || ts + ns > last)
+            last = ts + ns;
+    }
+    fclose(f);
+    if (latency == NULL || n == 0) {
+        free(latency);
+        return latency == NULL ? -1 : 0;
+    }
+    qsort(latency, n, sizeof(double), cmp_double);
+    out[METRIC_P50] = percentile(latency, n, 0.50);
+    out[METRIC_P99] = percentile(latency, n, 0.99);
+    out[METRIC_THROUGHPUT] = last > first ? n * 1e9 / (last - first) : 0.0;
+    free(latency);
+    return n;
+}
+
+static int run_once(const struct run_options *o, int rep, double out[N_METRICS]) {
+    char times_path[512], log_path[512], server_log[512];
+    snprintf(times_path, sizeof(times_path), "%s.times.csv", o->name);
+    snprintf(log_path, sizeof(log_path), "%s.log", o->name);
+    snprintf(server_log, sizeof(server_log), "%s.server.log", o->name);
+    if (rep == 0) {
+        unlink(log_path);
+        unlink(server_log);
+    }
+
+    // @TIMES@ negli argomenti diventa il file dei tempi; altrimenti si usa stdout
+    int n_args = 0, substituted = 0;
+    while (o->load_argv[n_args] != NULL)
+        n_args++;
+    char *argv[n_args + 1];
+    for (int i = 0; i <= n_args; i++) {
+        argv[i] = o->load_argv[i];
+        if (argv[i] != NULL && strcmp(argv[i], "@TIMES@") == 0) {
+            argv[i] = times_path;
+            substituted = 1;
+        }
+    }
+    unlink(times_path);
+
+    pid_t server = -1;
+    if (o->server) {
+        server = spawn(o->server_argv, NULL, server_log);
+        if (server < 0 || wait_port(o->port, server, 120) < 0) {
+            fprintf(stderr, "event=server_non_pronto cmd=%s port=%d log=%s\n", o->server_argv[0], o->port, server_log);
+            if (server > 0) {
+                kill(server, SIGKILL);
+                waitpid(server, NULL, 0);
+            }
+            return -1;
+        }
+    }
+    int status = -1;
+    pid_t load = spawn(argv, substituted ? NULL : times_path, log_path);
+    if (load > 0)
+        waitpid(load, &status, 0);
+    if (server > 0) {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "event=comando_fallito cmd=%s status=%d log=%s\n", argv[0],
+                WIFEXITED(status) ? WEXITSTATUS(status) : -1, log_path);
+        return -1;
+    }
+    if (read_times(times_path, o->warmup, out) <= 0) {
+        fprintf(stderr, "event=tempi_mancanti path=%s\n", times_path);
+        return -1;
+    }
+    return 0;
+}
+
+/* BASELINE ------------------------------------------------------------------ */
+
+static int read_baseline(const char *path, struct series *s) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    char line[4096];
+    int version = 0, found = 0;
+    memset(s, 0, sizeof(*s));
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '#' || line[0] == '\0')
+            continue;
+        if (sscanf(line, "versione %d", &version) == 1)
+            continue;
+        if (strncmp(line, "cpu ", 4) == 0) {
+            snprintf(s->cpu, sizeof(s->cpu), "%.*s", (int)sizeof(s->cpu) - 1, line + 4);
+            continue;
+        }
+        if (strncmp(line, "build ", 6) == 0) {
+            snprintf(s->build, sizeof(s->build), "%.*s", (int)sizeof(s->build) - 1, line + 6);
+            continue;
+        }
+        for (int m = 0; m < N_METRICS; m++) {
+            size_t len = strlen(metrics[m].name);
+            if (strncmp(line, metrics[m].name, len) != 0 || line[len] != ' ')
+                continue;
+            int reps = 0;
+            char *p = line + len, *end;
+            for (double v; reps < MAX_REPS && (v = strtod(p, &end), end != p); p = end)
+                s->values[m][reps++] = v;
+            s->reps = found++ == 0 || reps < s->reps ? reps : s->reps;
+        }
+    }
+    fclose(f);
+    if (version != BASELINE_VERSION || found != N_METRICS || s->reps < 1) {
+        fprintf(stderr, "event=baseline_non_valida path=%s versione=%d\n", path, version);
+        return -2;
+    }
+    return 0;
+}
+
+static int write_baseline(const char *path, const char *name, const struct series *s) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "event=apertura_file_fallita path=%s error=\"%s\"\n", path, strerror(errno));
+        return -1;
+    }
+    fprintf(f, "# Baseline di perf_check: una riga per metrica, un valore per ripetizione\n");
+    fprintf(f, "versione %d\ntest %s\ncpu %s\nbuild %s\n", BASELINE_VERSION, name, s->cpu, s->build);
+    for (int m = 0; m < N_METRICS; m++) {
+        fprintf(f, "%s", metrics[m].name);
+        for (int r = 0; r < s->reps; r++)
+            fprintf(f, " %.3f", s->values[m][r]);
+        fprintf(f, "\n");
+    }
+    return fclose(f);
+}
+
+/* STATISTICA ---------------------------------------------------------------- */
+
+static double median(const double *values, int n) {
+    double sorted[MAX_REPS];
+    memcpy(sorted, values, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), cmp_double);
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+/*
+ * Probabilita' (unilaterale) che x sia peggiore di y solo per caso: U conta le
+ * coppie in cui x e' peggiore. Distribuzione esatta per campioni piccoli,
+ * con la ricorrenza f(m, n, u) = f(m-1, n, u-n) + f(m, n-1, u).
+ */
+static double mann_whitney_p(const double *x, int m, const double *y, int n, int lower_better) {
+    double u = 0;
+    for (int i = 0; i < m; i++)
+        for (int j = 0; j < n; j++) {
+            double d = lower_better ? x[i] - y[j] : y[j] - x[i];
+            u += d > 0 ? 1.0 : d == 0 ? 0.5 : 0.0;
+        }
+    if (m * n > EXACT_LIMIT) {
+        double mean = m * n / 2.0, sd = sqrt(m * n * (m + n + 1) / 12.0);
+        return 0.5 * erfc((u - 0.5 - mean) / (sd * sqrt(2.0)));
+    }
+
+    int max_u = m * n;
+    double(*f)[n + 1][max_u + 1] = calloc(m + 1, sizeof(*f));
+    if (f == NULL)
+        return 1.0;
+    for (int i = 0; i <= m; i++)
+        for (int j = 0; j <= n; j++)
+            for (int k = 0; k <= max_u; k++) {
+                if (i == 0 || j == 0)
+                    f[i][j][k] = k == 0;
+                else
+                    f[i][j][k] = (k >= j ? f[i - 1][j][k - j] : 0) + f[i][j - 1][k];
+            }
+    double total = 0, tail = 0;
+    for (int k = 0; k <= max_u; k++) {
+        total += f[m][n][k];
+        if (k >= (int)floor(u))
+            tail += f[m][n][k];
+    }
+    free(f);
+    return tail / total;
+}
+
+// Stampa il confronto metrica per metrica; restituisce il numero di regressioni
+static int report(const struct run_options *o, const struct series *base, const struct series *cur) {
+    int regressions = 0;
+    printf("perf %s: %d ripetizioni, baseline %d (%s)\n", o->name, cur->reps, base->reps, o->baseline_path);
+    printf("%-14s %12s %12s %9s %8s %8s  %s\n", "metrica", "baseline", "attuale", "delta", "soglia", "p", "esito");
+    for (int m = 0; m < N_METRICS; m++) {
+        double b = median(base->values[m], base->reps);
+        double c = median(cur->values[m], cur->reps);
+        double delta = b != 0 ? (c - b) / b : 0.0;
+        double tol = m == METRIC_P99 ? o->tolerance_p99 : o->tolerance;
+        int lower = metrics[m].lower_better;
+        double p_worse = mann_whitney_p(cur->values[m], cur->reps, base->values[m], base->reps, lower);
+        double p_better = mann_whitney_p(cur->values[m], cur->reps, base->values[m], base->reps, !lower);
+        int worse = lower ? delta > tol : delta < -tol;
+        int better = lower ? delta < -tol : delta > tol;
+        const char *esito = "ok";
+        double p = p_worse;
+        if (worse && p_worse < o->alpha) {
+            esito = "REGRESSIONE";
+            regressions++;
+        } else if (better && p_better < o->alpha) {
+            esito = "migliorato";
+            p = p_better;
+        } else if (worse || better) {
+            esito = "ok (non significativo)";
+            p = worse ? p_worse : p_better;
+        }
+        printf("%-14s %12.3f %12.3f %+8.2f%% %7.1f%% %8.4f  %s\n", metrics[m].name, b, c, delta * 100, tol * 100, p,
+               esito);
+    }
+    if (regressions > 0) {
+        printf("\nValori per ripetizione delle metriche regredite:\n");
+        for (int m = 0; m < N_METRICS; m++) {
+            double b = median(base->values[m], base->reps), c = median(cur->values[m], cur->reps);
+            double tol = m == METRIC_P99 ? o->tolerance_p99 : o->tolerance;
+            if (!(metrics[m].lower_better ? c > b * (1 + tol) : c < b * (1 - tol)))
+                continue;
+            printf("  %-12s baseline:", metrics[m].name);
+            for (int r = 0; r < base->reps; r++)
+                printf(" %.3f", base->values[m][r]);
+            printf("\n  %-12s attuale: ", "");
+            for (int r = 0; r < cur->reps; r++)
+                printf(" %.3f", cur->values[m][r]);
+            printf("\n");
+        }
+    }
+    printf("\nRISULTATO %s: %d regressioni su %d metriche\n", o->name, regressions, N_METRICS);
+    return regressions;
+}
+
+static void usage_run(void) {
+    fprintf(stderr, "Usage: perf_check run -n name -b baseline [-r reps] [-w warmup] [-t tolerance] [-T tolerance_p99] "
+                    "[-a alpha] [-B build_type] [-U] [-S [-P port]] -- cmd... [-- load_cmd...]\n");
+}
+
+static int run(int argc, char **argv) {
+    struct run_options o = {.reps = 5, .warmup = 10, .tolerance = 0.10, .tolerance_p99 = 0.25, .alpha = 0.05,
+                            .port = 30080};
+    int opt;
+    while ((opt = getopt(argc, argv, "+n:b:r:w:t:T:a:B:USP:")) != -1) {
+        switch (opt) {
+        case 'n':
+            o.name = optarg;
+            break;
+        case 'b':
+            o.baseline_path = optarg;
+            break;
+        case 'r':
+            o.reps = atoi(optarg);
+            break;
+        case 'w':
+            o.warmup = atoi(optarg);
+            break;
+        case 't':
+            o.tolerance = atof(optarg);
+            break;
+        case 'T':
+            o.tolerance_p99 = atof(optarg);
+            break;
+        case 'a':
+            o.alpha = atof(optarg);
+            break;
+        case 'B':
+            o.build = optarg;
+            break;
+        case 'U':
+            o.update = 1;
+            break;
+        case 'S':
+            o.server = 1;
+            break;
+        case 'P':
+            o.port = atoi(optarg);
+            break;
+        default:
+            usage_run();
+            return 3;
+        }
+    }
+    if (o.name == NULL || o.baseline_path == NULL || optind >= argc || o.reps < 1 || o.reps > MAX_REPS) {
+        usage_run();
+        return 3;
+    }
+    // Con -S: server fino al secondo "--", poi il carico
+    o.load_argv = &argv[optind];
+    if (o.server) {
+        o.server_argv = &argv[optind];
+        int i = optind;
+        while (i < argc && strcmp(argv[i], "--") != 0)
+            i++;
+        if (i + 1 >= argc) {
+            usage_run();
+            return 3;
+        }
+        argv[i] = NULL;
+        o.load_argv = &argv[i + 1];
+    }
+
+    struct series cur = {.reps = o.reps};
+    cpu_model(cur.cpu, sizeof(cur.cpu));
+    // Senza -B resta "sconosciuto", come in una baseline che non lo registra
+    snprintf(cur.build, sizeof(cur.build), "%s", o.build != NULL && o.build[0] != '\0' ? o.build : "sconosciuto");
+    for (int r = 0; r < o.reps; r++) {
+        double out[N_METRICS];
+        if (run_once(&o, r, out) < 0)
+            return 3;
+        for (int m = 0; m < N_METRICS; m++)
+            cur.values[m][r] = out[m];
+        fprintf(stderr, "event=ripetizione test=%s rep=%d p50_us=%.3f p99_us=%.3f throughput_s=%.1f\n", o.name, r,
+                out[METRIC_P50], out[METRIC_P99], out[METRIC_THROUGHPUT]);
+    }
+
+    if (o.update) {
+        // Prima baseline di una macchina: la sua directory non esiste ancora
+        char dir[512];
+        snprintf(dir, sizeof(dir), "%s", o.baseline_path);
+        mkdir(dirname(dir), 0755);
+        if (write_baseline(o.baseline_path, o.name, &cur) < 0)
+            return 3;
+        printf("perf %s: baseline aggiornata in %s\n", o.name, o.baseline_path);
+        return 0;
+    }
+
+    struct series base;
+    int rc = read_baseline(o.baseline_path, &base);
+    if (rc == -2)
+        return 3;
+    if (base.build[0] == '\0')
+        snprintf(base.build, sizeof(base.build), "sconosciuto");
+    if (rc < 0 || strcmp(base.cpu, cur.cpu) != 0 || strcmp(base.build, cur.build) != 0) {
+        char candidate[512];
+        snprintf(candidate, sizeof(candidate), "%s.baseline", o.name);
+        write_baseline(candidate, o.name, &cur);
+        if (rc < 0)
+            printf("perf %s: baseline %s assente, candidato scritto in %s\n", o.name, o.baseline_path, candidate);
+        else if (strcmp(base.cpu, cur.cpu) != 0)
+            printf("perf %s: baseline registrata su \"%s\", questa macchina e' \"%s\"; candidato in %s\n", o.name,
+                   base.cpu, cur.cpu, candidate);
+        else
+            printf("perf %s: baseline di una build %s, questa e' %s; candidato in %s\n", o.name, base.build,
+                   cur.build, candidate);
+        return EXIT_SKIP;
+    }
+    return report(&o, &base, &cur) > 0 ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "gen-mnist") == 0)
+        return gen_mnist(argc - 1, argv + 1);
+    if (argc >= 2 && strcmp(argv[1], "run") == 0)
+        return run(argc - 1, argv + 1);
+    fprintf(stderr, "Usage: %s gen-mnist|run ...\n", argv[0]);
+    return 3;
+}
@@ -1,8 +1,14 @@
 #define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
 #include <math.h>
+#include <netinet/in.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 #include <stdint.h>
@@ -13,6 +19,19 @@
 
 #define INPUT_SIZE 10
 #define THRESHOLD 0.1 // Threshold for anomaly detection
+#define DEFAULT_WINDOW 1000
+
+/*
+ * Servizio di regressione e anomaly detection su uno stream di campioni.
+ *
+ * Ogni campione e' una riga CSV "f1,...,f10,label" letta da file (modalita'
+ * storica, ./../data.csv) oppure da una connessione TCP o Unix: il servizio
+ * resta in ascolto e serve un produttore alla volta. Con -r i campioni
+ * vengono elaborati al ritmo indicato, con scadenze assolute per non
+ * accumulare deriva; -d fissa il budget di latenza di un campione, dalla
+ * lettura al risultato. MAE e tasso di anomalie sono calcolati su una
+ * finestra scorrevole degli ultimi campioni con aggiornamento O(1).
+ */
 
 struct times_data
 {
@@ -27,41 +46,141 @@ struct metadata
     double predicted[1]; // Store predicted values
 };
 
-// Function to calculate Mean Absolute Error
-double mean_absolute_error(double *actual, double *predicted, int size)
+struct config
+{
+    const char *model_path;
+    const char *data_path;   // modalita' file (default se non c'e' una socket)
+    const char *unix_path;
+    int port;                // 0 = nessuna socket TCP
+    double rate_hz;          // 0 = il prima possibile
+    long long budget_ns;     // 0 = nessun budget
+    int window;
+    double threshold;
+    int stats_interval;      // secondi tra i report su stderr
+};
+
+// Finestra scorrevole: somma degli errori e numero di anomalie degli ultimi size campioni
+struct window
+{
+    double *errors;
+    unsigned char *anomalies;
+    int size;
+    int count;
+    int pos;
+    double sum;
+    int anomaly_count;
+    long long updates;
+};
+
+// Statistiche cumulative di pacing e latenza
+struct stream_stats
+{
+    long long samples;
+    long long anomalies;
+    long long deadline_miss;
+    long long overruns;      // campioni partiti oltre il periodo successivo
+    long long jitter_sum_ns;
+    long long jitter_max_ns;
+    long long latency_sum_ns;
+    long long latency_max_ns;
+    long long inference_sum_ns;
+};
+
+// Input del modello in float32 o float64, in base al tipo del tensore
+struct model_io
+{
+    TfLiteInterpreter *interpreter;
+    TfLiteTensor *input_tensor;
+    const TfLiteTensor *output_tensor;
+    TfLiteType input_type;
+    TfLiteType output_type;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
 {
-    double error = 0.0;
-    for (int i = 0; i < size; i++)
+    (void)sig;
+    stop = 1;
+}
+
+int window_init(struct window *w, int size)
+{
+    memset(w, 0, sizeof(*w));
+    w->size = size;
+    w->errors = calloc(size, sizeof(double));
+    w->anomalies = calloc(size, 1);
+    return w->errors != NULL && w->anomalies != NULL ? 0 : -1;
+}
+
+void window_push(struct window *w, double error, int anomaly)
+{
+    if (w->count == w->size)
+    {
+        w->sum -= w->errors[w->pos];
+        w->anomaly_count -= w->anomalies[w->pos];
+    }
+    else
+    {
+        w->count++;
+    }
+    w->errors[w->pos] = error;
+    w->anomalies[w->pos] = anomaly;
+    w->sum += error;
+    w->anomaly_count += anomaly;
+    w->pos = (w->pos + 1) % w->size;
+
+    // La somma incrementale accumula errore di arrotondamento: ogni size
+    // aggiornamenti si ricalcola, costo ammortizzato O(1) per campione
+    if (++w->updates % w->size == 0)
     {
-        error += fabs(actual[i] - predicted[i]);
+        w->sum = 0.0;
+        for (int i = 0; i < w->count; i++)
+            w->sum += w->errors[i];
     }
-    return error / size;
+}
+
+double window_mae(const struct window *w)
+{
+    return w->count > 0 ? w->sum / w->count : 0.0;
+}
+
+double window_anomaly_rate(const struct window *w)
+{
+    return w->count > 0 ? (double)w->anomaly_count / w->count : 0.0;
 }
 
 // Function to detect anomalies based on a threshold
-int detect_anomaly(double actual, double predicted)
+int detect_anomaly(double actual, double predicted, double threshold)
 {
-    return fabs(actual - predicted) > THRESHOLD;
+    return fabs(actual - predicted) > threshold;
 }
 
-// training from streaming data coming from dataset data.csv
+// Legge un campione dallo stream; le righe non numeriche (header) vengono saltate
 int get_data(FILE *file, struct metadata *data)
 {
     char line[1024];
-    char *check = fgets(line, 1024, file);
-    if (check == NULL)
-        return -1;
-
-    char *token = strtok(line, ",");
-    for (int i = 0; i < INPUT_SIZE; i++)
+    while (fgets(line, sizeof(line), file) != NULL)
     {
-        data->train_feature[i] = atof(token);
-        token = strtok(NULL, ",");
+        char *p = line, *end;
+        int i;
+        for (i = 0; i <= INPUT_SIZE; i++)
+        {
+            double value = strtod(p, &end);
+            if (end == p)
+                break;
+            if (i < INPUT_SIZE)
+                data->train_feature[i] = value;
+            else
+                data->label[0] = value;
+            p = end;
+            while (*p == ',' || *p == ' ')
+                p++;
+        }
+        if (i == INPUT_SIZE + 1)
+            return 0;
     }
-
-    data->label[0] = atof(token);
-
-    return 0;
+    return -1;
 }
 
 #define NSEC_PER_SEC 1000000000LL
@@ -73,66 +192,308 @@ long long gettimens()
     return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
 }
 
-int main()
+void sleep_until(long long deadline)
+{
+    struct timespec ts = {.tv_sec = deadline / NSEC_PER_SEC, .tv_nsec = deadline % NSEC_PER_SEC};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !stop)
+        ;
+}
+
+// Tensori cercati una sola volta; il tipo decide la conversione dell'input
+int model_io_init(struct model_io *io, TfLiteInterpreter *interpreter)
 {
-    uint64_t start, end;
+    io->interpreter = interpreter;
+    io->input_tensor = TfLiteInterpreterGetInputTensor(interpreter, 0);
+    io->output_tensor = TfLiteInterpreterGetOutputTensor(interpreter, 0);
+    if (io->input_tensor == NULL || io->output_tensor == NULL)
+        return -1;
+    io->input_type = TfLiteTensorType(io->input_tensor);
+    io->output_type = TfLiteTensorType(io->output_tensor);
+    size_t in_elem = io->input_type == kTfLiteFloat64 ? sizeof(double) : sizeof(float);
+    size_t out_elem = io->output_type == kTfLiteFloat64 ? sizeof(double) : sizeof(float);
+    if ((io->input_type != kTfLiteFloat32 && io->input_type != kTfLiteFloat64) ||
+        (io->output_type != kTfLiteFloat32 && io->output_type != kTfLiteFloat64) ||
+        TfLiteTensorByteSize(io->input_tensor) != INPUT_SIZE * in_elem ||
+        TfLiteTensorByteSize(io->output_tensor) < out_elem)
+        return -1;
+    return 0;
+}
 
-    times.timestamp = gettimens();
-    times.run_time = 0;
+int predict(struct model_io *io, struct metadata *data)
+{
+    if (io->input_type == kTfLiteFloat32)
+    {
+        float *input = TfLiteTensorData(io->input_tensor);
+        for (int i = 0; i < INPUT_SIZE; i++)
+            input[i] = (float)data->train_feature[i];
+    }
+    else
+    {
+        memcpy(TfLiteTensorData(io->input_tensor), data->train_feature, sizeof(data->train_feature));
+    }
 
-    printf("timestamp[ns], inference_time[ns], actual, predicted, mae, anomaly_detected\n");
+    if (TfLiteInterpreterInvoke(io->interpreter) != kTfLiteOk)
+        return -1;
 
-    // load tflite model
-    TfLiteModel *model = TfLiteModelCreateFromFile("./model.tflite");
-    TfLiteInterpreterOptions *options = TfLiteInterpreterOptionsCreate();
-    // TfLiteInterpreterOptionsSetNumThreads(options, 2);
+    const void *output = TfLiteTensorData(io->output_tensor);
+    data->predicted[0] = io->output_type == kTfLiteFloat32 ? *(const float *)output : *(const double *)output;
+    return 0;
+}
 
-    // create interpreter
-    TfLiteInterpreter *interpreter = TfLiteInterpreterCreate(model, options);
-    TfLiteInterpreterAllocateTensors(interpreter);
+void print_stats(const struct config *cfg, const struct stream_stats *st, const struct window *w)
+{
+    long long n = st->samples > 0 ? st->samples : 1;
+    fprintf(stderr,
+            "event=stats samples=%lld anomalies=%lld window=%d rolling_mae=%f anomaly_rate=%f deadline_miss=%lld "
+            "budget_ns=%lld overruns=%lld jitter_mean_ns=%lld jitter_max_ns=%lld latency_mean_ns=%lld "
+            "latency_max_ns=%lld inference_mean_ns=%lld rate_hz=%g\n",
+            st->samples, st->anomalies, w->count, window_mae(w), window_anomaly_rate(w), st->deadline_miss,
+            cfg->budget_ns, st->overruns, st->jitter_sum_ns / n, st->jitter_max_ns, st->latency_sum_ns / n,
+            st->latency_max_ns, st->inference_sum_ns / n, cfg->rate_hz);
+    fflush(stdout);
+}
 
-    // get input tensor
+/*
+ * Elabora uno stream fino alla fine o a un segnale. Il ritmo e' dato da
+ * scadenze assolute: se un campione parte oltre il periodo successivo la
+ * sequenza si riallinea all'istante attuale invece di recuperare a raffica.
+ */
+void process_stream(FILE *in, const struct config *cfg, struct model_io *io, struct window *w,
+                    struct stream_stats *st, long long *next_stats)
+{
     struct metadata data;
-    FILE *file = fopen("./../data.csv", "r");
-    // skip header
-    char line[1024];
-    char *check = fgets(line, 1024, file);
+    long long period = cfg->rate_hz > 0 ? (long long)(NSEC_PER_SEC / cfg->rate_hz) : 0;
+    long long scheduled = gettimens();
 
-    for (;;)
+    while (!stop)
     {
-        if (get_data(file, &data) == -1)
+        if (period > 0)
+        {
+            sleep_until(scheduled);
+            long long jitter = gettimens() - scheduled;
+            st->jitter_sum_ns += jitter;
+            if (jitter > st->jitter_max_ns)
+                st->jitter_max_ns = jitter;
+        }
+
+        if (get_data(in, &data) == -1)
             break;
-        
+
         times.timestamp = gettimens();
-        
-        // set input as data.train_feature
-        TfLiteTensor *input_tensor = TfLiteInterpreterGetInputTensor(interpreter, 0);
-        TfLiteTensorCopyFromBuffer(input_tensor, data.train_feature, sizeof(data.train_feature));
-        
-        // run inference
-        TfLiteInterpreterInvoke(interpreter);
-        
-        // extract output
-        const TfLiteTensor *output_tensor = TfLiteInterpreterGetOutputTensor(interpreter, 0);
-        TfLiteTensorCopyToBuffer(output_tensor, data.predicted, sizeof(data.predicted));
-        
+        if (predict(io, &data) < 0)
+        {
+            fprintf(stderr, "event=invoke_fallita sample=%lld\n", st->samples);
+            break;
+        }
+        long long inference = gettimens() - times.timestamp;
+
         // Calculate metrics
-        double mae = mean_absolute_error(data.label, data.predicted, 1);
-        int anomaly_detected = detect_anomaly(data.label[0], data.predicted[0]);
+        double mae = fabs(data.label[0] - data.predicted[0]);
+        int anomaly_detected = detect_anomaly(data.label[0], data.predicted[0], cfg->threshold);
+        window_push(w, mae, anomaly_detected);
 
         times.run_time = gettimens() - times.timestamp;
+        int miss = cfg->budget_ns > 0 && times.run_time > cfg->budget_ns;
+        st->samples++;
+        st->anomalies += anomaly_detected;
+        st->deadline_miss += miss;
+        st->inference_sum_ns += inference;
+        st->latency_sum_ns += times.run_time;
+        if (times.run_time > st->latency_max_ns)
+            st->latency_max_ns = times.run_time;
 
         // Print the results
-        printf("%ld,%ld,%f,%f,%f,%d\n", times.timestamp, times.run_time, data.label[0], data.predicted[0], mae, anomaly_detected);
-        
-        // sleeping for 1ms minus the time taken to train the model
-        // usleep(2000000 - times.run_time);
+        printf("%ld,%ld,%f,%f,%f,%d,%f,%f,%d\n", times.timestamp, times.run_time, data.label[0], data.predicted[0],
+               mae, anomaly_detected, window_mae(w), window_anomaly_rate(w), miss);
+
+        long long now = gettimens();
+        if (period > 0)
+        {
+            scheduled += period;
+            if (now > scheduled + period)
+            {
+                st->overruns++;
+                scheduled = now;
+            }
+        }
+        if (cfg->stats_interval > 0 && now >= *next_stats)
+        {
+            print_stats(cfg, st, w);
+            *next_stats = now + (long long)cfg->stats_interval * NSEC_PER_SEC;
+        }
+    }
+}
+
+int open_listener(const struct config *cfg)
+{
+    int fd;
+    if (cfg->unix_path != NULL)
+    {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        if (strlen(cfg->unix_path) >= sizeof(addr.sun_path))
+            return -1;
+        strcpy(addr.sun_path, cfg->unix_path);
+        unlink(cfg->unix_path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0)
+            return -1;
+        return fd;
+    }
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(cfg->port), .sin_addr.s_addr = INADDR_ANY};
+    int opt = 1;
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0)
+        return -1;
+    return fd;
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-m model_path] [-f data_path | -p port | -u unix_socket_path] [-r rate_hz]\n"
+            "          [-d budget_us] [-w window] [-t threshold] [-s stats_interval]\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct config cfg = {.model_path = "./model.tflite", .window = DEFAULT_WINDOW, .threshold = THRESHOLD,
+                         .stats_interval = 10};
+    int opt;
+    while ((opt = getopt(argc, argv, "m:f:p:u:r:d:w:t:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            cfg.model_path = optarg;
+            break;
+        case 'f':
+            cfg.data_path = optarg;
+            break;
+        case 'p':
+            cfg.port = atoi(optarg);
+            break;
+        case 'u':
+            cfg.unix_path = optarg;
+            break;
+        case 'r':
+            cfg.rate_hz = atof(optarg);
+            break;
+        case 'd':
+            cfg.budget_ns = atoll(optarg) * 1000;
+            break;
+        case 'w':
+            cfg.window = atoi(optarg);
+            break;
+        case 't':
+            cfg.threshold = atof(optarg);
+            break;
+        case 's':
+            cfg.stats_interval = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.window < 1 || cfg.rate_hz < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (cfg.data_path == NULL && cfg.port == 0 && cfg.unix_path == NULL)
+        cfg.data_path = "./../data.csv";
+
+    // Arresto pulito: le letture bloccanti vengono interrotte
+    struct sigaction sa = {.sa_handler = on_signal};
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("timestamp[ns], inference_time[ns], actual, predicted, mae, anomaly_detected, rolling_mae, anomaly_rate, "
+           "deadline_miss\n");
+
+    // load tflite model
+    TfLiteModel *model = TfLiteModelCreateFromFile(cfg.model_path);
+    if (model == NULL)
+    {
+        fprintf(stderr, "event=modello_non_caricato path=%s\n", cfg.model_path);
+        return 1;
+    }
+    TfLiteInterpreterOptions *options = TfLiteInterpreterOptionsCreate();
+    // TfLiteInterpreterOptionsSetNumThreads(options, 2);
+
+    // create interpreter
+    TfLiteInterpreter *interpreter = TfLiteInterpreterCreate(model, options);
+    struct model_io io;
+    if (interpreter == NULL || TfLiteInterpreterAllocateTensors(interpreter) != kTfLiteOk ||
+        model_io_init(&io, interpreter) < 0)
+    {
+        fprintf(stderr, "event=tensori_non_validi path=%s\n", cfg.model_path);
+        return 1;
+    }
+
+    struct window w;
+    struct stream_stats st = {0};
+    if (window_init(&w, cfg.window) < 0)
+    {
+        fprintf(stderr, "event=memoria_insufficiente window=%d\n", cfg.window);
+        return 1;
     }
+    long long next_stats = gettimens() + (long long)cfg.stats_interval * NSEC_PER_SEC;
 
+    if (cfg.data_path != NULL)
+    {
+        FILE *file = fopen(cfg.data_path, "r");
+        if (file == NULL)
+        {
+            fprintf(stderr, "event=apertura_file_fallita path=%s error=\"%s\"\n", cfg.data_path, strerror(errno));
+            return 1;
+        }
+        process_stream(file, &cfg, &io, &w, &st, &next_stats);
+        fclose(file); // Close the file
+    }
+    else
+    {
+        int listen_fd = open_listener(&cfg);
+        if (listen_fd < 0)
+        {
+            fprintf(stderr, "event=listen_fallita error=\"%s\"\n", strerror(errno));
+            return 1;
+        }
+        if (cfg.unix_path != NULL)
+            fprintf(stderr, "event=in_ascolto path=%s\n", cfg.unix_path);
+        else
+            fprintf(stderr, "event=in_ascolto port=%d\n", cfg.port);
+        // Un produttore alla volta; finestra e statistiche proseguono tra le connessioni
+        while (!stop)
+        {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd < 0)
+                continue;
+            FILE *in = fdopen(fd, "r");
+            if (in == NULL)
+            {
+                close(fd);
+                continue;
+            }
+            fprintf(stderr, "event=produttore_connesso\n");
+            process_stream(in, &cfg, &io, &w, &st, &next_stats);
+            fclose(in);
+            fprintf(stderr, "event=produttore_disconnesso samples=%lld\n", st.samples);
+        }
+        close(listen_fd);
+        if (cfg.unix_path != NULL)
+            unlink(cfg.unix_path);
+    }
+    print_stats(&cfg, &st, &w);
+
+    free(w.errors);
+    free(w.anomalies);
     TfLiteInterpreterDelete(interpreter);
     TfLiteInterpreterOptionsDelete(options);
     TfLiteModelDelete(model);
-    fclose(file); // Close the file
 
     return 0;
-}
\ No newline at end of file
+}
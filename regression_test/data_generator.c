@@ -1,37 +1,417 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
 
 #define INPUT_SIZE 10
-#define DATASET_SIZE 1e5
+#define DATASET_SIZE 100000
 #define MAX_VALUE 8
 #define MIN_VALUE 6
+#define CHUNK_ROWS 4096  // righe generate da un thread in un colpo
+#define DECIMALS 6       // come printf("%lf")
+#define ROW_TEXT_MAX ((INPUT_SIZE + 1) * 32)
+
+/*
+ * Generatore parallelo e deterministico del dataset sintetico.
+ *
+ * Il valore della feature k della riga i dipende solo da (seed, i, k): il
+ * generatore e' a contatore (splitmix64 del contatore), quindi l'output a
+ * parita' di seed e' identico con qualsiasi numero di thread. Le righe sono
+ * divise in chunk generati in parallelo e scritti in ordine da un solo
+ * thread, su stdout o direttamente su una socket TCP/Unix, con un limite
+ * opzionale di righe al secondo. Il formato e' il CSV storico oppure, con -B,
+ * righe binarie di INPUT_SIZE + 1 double nell'ordine dei byte nativo.
+ */
+
+static const double exps[INPUT_SIZE] = {1.5, 1.1, 1, 1.9, 1, 3, 2, 1.7, 1.2, 1};
+static const double as[INPUT_SIZE] = {5, 3, 1, 1, 0, 0, 5, 4, 7, 2};
+
+struct config
+{
+    long long rows;
+    uint64_t seed;
+    int threads;
+    int binary;
+    double rate;        // righe al secondo, 0 = nessun limite
+    int chunk_rows;
+};
+
+// Chunk generato: slot di un anello condiviso tra generatori e writer
+struct chunk
+{
+    long long index;    // chunk contenuto, -1 = slot libero
+    long long next;     // unico chunk ammesso quando lo slot si libera
+    char *data;
+    size_t len;
+    int rows;
+};
+
+struct generator
+{
+    const struct config *cfg;
+    long long n_chunks;
+    struct chunk *slots;
+    int n_slots;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    long long next_chunk; // prossimo chunk da assegnare a un generatore
+};
 
-double synthetic_function(double *x)
+static inline uint64_t splitmix64(uint64_t z)
 {
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Uniforme in [0, 1) dai 53 bit alti dell'hash del contatore
+static inline double uniform(uint64_t seed, uint64_t counter)
+{
+    return (splitmix64(seed ^ splitmix64(counter)) >> 11) * 0x1.0p-53;
+}
+
+/*
+ * Valuta la funzione sintetica su n righe in forma struct-of-arrays, un ciclo
+ * senza dipendenze per termine. Gli esponenti interi diventano moltiplicazioni
+ * e quei cicli vengono vettorizzati; 1.5 usa sqrt e gli altri (1.1, 1.9, 1.7,
+ * 1.2) exp(e * log(x)), che restano scalari: senza -ffast-math la libm non ha
+ * versioni vettoriali e cambiarle altererebbe le cifre del dataset.
+ */
+static void synthetic_block(uint64_t seed, long long first_row, int n, double x[INPUT_SIZE][CHUNK_ROWS],
+                            double *y)
+{
+    for (int k = 0; k < INPUT_SIZE; k++)
+        for (int r = 0; r < n; r++)
+            x[k][r] = MIN_VALUE + (MAX_VALUE - MIN_VALUE) * uniform(seed, (uint64_t)(first_row + r) * INPUT_SIZE + k);
+
+    for (int r = 0; r < n; r++)
+        y[r] = 0;
     for (int k = 0; k < INPUT_SIZE; k++)
     {
-        x[k] = MIN_VALUE + (MAX_VALUE - MIN_VALUE) * ((double)rand() / RAND_MAX);
+        const double a = as[k], e = exps[k];
+        const double *xk = x[k];
+        if (a == 0)
+            continue;
+        if (e == 1)
+            for (int r = 0; r < n; r++)
+                y[r] += a * xk[r];
+        else if (e == 2)
+            for (int r = 0; r < n; r++)
+                y[r] += a * xk[r] * xk[r];
+        else if (e == 3)
+            for (int r = 0; r < n; r++)
+                y[r] += a * xk[r] * xk[r] * xk[r];
+        else if (e == 1.5)
+            for (int r = 0; r < n; r++)
+                y[r] += a * xk[r] * sqrt(xk[r]);
+        else
+            for (int r = 0; r < n; r++)
+                y[r] += a * exp(e * log(xk[r]));
     }
-    double exps[INPUT_SIZE] = {1.5, 1.1, 1, 1.9, 1, 3, 2, 1.7, 1.2, 1};
-    double as[INPUT_SIZE] = {5, 3, 1, 1, 0, 0, 5, 4, 7, 2};
-    double result = 0;
-    for (int i = 0; i < INPUT_SIZE; i++)
+}
+
+// Scrive value con DECIMALS cifre decimali arrotondate; restituisce i byte scritti
+static int format_fixed(char *out, double value)
+{
+    static const long long scale = 1000000; // 10^DECIMALS
+    char tmp[32];
+    int n = 0, len = 0;
+    if (value < 0)
+    {
+        out[len++] = '-';
+        value = -value;
+    }
+    long long fixed = llround(value * scale);
+    long long ip = fixed / scale, fp = fixed % scale;
+    for (int d = 0; d < DECIMALS; d++, fp /= 10)
+        tmp[n++] = '0' + fp % 10;
+    tmp[n++] = '.';
+    do
+    {
+        tmp[n++] = '0' + ip % 10;
+        ip /= 10;
+    } while (ip > 0);
+    while (n > 0)
+        out[len++] = tmp[--n];
+    return len;
+}
+
+static void generate_chunk(const struct config *cfg, long long index, struct chunk *c)
+{
+    static __thread double x[INPUT_SIZE][CHUNK_ROWS];
+    static __thread double y[CHUNK_ROWS];
+    long long first = index * cfg->chunk_rows;
+    int n = first + cfg->chunk_rows <= cfg->rows ? cfg->chunk_rows : (int)(cfg->rows - first);
+
+    synthetic_block(cfg->seed, first, n, x, y);
+    c->rows = n;
+    c->len = 0;
+    if (cfg->binary)
+    {
+        double *out = (double *)c->data;
+        for (int r = 0; r < n; r++, out += INPUT_SIZE + 1)
+        {
+            for (int k = 0; k < INPUT_SIZE; k++)
+                out[k] = x[k][r];
+            out[INPUT_SIZE] = y[r];
+        }
+        c->len = (size_t)n * (INPUT_SIZE + 1) * sizeof(double);
+        return;
+    }
+    char *p = c->data;
+    for (int r = 0; r < n; r++)
+    {
+        for (int k = 0; k < INPUT_SIZE; k++)
+        {
+            p += format_fixed(p, x[k][r]);
+            *p++ = ',';
+        }
+        p += format_fixed(p, y[r]);
+        *p++ = '\n';
+    }
+    c->len = p - c->data;
+}
+
+static void *generator_main(void *arg)
+{
+    struct generator *g = arg;
+    for (;;)
     {
-        result += as[i] * pow(x[i], exps[i]);
+        pthread_mutex_lock(&g->lock);
+        long long index = g->next_chunk++;
+        if (index >= g->n_chunks)
+        {
+            pthread_mutex_unlock(&g->lock);
+            break;
+        }
+        // Lo slot si libera quando il writer ha scritto il chunk di n_slots posizioni prima;
+        // un generatore rimasto indietro non deve farsi sorpassare da uno piu' avanti
+        struct chunk *c = &g->slots[index % g->n_slots];
+        while (c->index != -1 || c->next != index)
+            pthread_cond_wait(&g->changed, &g->lock);
+        c->index = -2; // in generazione
+        pthread_mutex_unlock(&g->lock);
+
+        generate_chunk(g->cfg, index, c);
+
+        pthread_mutex_lock(&g->lock);
+        c->index = index;
+        pthread_cond_broadcast(&g->changed);
+        pthread_mutex_unlock(&g->lock);
     }
-    return result;
+    return NULL;
 }
 
-int main()
+static int write_all(int fd, const char *buf, size_t len)
 {
-    double train_feature[INPUT_SIZE];
-    double train_label;
-    printf("x1,x2,x3,x4,x5,x6,x7,x8,x9,x10,y\n");
-    for (int i = 0; i < DATASET_SIZE; i++)
+    while (len > 0)
     {
-        train_label = synthetic_function(train_feature);
-        printf("%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf\n", train_feature[0], train_feature[1], train_feature[2], train_feature[3], train_feature[4], train_feature[5], train_feature[6], train_feature[7], train_feature[8], train_feature[9], train_label);
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK)
+            n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
     }
     return 0;
 }
+
+static long long gettimens(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// host:port per TCP, un percorso (con '/') per una socket Unix
+static int connect_output(const char *target)
+{
+    int fd;
+    if (strchr(target, '/') != NULL)
+    {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", target);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+            return fd;
+    }
+    else
+    {
+        char host[256];
+        const char *colon = strrchr(target, ':');
+        if (colon == NULL || colon - target >= (int)sizeof(host))
+            return -1;
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - target), target);
+        struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM}, *res;
+        if (getaddrinfo(host, colon + 1, &hints, &res) != 0)
+            return -1;
+        fd = socket(res->ai_family, res->ai_socktype, 0);
+        int ok = fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) == 0;
+        freeaddrinfo(res);
+        if (ok)
+            return fd;
+    }
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+    struct config cfg = {.rows = DATASET_SIZE, .seed = 1, .threads = sysconf(_SC_NPROCESSORS_ONLN)};
+    const char *target = NULL;
+    int header = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:j:Br:o:H")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            cfg.rows = atoll(optarg);
+            break;
+        case 's':
+            cfg.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'j':
+            cfg.threads = atoi(optarg);
+            break;
+        case 'B':
+            cfg.binary = 1;
+            break;
+        case 'r':
+            cfg.rate = atof(optarg);
+            break;
+        case 'o':
+            target = optarg;
+            break;
+        case 'H':
+            header = 0;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n rows] [-s seed] [-j threads] [-B] [-H] [-r rows_per_sec] "
+                            "[-o host:port|unix_socket_path]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.rows < 0 || cfg.rate < 0)
+    {
+        fprintf(stderr, "Usage: %s [-n rows] [-s seed] [-j threads] [-B] [-H] [-r rows_per_sec] "
+                        "[-o host:port|unix_socket_path]\n", argv[0]);
+        return 1;
+    }
+    if (cfg.threads < 1)
+        cfg.threads = 1;
+    // Con un limite di velocita' un chunk corrisponde a circa 1 ms di righe
+    cfg.chunk_rows = CHUNK_ROWS;
+    if (cfg.rate > 0 && cfg.rate / 1000 < CHUNK_ROWS)
+        cfg.chunk_rows = cfg.rate / 1000 >= 1 ? (int)(cfg.rate / 1000) : 1;
+
+    // Un lettore che chiude (head, server) diventa un errore di scrittura
+    signal(SIGPIPE, SIG_IGN);
+    int fd = STDOUT_FILENO;
+    if (target != NULL && (fd = connect_output(target)) < 0)
+    {
+        fprintf(stderr, "event=connect_fallita target=%s error=\"%s\"\n", target, strerror(errno));
+        return 3;
+    }
+
+    struct generator g = {.cfg = &cfg, .n_slots = 2 * cfg.threads};
+    g.n_chunks = (cfg.rows + cfg.chunk_rows - 1) / cfg.chunk_rows;
+    g.slots = calloc(g.n_slots, sizeof(*g.slots));
+    size_t chunk_bytes = (size_t)cfg.chunk_rows * (cfg.binary ? (INPUT_SIZE + 1) * sizeof(double) : ROW_TEXT_MAX);
+    for (int i = 0; g.slots != NULL && i < g.n_slots; i++)
+    {
+        g.slots[i].index = -1;
+        g.slots[i].next = i;
+        if ((g.slots[i].data = malloc(chunk_bytes)) == NULL)
+            return 3;
+    }
+    if (g.slots == NULL)
+        return 3;
+    pthread_mutex_init(&g.lock, NULL);
+    pthread_cond_init(&g.changed, NULL);
+
+    if (!cfg.binary && header)
+    {
+        static const char line[] = "x1,x2,x3,x4,x5,x6,x7,x8,x9,x10,y\n";
+        if (write_all(fd, line, sizeof(line) - 1) < 0)
+            return 3;
+    }
+
+    pthread_t *threads = calloc(cfg.threads, sizeof(*threads));
+    if (threads == NULL)
+        return 3;
+    for (int i = 0; i < cfg.threads; i++)
+        pthread_create(&threads[i], NULL, generator_main, &g);
+
+    // Writer: chunk in ordine, eventualmente al ritmo richiesto
+    long long start = gettimens(), written = 0, limit = g.n_chunks;
+    int ret = 0;
+    for (long long index = 0; index < limit; index++)
+    {
+        struct chunk *c = &g.slots[index % g.n_slots];
+        pthread_mutex_lock(&g.lock);
+        while (c->index != index)
+            pthread_cond_wait(&g.changed, &g.lock);
+        pthread_mutex_unlock(&g.lock);
+
+        if (cfg.rate > 0)
+        {
+            long long due = start + (long long)(written / cfg.rate * 1e9);
+            struct timespec ts = {.tv_sec = due / 1000000000LL, .tv_nsec = due % 1000000000LL};
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                ;
+        }
+        int failed = ret == 0 && write_all(fd, c->data, c->len) < 0;
+        if (failed)
+        {
+            fprintf(stderr, "event=scrittura_fallita rows=%lld error=\"%s\"\n", written, strerror(errno));
+            ret = 3;
+        }
+        else if (ret == 0)
+        {
+            written += c->rows;
+        }
+
+        pthread_mutex_lock(&g.lock);
+        c->index = -1;
+        c->next = index + g.n_slots;
+        // Dopo un errore non si assegnano altri chunk: si scartano solo quelli gia' in corso
+        if (failed)
+        {
+            limit = g.next_chunk < g.n_chunks ? g.next_chunk : g.n_chunks;
+            g.next_chunk = g.n_chunks;
+        }
+        pthread_cond_broadcast(&g.changed);
+        pthread_mutex_unlock(&g.lock);
+    }
+    for (int i = 0; i < cfg.threads; i++)
+        pthread_join(threads[i], NULL);
+
+    double elapsed = (gettimens() - start) / 1e9;
+    fprintf(stderr, "event=dataset_generato rows=%lld seed=%llu threads=%d format=%s s=%.3f rows_s=%.0f\n", written,
+            (unsigned long long)cfg.seed, cfg.threads, cfg.binary ? "binary" : "csv", elapsed,
+            elapsed > 0 ? written / elapsed : 0.0);
+    for (int i = 0; i < g.n_slots; i++)
+        free(g.slots[i].data);
+    free(g.slots);
+    free(threads);
+    if (fd != STDOUT_FILENO)
+        close(fd);
+    return ret;
+}